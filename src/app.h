@@ -29,6 +29,7 @@ typedef struct App {
     int show_crt_info;
     int show_neighbours;
     int show_perception;
+    int show_contacts;
 
 } App;
 
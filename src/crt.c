@@ -7,6 +7,10 @@
 
 #include "app.h"
 #include "crt.h"
+#include "force.h"
+#include "lqtree.h"
+#include "pool.h"
+#include "sgrid.h"
 #include "qtree.h" // toto remove
 #include "utils.h"
 #include "vec2.h"
@@ -16,13 +20,17 @@
 #define CRT_EVT_TARG_REACHED = 1;
 #define CRT_EVT_BOUNDS_REACHED = 2;
 
+#define CRT_UPDATE_CHUNK_MIN 16 // creatures per chunk of crt_update_all()
+#define CRT_UPDATE_CHUNKS 8     // chunks per worker (at least), for balancing
+#define CRT_FORCE_BATCH 64      // streamed neighbours per force_sum()
+
 const char crt_type_names[][CRT_NAME_LEN] = {"CRT_TYPE_NONE", "CRT_TYPE_HERBIVORE", "CRT_TYPE_CARNIVORE"};
 const char crt_status_names[][CRT_NAME_LEN] = {"CRT_STATUS_NONE", "CRT_STATUS_DEAD", "CRT_STATUS_ALIVE"};
 
 
 static void _draw_circle(Vec2 pos, float r, size_t segments) {
     glBegin(GL_LINE_LOOP);
-    for (int i = 0; i < segments; i++)   {
+    for (size_t i = 0; i < segments; i++)   {
         float theta = 2.0f * M_PI * (float)i / (float) segments;
         float x = r * cosf(theta);
         float y = r * sinf(theta);
@@ -35,156 +43,704 @@ static void _draw_circle(Vec2 pos, float r, size_t segments) {
 // Crt
 ////
 
-Creature *crt_create(unsigned int id) {
-    // Creature crt = { id, {0}, CRT_TYPE_NONE, CRT_STATUS_NONE, 0, 0, 0, {CRT_POS_NONE, CRT_POS_NONE}, {CRT_POS_NONE, CRT_POS_NONE}  };
-    Creature *crt = calloc(sizeof(Creature), 1);
-    EXIT_IF_F(crt == NULL, "failed to allocate memory for creature %d", id);
+CrtStore *crt_store_create(size_t max) {
+    CrtStore *crts = calloc(sizeof(CrtStore), 1);
+    EXIT_IF(crts == NULL, "failed to allocate memory for CrtStore");
+
+    crts->len = 0;
+    crts->max = 0;
+    crts->slots_len = 0;
+    crts->free = CRT_SLOT_NONE;
+    EXIT_IF(crt_store_reserve(crts, (max) ? max : 1) != 0, "failed to allocate memory for CrtStore arrays");
+    return crts;
+}
+
+static int _crt_realloc(void **ptr, size_t max, size_t sz) {
+    void *tmp = realloc(*ptr, max * sz);
+    if (!tmp) {
+        return -1;
+    }
+    *ptr = tmp;
+    return 0;
+}
+
+/**
+ * Grows the capacity of the store to (at least) max creatures.
+ * Returns -1 if an allocation failed, the store keeps its capacity and creatures.
+ */
+int crt_store_reserve(CrtStore *crts, size_t max) {
+    if (!crts) {
+        return -1;
+    }
+    if (max <= crts->max) {
+        return 0;
+    }
+    if (max > CRT_SLOT_NONE) {
+        LOG_ERROR_F("CrtStore capacity %ld exceeds the number of handle slots", max);
+        return -1;
+    }
+
+    if (_crt_realloc((void **)&crts->pos, max, sizeof(Vec2))
+        || _crt_realloc((void **)&crts->targ, max, sizeof(Vec2))
+        || _crt_realloc((void **)&crts->pos_next, max, sizeof(Vec2))
+        || _crt_realloc((void **)&crts->targ_next, max, sizeof(Vec2))
+        || _crt_realloc((void **)&crts->mass, max, sizeof(float))
+        || _crt_realloc((void **)&crts->agility, max, sizeof(float))
+        || _crt_realloc((void **)&crts->perception, max, sizeof(float))
+        || _crt_realloc((void **)&crts->size, max, sizeof(float))
+        || _crt_realloc((void **)&crts->type, max, sizeof(CrtType))
+        || _crt_realloc((void **)&crts->seed, max, sizeof(unsigned int))
+        || _crt_realloc((void **)&crts->info, max, sizeof(Creature))
+        || _crt_realloc((void **)&crts->slots, max, sizeof(CrtSlot))) {
+        LOG_ERROR_F("failed to re-allocate memory for %ld creatures", max);
+        return -1;
+    }
+
+    crts->max = max;
+    return 0;
+}
+
+/**
+ * Appends an unborn creature (see crt_birth()) and returns its handle, O(1) amortized: the store doubles when full,
+ * slots of dead creatures are reused first.
+ * Returns CRT_HANDLE_NONE if growing failed.
+ */
+CrtHandle crt_store_spawn(CrtStore *crts) {
+    if (!crts) {
+        return CRT_HANDLE_NONE;
+    }
+    if (crts->len >= crts->max && crt_store_reserve(crts, 2 * crts->max) != 0) {
+        return CRT_HANDLE_NONE;
+    }
+
+    unsigned int slot;
+    if (crts->free != CRT_SLOT_NONE) {
+        slot = crts->free;
+        crts->free = crts->slots[slot].index;
+    } else {
+        slot = crts->slots_len++;
+        crts->slots[slot].gen = 1;
+    }
+
+    size_t i = crts->len++;
+    CrtHandle handle = {slot, crts->slots[slot].gen};
+    crts->slots[slot].index = i;
+
+    crts->pos[i] = (Vec2){CRT_POS_NONE, CRT_POS_NONE};
+    crts->targ[i] = (Vec2){CRT_POS_NONE, CRT_POS_NONE};
+    crts->pos_next[i] = crts->pos[i];
+    crts->targ_next[i] = crts->targ[i];
+    crts->mass[i] = 0;
+    crts->agility[i] = 0;
+    crts->perception[i] = 0;
+    crts->size[i] = 0;
+    crts->type[i] = CRT_TYPE_NONE;
+    crts->seed[i] = rand() | 1; // never 0, see _crt_rand()
+    crts->info[i] = (Creature){handle, {0}, CRT_STATUS_NONE};
+    return handle;
+}
+
+/**
+ * Removes a creature in O(1): the last creature is moved into its place (its handle stays valid)
+ * and the slot is freed for reuse under the next generation. Between steps only, the next state is not moved.
+ * Returns 1 if the handle is not (or no longer) valid.
+ */
+int crt_store_despawn(CrtStore *crts, CrtHandle handle) {
+    long i = crt_store_index(crts, handle);
+    if (i < 0) {
+        return 1;
+    }
 
-    crt->id = id;
-    crt->pos = (Vec2){CRT_POS_NONE, CRT_POS_NONE};
-    crt->targ = (Vec2){CRT_POS_NONE, CRT_POS_NONE};
-    return crt;
+    size_t last = --crts->len;
+    if ((size_t)i != last) {
+        crts->pos[i] = crts->pos[last];
+        crts->targ[i] = crts->targ[last];
+        crts->mass[i] = crts->mass[last];
+        crts->agility[i] = crts->agility[last];
+        crts->perception[i] = crts->perception[last];
+        crts->size[i] = crts->size[last];
+        crts->type[i] = crts->type[last];
+        crts->seed[i] = crts->seed[last];
+        crts->info[i] = crts->info[last];
+        crts->slots[crts->info[i].handle.slot].index = i;
+    }
+
+    CrtSlot *slot = &crts->slots[handle.slot];
+    slot->gen = (slot->gen + 1) ? slot->gen + 1 : 1;
+    slot->index = crts->free;
+    crts->free = handle.slot;
+    return 0;
 }
 
-Creature *crt_birth(int id, char *name, CrtType type, Vec2 pos) {
-    Creature *crt = crt_create(id);
-    strncpy(crt->name, name, CRT_NAME_LEN);
+/**
+ * Makes the next state of the step current (see CrtStore)
+ */
+void crt_store_swap(CrtStore *crts) {
+    if (!crts) {
+        return;
+    }
+
+    Vec2 *tmp = crts->pos;
+    crts->pos = crts->pos_next;
+    crts->pos_next = tmp;
+
+    tmp = crts->targ;
+    crts->targ = crts->targ_next;
+    crts->targ_next = tmp;
+}
+
+/**
+ * Current index of a creature in the arrays, -1 if the handle is not (or no longer) valid
+ */
+long crt_store_index(CrtStore *crts, CrtHandle handle) {
+    if (!crts || handle.slot >= crts->slots_len || !handle.gen || crts->slots[handle.slot].gen != handle.gen) {
+        return -1;
+    }
+    return crts->slots[handle.slot].index;
+}
+
+void crt_store_destroy(CrtStore *crts) {
+    if (!crts) {
+        return;
+    }
+    freez(crts->pos);
+    freez(crts->targ);
+    freez(crts->pos_next);
+    freez(crts->targ_next);
+    freez(crts->mass);
+    freez(crts->agility);
+    freez(crts->perception);
+    freez(crts->size);
+    freez(crts->type);
+    freez(crts->seed);
+    freez(crts->info);
+    freez(crts->slots);
+    freez(crts);
+}
+
+/**
+ * Gives birth to a creature with minimal attributes, appended to the world's population.
+ * Returns CRT_HANDLE_NONE if the population could not grow.
+ */
+CrtHandle crt_birth(World *world, char *name, CrtType type, Vec2 pos) {
+    if (!world || !world->crts) {
+        return CRT_HANDLE_NONE;
+    }
+
+    CrtStore *crts = world->crts;
+    CrtHandle handle = crt_store_spawn(crts);
+    if (!handle.gen) {
+        return handle;
+    }
+    if (world_reserve(world, crts->max) != 0) {
+        crt_store_despawn(crts, handle);
+        return CRT_HANDLE_NONE;
+    }
+
+    size_t i = crts->len - 1;
+    strncpy(crts->info[i].name, name, CRT_NAME_LEN);
+    crts->info[i].name[CRT_NAME_LEN - 1] = '\0';
+    crts->info[i].status = CRT_STATUS_ALIVE;
+
+    crts->type[i] = type;
+    crts->agility[i] = CRT_MIN_AGILITY;
+    crts->size[i] = CRT_MIN_SIZE;
+    crts->mass[i] = CRT_MIN_MASS;
+    crts->perception[i] = CRT_MIN_PERCEPTION;
+
+    crts->pos[i] = pos;
+    crts->targ[i] = pos;
+    crts->pos_next[i] = pos;
+    crts->targ_next[i] = pos;
+    return handle;
+}
 
-    crt->type = type;
-    crt->status = CRT_STATUS_ALIVE;
+/**
+ * Removes a creature from the world's population (between frames: the neighbour table and far field of the current
+ * frame are stale until the next world_update()).
+ * Returns 1 if the handle is not (or no longer) valid.
+ */
+int crt_death(World *world, CrtHandle handle) {
+    if (!world || !world->crts) {
+        return 1;
+    }
 
-    crt->agility = CRT_MIN_AGILITY;
-    crt->size = CRT_MIN_SIZE;
-    crt->mass = CRT_MIN_MASS;
+    CrtStore *crts = world->crts;
+    long i = crt_store_index(crts, handle);
+    if (i < 0) {
+        return 1;
+    }
 
-    crt->perception = CRT_MIN_PERCEPTION;
+    size_t last = crts->len - 1;
+    world_unindex(world, i);
+    crt_store_despawn(crts, handle);
+    if ((size_t)i != last) {
+        world_reindex(world, last, i);
+    }
+    return 0;
+}
 
-    crt->pos = pos;
-    crt->targ = pos;
-    return crt;
+/**
+ * Random number 0..1 from a creature's own state (xorshift32)
+ */
+static float _crt_rand(unsigned int *seed) {
+    unsigned int x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x / (float)UINT_MAX;
 }
 
-void crt_destroy(Creature *crt) {
-    // provision for future complexities
-    freez(crt);
+/**
+ * Random target of creature i within max_radius from pos (see vec2_rand_from())
+ */
+static Vec2 _crt_random_targ(World *world, size_t i, Vec2 pos, float max_radius) {
+    unsigned int *seed = &world->crts->seed[i];
+    PVec2 p = {
+        .r = (2.f * _crt_rand(seed) - 1.f) * max_radius,
+        .phi = _crt_rand(seed) * 2.f * M_PI // radians
+    };
+    Vec2 delta = vec2_add(pos, vec2_polar_to_cartesian(p));
+
+    if (world->wrap) {
+        delta = world_wrap(world, delta); // reached the short way around, see crt_update()
+    } else {
+        delta.x = clamp_f(delta.x, 0, WORLD_WIDTH(world));
+        delta.y = clamp_f(delta.y, 0, WORLD_HEIGHT(world));
+    }
+    return delta;
 }
 
-int crt_random_targ(Creature *crt, World *world, float max_radius) {
-    if (!crt || !world) {
+/**
+ * Sets a random (current) target, between steps
+ */
+int crt_random_targ(World *world, size_t i, float max_radius) {
+    if (!world || i >= world->crts->len) {
         return 1;
     }
 
-    Vec2 delta = vec2_rand_from(crt->pos, max_radius);
+    world->crts->targ[i] = _crt_random_targ(world, i, world->crts->pos[i], max_radius);
+    return 0;
+}
 
-    delta = vec2_add(crt->pos, delta);
-    delta.x = clamp_f(delta.x, 0, WORLD_WIDTH(world));
-    delta.y = clamp_f(delta.y, 0, WORLD_HEIGHT(world));
+////
+// Neighbours
+////
 
-    crt->targ = delta;
+/**
+ * Grows the arrays of a neighbour buffer to max neighbours, returns -1 if an allocation failed (the buffer keeps its capacity)
+ */
+static int _crt_neighbours_reserve(CrtNeighbours *neighbours, size_t max) {
+    if (_crt_realloc((void **)&neighbours->x, max, sizeof(float))
+        || _crt_realloc((void **)&neighbours->y, max, sizeof(float))
+        || _crt_realloc((void **)&neighbours->mass, max, sizeof(float))
+        || _crt_realloc((void **)&neighbours->dist2, max, sizeof(float))
+        || _crt_realloc((void **)&neighbours->type, max, sizeof(int))
+        || _crt_realloc((void **)&neighbours->index, max, sizeof(unsigned int))) {
+        return -1;
+    }
+    neighbours->max = max;
     return 0;
 }
 
-static int _crt_apply_neighbours(Creature *crt, App *app, World *world, QuadList *neighbours) {
-    if (!neighbours->len) {
-        return 0;
+CrtNeighbours *crt_neighbours_create(size_t max) {
+    CrtNeighbours *neighbours = calloc(1, sizeof(CrtNeighbours));
+    if (!neighbours) {
+        LOG_ERROR("failed to allocate memory for CrtNeighbours");
+        return NULL;
     }
 
-    Creature *other;
-    Vec2 delta, accl;
-    float dist, force, attraction, speed;
-    Rule *attr_rule;
-    int dirx, diry;
+    neighbours->len = 0;
+    neighbours->list = qlist_create((max) ? max : 1);
+    if (_crt_neighbours_reserve(neighbours, (max) ? max : 1) != 0 || !neighbours->list) {
+        LOG_ERROR("failed to allocate memory for CrtNeighbours items");
+        crt_neighbours_destroy(neighbours);
+        return NULL;
+    }
+    return neighbours;
+}
 
-    size_t count = 0; // affected
-    for (size_t i = 0; i < neighbours->len; i++) {
-        other = (Creature *)neighbours->nodes[i]->data;
-        if (!other || other->id == crt->id) {
-            continue;
-        }
+/**
+ * Copies a neighbour into the buffer, doubles the capacity if it is full.
+ * Returns -1 if growing failed (the buffer keeps its items).
+ */
+int crt_neighbours_append(CrtNeighbours *neighbours, CrtStore *crts, size_t index, float dist2) {
+    if (!neighbours || !crts || index >= crts->len) {
+        return -1;
+    }
 
-        delta = vec2_sub(crt->pos, other->pos);
-        dist = vec2_mag(delta);
-        if (dist == 0 || dist >= crt->perception) {
-            continue;
-        }
+    if (neighbours->len >= neighbours->max && _crt_neighbours_reserve(neighbours, 2 * neighbours->max) != 0) {
+        LOG_ERROR("failed to re-allocate memory for CrtNeighbours items");
+        return -1;
+    }
 
-        // this is a variation of Newton's law of universal gravitation using attraction values instead of gravitation
-        attr_rule = rules_get(world->rules, crt->type, other->type);
-        attraction =  (attr_rule) ? attr_rule->val : 1.0f;
+    size_t n = neighbours->len++;
+    neighbours->x[n] = crts->pos[index].x;
+    neighbours->y[n] = crts->pos[index].y;
+    neighbours->mass[n] = crts->mass[index];
+    neighbours->dist2[n] = dist2;
+    neighbours->type[n] = crts->type[index];
+    neighbours->index[n] = index;
+    return 0;
+}
 
-        force = attraction * ((crt->mass * other->mass) / (dist * dist));
-        // force = GRAVITY * ((crt->mass * other->mass) / (dist * dist));
+void crt_neighbours_reset(CrtNeighbours *neighbours) {
+    if (!neighbours) {
+        return;
+    }
+    neighbours->len = 0;
+    qlist_reset(neighbours->list);
+}
 
-        // bounds
-        dirx = (crt->pos.x < world->nw.x || crt->pos.x > world->se.x) ? 1 : -1;
-        diry = (crt->pos.y < world->nw.y || crt->pos.y > world->se.y) ? 1 : -1;
+void crt_neighbours_destroy(CrtNeighbours *neighbours) {
+    if (!neighbours) {
+        return;
+    }
+    freez(neighbours->x);
+    freez(neighbours->y);
+    freez(neighbours->mass);
+    freez(neighbours->dist2);
+    freez(neighbours->type);
+    freez(neighbours->index);
+    qlist_destroy(neighbours->list);
+    freez(neighbours);
+}
 
-        speed = crt->agility * 25.0; // TODO dynamic
+_Static_assert(CRT_TYPE_MAX <= FORCE_CLASSES, "creature types exceed the attraction table of the force kernels");
 
-        accl = (Vec2){
-            force * delta.x * speed * dirx,
-            force * delta.y * speed * diry, // TODO
-        };
+/**
+ * Sets up creature i as the body of the force kernels: attraction by neighbour type (rules_get(), 1 without rule)
+ */
+static void _crt_force_body(size_t i, World *world, ForceBody *body) {
+    CrtStore *crts = world->crts;
+    Rule *attr_rule;
+
+    body->pos = crts->pos[i];
+    body->mass = crts->mass[i];
+    body->range2 = crts->perception[i] * crts->perception[i];
+    body->wrap = (world->wrap) ? (Vec2){world->se.x - world->nw.x, world->se.y - world->nw.y} : (Vec2){0.f, 0.f};
+    for (int type = 0; type < FORCE_CLASSES; type++) {
+        attr_rule = (type < CRT_TYPE_MAX) ? rules_get(world->rules, crts->type[i], type) : NULL;
+        body->attraction[type] = (attr_rule) ? attr_rule->val : 1.0f;
+    }
+}
+
+/**
+ * Neighbours which are not collected (streamed from the qtree, all-pairs table rows), summed in batches
+ */
+typedef struct CrtBatch {
+    CrtStore *crts;
+    ForceLevel level;
+    ForceBody body;
+    size_t len;
+    float x[CRT_FORCE_BATCH];
+    float y[CRT_FORCE_BATCH];
+    float mass[CRT_FORCE_BATCH];
+    float dist2[CRT_FORCE_BATCH];
+    int type[CRT_FORCE_BATCH];
+    Vec2 accl; // sum of force * delta
+    size_t count; // affected
+} CrtBatch;
+
+static void _crt_batch_init(CrtBatch *batch, size_t i, World *world) {
+    batch->crts = world->crts;
+    batch->level = world->simd;
+    _crt_force_body(i, world, &batch->body);
+    batch->len = 0;
+    batch->accl = (Vec2){0.f, 0.f};
+    batch->count = 0;
+}
+
+static void _crt_batch_flush(CrtBatch *batch) {
+    ForceBatch view = {batch->len, batch->x, batch->y, batch->mass, batch->dist2, batch->type};
+    batch->count += force_sum(batch->level, &batch->body, &view, &batch->accl);
+    batch->len = 0;
+}
 
-        // printf("%d(%d) -> %d(%d): force %f, attr: %f, accl { %f, %f }\n", crt->id, crt->type, other->id, other->type, force, attraction, accl.x, accl.y);
-        crt->pos.x += accl.x;
-        crt->pos.y += accl.y;
+static void _crt_batch_add(CrtBatch *batch, size_t other, float dist2) {
+    CrtStore *crts = batch->crts;
+    if (other >= crts->len) {
+        return;
+    }
 
-        count++;
+    size_t n = batch->len++;
+    batch->x[n] = crts->pos[other].x;
+    batch->y[n] = crts->pos[other].y;
+    batch->mass[n] = crts->mass[other];
+    batch->dist2[n] = dist2;
+    batch->type[n] = crts->type[other];
+    if (batch->len == CRT_FORCE_BATCH) {
+        _crt_batch_flush(batch);
     }
+}
 
+/**
+ * Moves creature i by the sum of force * delta of its neighbours: writes the next position from the current one
+ */
+static void _crt_move(size_t i, World *world, Vec2 accl) {
+    CrtStore *crts = world->crts;
+    Vec2 pos = crts->pos[i];
+
+    // bounds
+    int dirx = (pos.x < world->nw.x || pos.x > world->se.x) ? 1 : -1;
+    int diry = (pos.y < world->nw.y || pos.y > world->se.y) ? 1 : -1;
+
+    float speed = crts->agility[i] * 25.0; // TODO dynamic
+
+    crts->pos_next[i].x = pos.x + accl.x * speed * dirx;
+    crts->pos_next[i].y = pos.y + accl.y * speed * diry; // TODO
+}
+
+static int _crt_apply_neighbours(size_t i, World *world, CrtNeighbours *neighbours) {
+    ForceBody body;
+    ForceBatch batch = {neighbours->len, neighbours->x, neighbours->y, neighbours->mass, neighbours->dist2, neighbours->type};
+    Vec2 accl = {0.f, 0.f};
+
+    _crt_force_body(i, world, &body);
+    size_t count = force_sum(world->simd, &body, &batch, &accl); // affected
+
+    if (count) {
+        _crt_move(i, world, accl);
+    }
     return count;
 }
 
+static int _crt_visit_neighbour(QuadItem *item, float dist2, void *ctx) {
+    _crt_batch_add(ctx, CRT_INDEX(item->data), dist2);
+    return QUAD_VISIT_CONTINUE;
+}
+
+/**
+ * Applies the creature's row of the frame's all-pairs neighbour table
+ */
+static int _crt_apply_pairs(size_t i, World *world) {
+    QuadPairs *pairs = world->pairs;
+    if (i >= pairs->len) {
+        return 0;
+    }
+
+    CrtBatch batch;
+    _crt_batch_init(&batch, i, world);
+    for (size_t n = pairs->offsets[i]; n < pairs->offsets[i + 1]; n++) {
+        _crt_batch_add(&batch, pairs->indices[n], pairs->dist2[n]);
+    }
+    _crt_batch_flush(&batch);
+
+    if (batch.count) {
+        _crt_move(i, world, batch.accl);
+    }
+    return batch.count;
+}
+
+/**
+ * Applies neighbours as they are streamed from the qtree, without collecting them.
+ */
+static int _crt_stream_neighbours(size_t i, World *world) {
+    CrtStore *crts = world->crts;
+    CrtBatch batch;
+    _crt_batch_init(&batch, i, world);
+
+    unsigned int mask = rules_mask(world->rules, crts->type[i], CRT_TYPE_MAX);
+    qtree_visit_radius_mask(world->qtree, crts->pos[i], crts->perception[i], mask, _crt_visit_neighbour, &batch);
+    _crt_batch_flush(&batch);
+
+    if (batch.count) {
+        _crt_move(i, world, batch.accl);
+    }
+    return batch.count;
+}
+
+typedef struct CrtVisit {
+    size_t i;
+    World *world;
+    Vec2 accl; // sum of force * delta
+    size_t count; // affected
+} CrtVisit;
+
+static int _crt_visit_mass(Vec2 com, float mass, int class, QuadItem *item, void *ctx) {
+    CrtVisit *field = ctx;
+    CrtStore *crts = field->world->crts;
+    size_t i = field->i;
+
+    if (item && CRT_INDEX(item->data) == i) {
+        return QUAD_VISIT_CONTINUE;
+    }
+
+    Vec2 delta = world_delta(field->world, crts->pos[i], com);
+    float dist2 = delta.x * delta.x + delta.y * delta.y;
+    if (dist2 == 0) {
+        return QUAD_VISIT_CONTINUE;
+    }
+    dist2 = fmaxf(dist2, CRT_MIN_DIST * CRT_MIN_DIST); // softening: close encounters don't explode
+
+    // same law as force_sum(), class is the type of the aggregated creatures
+    Rule *attr_rule = rules_get(field->world->rules, crts->type[i], class);
+    float attraction = (attr_rule) ? attr_rule->val : 1.0f;
+    float force = attraction * ((crts->mass[i] * mass) / dist2);
+
+    field->accl.x += force * delta.x;
+    field->accl.y += force * delta.y;
+    field->count++;
+    return QUAD_VISIT_CONTINUE;
+}
+
 /**
- * Main loop: update
+ * Applies the whole world at once (Barnes-Hut, see qmass_visit()): near creatures exactly, far nodes by the
+ * center of mass of each type. Not limited by perception.
  */
-int crt_update(Creature *crt, App *app, World *world, QuadList *neighbours) {
-    if (!crt || !app || !world) {
+static int _crt_apply_far_field(size_t i, World *world) {
+    CrtVisit field = {i, world, {0.f, 0.f}, 0};
+    qmass_visit(world->mass, world->crts->pos[i], world->theta, _crt_visit_mass, &field);
+
+    if (field.count) {
+        _crt_move(i, world, field.accl);
+    }
+    return field.count;
+}
+
+/**
+ * Makes sure there is a neighbour buffer for each of threads workers
+ */
+static void _crt_reserve_workers(World *world, unsigned int threads) {
+    if (world->workers >= threads) {
+        return;
+    }
+
+    CrtNeighbours **neighbours = realloc(world->neighbours, threads * sizeof(CrtNeighbours *));
+    EXIT_IF(neighbours == NULL, "failed to allocate memory for world neighbour buffers");
+    world->neighbours = neighbours;
+    for (unsigned int i = world->workers; i < threads; i++) {
+        world->neighbours[i] = crt_neighbours_create(16);
+        EXIT_IF(world->neighbours[i] == NULL, "failed to allocate memory for CrtNeighbours");
+    }
+    world->workers = threads;
+}
+
+/**
+ * Main loop: step creature i, reads the current state of the world only and writes the next state of the creature
+ * (see CrtStore, world_swap())
+ * neighbours: found with crt_find_neighbours(), or NULL to take them from the world's all-pairs table if there is one,
+ * otherwise to stream them from the index (see crt_streams_neighbours())
+ */
+int crt_update(size_t i, App *app, World *world, CrtNeighbours *neighbours) {
+    if (!app || !world || i >= world->crts->len) {
         return 1;
     }
 
+    CrtStore *crts = world->crts;
+    crts->targ_next[i] = crts->targ[i];
+
     // apply influenc eof neighbouring particles
-    int did = _crt_apply_neighbours(crt, app, world, neighbours);
+    int did = 0;
+    if (world->mass && world->theta > 0) {
+        did = _crt_apply_far_field(i, world);
+    } else if (neighbours) {
+        did = _crt_apply_neighbours(i, world, neighbours);
+    } else if (world->pairs && world->pairs->len) {
+        did = _crt_apply_pairs(i, world);
+    } else if (world->backend == WORLD_BACKEND_QTREE && !world->knn) {
+        did = _crt_stream_neighbours(i, world);
+    }
     if (did) {
+        crts->pos_next[i] = world_wrap(world, crts->pos_next[i]);
         return 0;
     }
 
     // move towards target
 
     // compute speed and progess linear
-    float speed = crt->agility * 25.0; // TODO dynamic
+    float speed = crts->agility[i] * 25.0; // TODO dynamic
 
-    Vec2 delta = vec2_sub(crt->pos, crt->targ);
+    Vec2 delta = world_delta(world, crts->pos[i], crts->targ[i]);
     float mag = vec2_mag(delta);
     Vec2 norm = vec2_norm(delta);
 
-    crt->pos.x -= speed * norm.x;
-    crt->pos.y -= speed * norm.y;
+    Vec2 pos = {
+        crts->pos[i].x - speed * norm.x,
+        crts->pos[i].y - speed * norm.y,
+    };
+    crts->pos_next[i] = world_wrap(world, pos);
 
     // overshoot
     if (fabs(mag) < speed) {
-        crt_random_targ(crt, world, 200.f);
+        crts->targ_next[i] = _crt_random_targ(world, i, crts->pos_next[i], 200.f);
     }
 
     return 0;
 }
 
+typedef struct CrtStep {
+    App *app;
+    World *world;
+    int stream;
+} CrtStep;
+
+static void _crt_update_range(size_t begin, size_t end, unsigned int worker, void *ctx) {
+    CrtStep *step = ctx;
+    CrtNeighbours *neighbours = (step->stream) ? NULL : step->world->neighbours[worker];
+
+    for (size_t i = begin; i < end; i++) {
+        if (neighbours) {
+            crt_find_neighbours(i, step->app, step->world, neighbours);
+        }
+        crt_update(i, step->app, step->world, neighbours);
+    }
+}
+
+/**
+ * Main loop: steps every creature (crt_find_neighbours(), crt_update()) in parallel chunks on world->threads workers.
+ * The result does not depend on the number of threads (see CrtStore). Query counters are not thread safe, the step
+ * runs on the calling thread while they are enabled.
+ */
+int crt_update_all(App *app, World *world) {
+    if (!app || !world) {
+        return 1;
+    }
+
+    unsigned int threads = (world->threads) ? world->threads : 1;
+    _crt_reserve_workers(world, threads);
+
+    CrtStep step = {app, world, crt_streams_neighbours(app, world)};
+    size_t len = world->crts->len;
+
+    if (threads <= 1 || (world->qtree && world->qtree->counting)) {
+        _crt_update_range(0, len, 0, &step);
+        return 0;
+    }
+
+    if (world->pool && world->pool->threads != threads) {
+        pool_destroy(world->pool);
+        world->pool = NULL;
+    }
+    if (!world->pool) {
+        world->pool = pool_create(threads);
+        EXIT_IF(world->pool == NULL, "failed to allocate memory for world workers");
+    }
+
+    size_t chunk = len / (threads * CRT_UPDATE_CHUNKS);
+    if (pool_for(world->pool, len, (chunk > CRT_UPDATE_CHUNK_MIN) ? chunk : CRT_UPDATE_CHUNK_MIN, _crt_update_range, &step) != 0) {
+        _crt_update_range(0, len, 0, &step);
+    }
+    return 0;
+}
+
 /**
  * Main loop: draw
  */
-void crt_print(FILE *fp, Creature *crt) {
+void crt_print(FILE *fp, World *world, size_t i) {
     if (!fp) {
         return;
     }
-    if (!crt) {
+    if (!world || i >= world->crts->len) {
         fprintf(fp, "<NULL>\n");
         return;
     }
 
+    CrtStore *crts = world->crts;
     fprintf(fp,
             "{"
-            " id: %d,"
+            " id: %u,"
             " name: \"%s\","
             " type: %s,"
             " status: %s,"
@@ -195,42 +751,45 @@ void crt_print(FILE *fp, Creature *crt) {
             " pos: {x:%f, y:%f},"
             " targ: {x:%f, y:%f}"
             " }\n",
-            crt->id,
-            crt->name,
-            CRT_TYPE_NAME(crt->type),
-            CRT_STATUS_NAME(crt->status),
-            crt->agility,
-            crt->size,
-            crt->perception,
-            crt->mass,
-            crt->pos.x, crt->pos.y,
-            crt->targ.x, crt->targ.y);
-}
-
-int crt_draw(Creature *crt, App *app, World *world) {
-    if (!crt || !app || !world) {
+            crts->info[i].handle.slot,
+            crts->info[i].name,
+            CRT_TYPE_NAME(crts->type[i]),
+            CRT_STATUS_NAME(crts->info[i].status),
+            crts->agility[i],
+            crts->size[i],
+            crts->mass[i],
+            crts->perception[i],
+            crts->pos[i].x, crts->pos[i].y,
+            crts->targ[i].x, crts->targ[i].y);
+}
+
+int crt_draw(size_t i, App *app, World *world) {
+    if (!app || !world || i >= world->crts->len) {
         return -1;
     }
 
+    CrtStore *crts = world->crts;
     int ret = 0;
-    float hsz = crt->size / 2;
-    float x = crt->pos.x - hsz;
-    float y = crt->pos.y - hsz;
+    float size = crts->size[i];
+    Vec2 targ = crts->targ[i];
+    float hsz = size / 2;
+    float x = crts->pos[i].x - hsz;
+    float y = crts->pos[i].y - hsz;
 
     // 1. draw pos
 
-    switch (crt->type) {
+    switch (crts->type[i]) {
     case CRT_TYPE_HERBIVORE:
         glColor4f(0.0, 1.0, 0.0, 1.0);
-        glPointSize(crt->size);
+        glPointSize(size);
         break;
     case CRT_TYPE_CARNIVORE:
         glColor4f(1.0, 0.0, 0.0, 1.0);
-        glPointSize(crt->size);
+        glPointSize(size);
         break;
     default:
         glColor4f(1.0, 0.0, 0.0, 1.0);
-        glPointSize(crt->size);
+        glPointSize(size);
     }
 
     glBegin(GL_POINTS);
@@ -248,12 +807,12 @@ int crt_draw(Creature *crt, App *app, World *world) {
 
     glBegin(GL_LINES);
     glVertex2f(x, y);
-    glVertex2f(crt->targ.x - 1, crt->targ.y - 1);
+    glVertex2f(targ.x - 1, targ.y - 1);
     glEnd();
 
     // 3. draw targ
 
-    if (vec2_equals(crt->pos, crt->targ)) {
+    if (vec2_equals(crts->pos[i], targ)) {
         return ret;
     }
 
@@ -261,7 +820,7 @@ int crt_draw(Creature *crt, App *app, World *world) {
     glPointSize(2);
 
     glBegin(GL_POINTS);
-    glVertex2f(crt->targ.x - 1, crt->targ.y - 1);
+    glVertex2f(targ.x - 1, targ.y - 1);
     glEnd();
 
     return ret;
@@ -271,23 +830,98 @@ int crt_draw(Creature *crt, App *app, World *world) {
 // Relationships
 ////
 
-QuadList *crt_find_neighbours(Creature *crt, App *app, World *world, QuadList *list) {
-    if (!crt || !app || !world) {
+/**
+ * Whether neighbours can be applied without a list (crt_update() with NULL), from the all-pairs table
+ * or streamed from the index: qtree circle queries only (drawn neighbours are found separately).
+ */
+int crt_streams_neighbours(App *app, World *world) {
+    if (!app || !world) {
+        return 0;
+    }
+    return world->backend == WORLD_BACKEND_QTREE && !world->knn;
+}
+
+/**
+ * Circle query on the linear and grid backends. In a toroidal world a query crossing an edge is split into one query
+ * per image of the creature (see qbounds_wrap_offsets()), the distances to the images are the wrapped ones.
+ * Perception is clamped to below half the world there (qbounds_wrap_radius()).
+ * The qtree does the same by itself (qtree_toroidal()).
+ */
+static QuadList *_crt_find_in_radius(size_t i, World *world, QuadList *list) {
+    Vec2 offsets[4];
+    Vec2 at = world->crts->pos[i];
+    float perception = world->crts->perception[i];
+    if (world->wrap) {
+        perception = qbounds_wrap_radius((QuadBounds){world->nw, world->se}, perception);
+    }
+    Vec2 nw = {at.x - perception, at.y - perception};
+    Vec2 se = {at.x + perception, at.y + perception};
+    size_t len = (world->wrap) ? qbounds_wrap_offsets((QuadBounds){world->nw, world->se}, nw, se, offsets) : 1;
+    Vec2 pos;
+
+    offsets[0] = (Vec2){0.f, 0.f};
+    for (size_t n = 0; n < len; n++) {
+        pos = vec2_add(at, offsets[n]);
+        if (world->backend == WORLD_BACKEND_LINEAR) {
+            lqtree_find_in_radius(world->lqtree, pos, perception, list);
+        } else {
+            sgrid_find_in_radius(world->sgrid, pos, perception, list);
+        }
+    }
+    return list;
+}
+
+typedef struct CrtCollect {
+    CrtNeighbours *neighbours;
+    CrtStore *crts;
+} CrtCollect;
+
+static int _crt_collect_neighbour(QuadItem *item, float dist2, void *ctx) {
+    CrtCollect *collect = ctx;
+    crt_neighbours_append(collect->neighbours, collect->crts, CRT_INDEX(item->data), dist2);
+    return QUAD_VISIT_CONTINUE;
+}
+
+/**
+ * Finds the neighbours of creature i and copies them into a (reused) buffer, which is created if NULL.
+ * qtree circle queries are collected straight from the index, the other queries through the buffer's scratch list.
+ */
+CrtNeighbours *crt_find_neighbours(size_t i, App *app, World *world, CrtNeighbours *neighbours) {
+    if (!app || !world || i >= world->crts->len) {
         return NULL;
     }
 
-    if (!list) {
-        list = qlist_create(5);
-        EXIT_IF(list == NULL, "failed to allocate memory for QuadList");
+    if (!neighbours) {
+        neighbours = crt_neighbours_create(16);
+        EXIT_IF(neighbours == NULL, "failed to allocate memory for CrtNeighbours");
     } else {
-        qlist_reset(list);
+        crt_neighbours_reset(neighbours);
     }
 
-    return qtree_find_in_area(world->qtree, crt->pos, crt->perception, list);
+    CrtStore *crts = world->crts;
+    QuadList *list = neighbours->list;
+    if (world->backend == WORLD_BACKEND_LINEAR || world->backend == WORLD_BACKEND_GRID) {
+        _crt_find_in_radius(i, world, list);
+    } else {
+        // qtree: only the types the creature has (non-zero) rules for, see rules_mask()
+        unsigned int mask = rules_mask(world->rules, crts->type[i], CRT_TYPE_MAX);
+        if (!world->knn) {
+            CrtCollect collect = {neighbours, crts};
+            qtree_visit_radius_mask(world->qtree, crts->pos[i], crts->perception[i], mask, _crt_collect_neighbour, &collect);
+            return neighbours;
+        }
+        // +1: the creature finds itself (if its own type is in the mask)
+        qtree_find_knn_mask(world->qtree, crts->pos[i], world->knn + ((mask >> crts->type[i]) & 1), crts->perception[i], mask, list);
+    }
+
+    for (size_t n = 0; n < list->len; n++) {
+        crt_neighbours_append(neighbours, crts, CRT_INDEX(list->items[n]->data), (list->dist2) ? list->dist2[n] : -1.f);
+    }
+    return neighbours;
 }
 
-int crt_draw_neighbours(Creature *crt, QuadList *list, App *app, World *world) {
-    if (!crt || !list || !app || !world) {
+int crt_draw_neighbours(size_t i, CrtNeighbours *neighbours, App *app, World *world) {
+    if (!neighbours || !app || !world || i >= world->crts->len) {
         return -1;
     }
 
@@ -296,36 +930,92 @@ int crt_draw_neighbours(Creature *crt, QuadList *list, App *app, World *world) {
         return ret;
     }
 
-    float hsz = crt->size / 2;
-    float x = crt->pos.x - hsz;
-    float y = crt->pos.y - hsz;
+    CrtStore *crts = world->crts;
+    Vec2 pos = crts->pos[i];
+    float hsz = crts->size[i] / 2;
 
     // 1. draw neighbour perception circle
     if (app->show_perception) {
         glColor4f(0.1, 0.2, 0.2, 1.0);
         glLineWidth(1.0);
-        _draw_circle(crt->pos, crt->perception, 50);
+        _draw_circle(pos, crts->perception[i], 50);
     }
 
     // 4. draw neighbour relationships
     if (app->show_neighbours) {
-        Creature *other;
+        size_t other;
         glColor4f(0.25, 0.25, 0.1, 1.0);
         glLineWidth(1.0);
 
         float ohz;
-        for (size_t i = 0; i < list->len; i++) {
-            if (list->nodes[i] && list->nodes[i]->data) {
-                other = (Creature *)list->nodes[i]->data;
-                ohz = other->size / 2;
-                if (other->id != crt->id) {
-                    glBegin(GL_LINES);
-                    glVertex2f(crt->pos.x - hsz, crt->pos.y - hsz);
-                    glVertex2f(other->pos.x - ohz, other->pos.y - ohz);
-                    glEnd();
-                }
+        for (size_t n = 0; n < neighbours->len; n++) {
+            other = neighbours->index[n];
+            if (other == i || other >= crts->len) {
+                continue;
             }
+            ohz = crts->size[other] / 2;
+            glBegin(GL_LINES);
+            glVertex2f(pos.x - hsz, pos.y - hsz);
+            glVertex2f(crts->pos[other].x - ohz, crts->pos[other].y - ohz);
+            glEnd();
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Bounding box of a creature's body as drawn by crt_draw(): a square of size, centered on pos - size / 2
+ */
+QuadBounds crt_body(Vec2 pos, float size) {
+    return (QuadBounds){{pos.x - size, pos.y - size}, pos};
+}
+
+/**
+ * Finds the creatures whose body overlaps the body of creature i (the creature itself included)
+ */
+QuadList *crt_find_contacts(size_t i, World *world, QuadList *list) {
+    if (!world || !list || i >= world->crts->len) {
+        return NULL;
+    }
+
+    qlist_reset(list);
+    QuadBounds body = crt_body(world->crts->pos[i], world->crts->size[i]);
+    return world_find_bodies(world, body.nw, body.se, list);
+}
+
+int crt_draw_contacts(size_t i, QuadList *list, App *app, World *world) {
+    if (!list || !app || !world || i >= world->crts->len) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (!app->show_contacts) {
+        return ret;
+    }
+
+    CrtStore *crts = world->crts;
+    size_t other;
+    QuadBounds body;
+    glColor4f(0.9, 0.9, 0.2, 1.0);
+    glLineWidth(1.0);
+
+    for (size_t n = 0; n < list->len; n++) {
+        if (!list->items[n] || !list->items[n]->data) {
+            continue;
+        }
+        other = CRT_INDEX(list->items[n]->data);
+        if (other == i || other >= crts->len) {
+            continue;
         }
+
+        body = crt_body(crts->pos[other], crts->size[other]);
+        glBegin(GL_LINE_LOOP);
+        glVertex2f(body.nw.x, body.nw.y);
+        glVertex2f(body.se.x, body.nw.y);
+        glVertex2f(body.se.x, body.se.y);
+        glVertex2f(body.nw.x, body.se.y);
+        glEnd();
     }
 
     return ret;
@@ -1,6 +1,9 @@
 #ifndef __CRT_H__
 #define __CRT_H__
 
+#include <limits.h>
+#include <stdint.h>
+
 #include "app.h"
 #include "qtree.h"
 #include "vec2.h"
@@ -42,50 +45,131 @@ typedef enum CrtStatus {
 extern const char crt_status_names[][32];
 #define CRT_STATUS_NAME(s) ((s >= 0 && s < CRT_STATUS_MAX) ? crt_status_names[s] : "<UNDEFINED>")
 
+/**
+ * Stable reference to a creature: slot and generation. The slot maps to the creature's current (dense) index and
+ * survives the compaction of the arrays, the generation invalidates handles of dead creatures when the slot is reused.
+ */
+typedef struct CrtHandle {
+    unsigned int slot;
+    unsigned int gen; // 0: never valid
+} CrtHandle;
+
+#define CRT_SLOT_NONE UINT_MAX
+#define CRT_HANDLE_NONE ((CrtHandle){CRT_SLOT_NONE, 0})
+
+typedef struct CrtSlot {
+    unsigned int gen;   // generation of the current (alive) or next (free) creature
+    unsigned int index; // alive: index in the arrays, free: next free slot
+} CrtSlot;
+
+/**
+ * Cold creature data: read by the debug and ui paths only
+ */
 typedef struct Creature {
-    unsigned int id;
+    CrtHandle handle;
     char name[CRT_NAME_LEN];
-
-    CrtType type;
     CrtStatus status;
+} Creature;
 
-    float agility;
-    float size;
-    float mass;
-
-    float perception;
+/**
+ * Population storage as a structure of arrays, creature i is element i of every array.
+ * The hot arrays are what the update and draw loops touch (iterated linearly), cold data lives in info.
+ * The arrays are dense (0..len-1, removal moves the last creature into the gap) and grow geometrically,
+ * creatures are addressed across removals by handles (see crt_store_index()).
+ * State changed by a step is double buffered: crt_update() reads pos and targ of the current step only and writes
+ * pos_next and targ_next, world_swap() makes them current. The result of a step does not depend on the update order.
+ */
+typedef struct CrtStore {
+    size_t len;
+    size_t max;
+
+    // hot
+    Vec2 *pos;
+    Vec2 *targ;
+    Vec2 *pos_next;
+    Vec2 *targ_next;
+    float *mass;
+    float *agility;
+    float *perception;
+    float *size;
+    CrtType *type;
+    unsigned int *seed; // random state of the creature (targets), independent of the update order
+
+    // cold
+    Creature *info;
+
+    // handles
+    CrtSlot *slots;
+    size_t slots_len;
+    unsigned int free; // first free slot, CRT_SLOT_NONE: none
+} CrtStore;
+
+CrtStore *crt_store_create(size_t max);
+int crt_store_reserve(CrtStore *crts, size_t max);
+CrtHandle crt_store_spawn(CrtStore *crts);
+int crt_store_despawn(CrtStore *crts, CrtHandle handle);
+long crt_store_index(CrtStore *crts, CrtHandle handle);
+void crt_store_swap(CrtStore *crts);
+void crt_store_destroy(CrtStore *crts);
+
+/**
+ * Payload of creature i in the spatial indices: the population index (+1, never NULL) rather than a pointer
+ */
+#define CRT_DATA(i) ((void *)((uintptr_t)(i) + 1))
+#define CRT_INDEX(data) ((size_t)((uintptr_t)(data) - 1))
 
-    Vec2 pos;
-    Vec2 targ;
-} Creature;
+////
+// Neighbours
+////
 
-#define CRT_INIT(id)                                                                                                      \
-    {                                                                                                                     \
-        id, {0}, CRT_TYPE_NONE, CRT_STATUS_NONE, 0, 0, 0, 0, {CRT_POS_NONE, CRT_POS_NONE}, { CRT_POS_NONE, CRT_POS_NONE } \
-    }
+/**
+ * Neighbour result buffer: grows geometrically and keeps its capacity on reset.
+ * Dense copy of what the force loop needs from the neighbours, taken at query time, as structure of arrays
+ * for the force kernels (see force_sum())
+ */
+typedef struct CrtNeighbours {
+    size_t len;
+    size_t max;
+    float *x;
+    float *y;
+    float *mass;
+    float *dist2;        // squared (wrapped) distance to the query position, < 0: not computed
+    int *type;           // CrtType
+    unsigned int *index; // population index
+    QuadList *list; // scratch for the list based queries (knn, linear, grid)
+} CrtNeighbours;
+
+CrtNeighbours *crt_neighbours_create(size_t max);
+int crt_neighbours_append(CrtNeighbours *neighbours, CrtStore *crts, size_t index, float dist2);
+void crt_neighbours_reset(CrtNeighbours *neighbours);
+void crt_neighbours_destroy(CrtNeighbours *neighbours);
 
 // Live Cycle
 
-Creature *crt_create(unsigned int id);
-Creature *crt_birth(int id, char *name, CrtType type, Vec2 pos);
-void crt_destroy(Creature *crt);
-
-int crt_random_targ(Creature *crt, World *world, float max_radius);
+CrtHandle crt_birth(World *world, char *name, CrtType type, Vec2 pos);
+int crt_death(World *world, CrtHandle handle);
+int crt_random_targ(World *world, size_t i, float max_radius);
 
 // Debug
 
-void crt_print(FILE *fp, Creature *crt);
+void crt_print(FILE *fp, World *world, size_t i);
 
 // Main loop
 
-int crt_update(Creature *crt, App *app, World *world, QuadList *neighbours);
-int crt_draw(Creature *crt, App *app, World *world);
+int crt_update(size_t i, App *app, World *world, CrtNeighbours *neighbours);
+int crt_update_all(App *app, World *world);
+int crt_draw(size_t i, App *app, World *world);
 
 ////
 // Relationships
 ////
 
-QuadList *crt_find_neighbours(Creature *crt, App *app, World *world, QuadList *list);
-int crt_draw_neighbours(Creature *crt, QuadList *list, App *app, World *world);
+int crt_streams_neighbours(App *app, World *world);
+CrtNeighbours *crt_find_neighbours(size_t i, App *app, World *world, CrtNeighbours *neighbours);
+int crt_draw_neighbours(size_t i, CrtNeighbours *neighbours, App *app, World *world);
+
+QuadBounds crt_body(Vec2 pos, float size);
+QuadList *crt_find_contacts(size_t i, World *world, QuadList *list);
+int crt_draw_contacts(size_t i, QuadList *list, App *app, World *world);
 
 #endif
@@ -0,0 +1,297 @@
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FORCE_X86
+#include <immintrin.h>
+#endif
+
+#include "force.h"
+
+const char force_level_names[][16] = {"scalar", "sse2", "avx2", "avx512"};
+
+////
+// Scalar
+////
+
+/**
+ * Neighbours begin..end-1 of a batch, one at a time. Adds the sum of force * delta to accl,
+ * returns the number of neighbours which affected the body.
+ */
+static size_t _force_sum_range(const ForceBody *body, const ForceBatch *batch, size_t begin, size_t end, Vec2 *accl) {
+    float hw = body->wrap.x / 2;
+    float hh = body->wrap.y / 2;
+    float dx, dy, dist2, force;
+    size_t count = 0;
+
+    for (size_t n = begin; n < end; n++) {
+        // shortest delta, see world_delta()
+        dx = body->pos.x - batch->x[n];
+        dy = body->pos.y - batch->y[n];
+        if (body->wrap.x > 0) {
+            if (dx > hw) {
+                dx -= body->wrap.x;
+            } else if (dx < -hw) {
+                dx += body->wrap.x;
+            }
+        }
+        if (body->wrap.y > 0) {
+            if (dy > hh) {
+                dy -= body->wrap.y;
+            } else if (dy < -hh) {
+                dy += body->wrap.y;
+            }
+        }
+
+        dist2 = batch->dist2[n];
+        if (dist2 < 0) {
+            dist2 = dx * dx + dy * dy;
+        }
+        // 0: the body itself, or a coincident neighbour
+        if (dist2 == 0 || dist2 >= body->range2) {
+            continue;
+        }
+
+        // this is a variation of Newton's law of universal gravitation using attraction values instead of gravitation
+        force = body->attraction[batch->class[n]] * ((body->mass * batch->mass[n]) / dist2);
+        accl->x += force * dx;
+        accl->y += force * dy;
+        count++;
+    }
+    return count;
+}
+
+#ifdef FORCE_X86
+
+////
+// SSE2, 4 lanes
+////
+
+__attribute__((target("sse2")))
+static __m128 _force_wrap_sse2(__m128 d, __m128 size, __m128 half) {
+    __m128 over = _mm_and_ps(_mm_cmpgt_ps(d, half), size);
+    __m128 under = _mm_and_ps(_mm_cmplt_ps(d, _mm_sub_ps(_mm_setzero_ps(), half)), size);
+    return _mm_add_ps(_mm_sub_ps(d, over), under);
+}
+
+__attribute__((target("sse2")))
+static size_t _force_sum_sse2(const ForceBody *body, const ForceBatch *batch, Vec2 *accl) {
+    const float *attraction = body->attraction;
+    const int *class = batch->class;
+    __m128 zero = _mm_setzero_ps();
+    __m128 px = _mm_set1_ps(body->pos.x);
+    __m128 py = _mm_set1_ps(body->pos.y);
+    __m128 mass = _mm_set1_ps(body->mass);
+    __m128 range2 = _mm_set1_ps(body->range2);
+    __m128 ww = _mm_set1_ps(body->wrap.x);
+    __m128 wh = _mm_set1_ps(body->wrap.y);
+    __m128 hw = _mm_set1_ps(body->wrap.x / 2);
+    __m128 hh = _mm_set1_ps(body->wrap.y / 2);
+    __m128 ax = zero, ay = zero;
+    __m128 dx, dy, dist2, given, unknown, valid, attr, force;
+    size_t count = 0;
+    size_t n = 0;
+
+    for (; n + 4 <= batch->len; n += 4) {
+        dx = _mm_sub_ps(px, _mm_loadu_ps(batch->x + n));
+        dy = _mm_sub_ps(py, _mm_loadu_ps(batch->y + n));
+        if (body->wrap.x > 0) {
+            dx = _force_wrap_sse2(dx, ww, hw);
+        }
+        if (body->wrap.y > 0) {
+            dy = _force_wrap_sse2(dy, wh, hh);
+        }
+
+        given = _mm_loadu_ps(batch->dist2 + n);
+        unknown = _mm_cmplt_ps(given, zero);
+        dist2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        dist2 = _mm_or_ps(_mm_and_ps(unknown, dist2), _mm_andnot_ps(unknown, given));
+        valid = _mm_and_ps(_mm_cmpneq_ps(dist2, zero), _mm_cmplt_ps(dist2, range2));
+
+        // no variable permute in SSE2, the table lookup stays scalar
+        attr = _mm_set_ps(attraction[class[n + 3]], attraction[class[n + 2]], attraction[class[n + 1]], attraction[class[n]]);
+        force = _mm_mul_ps(attr, _mm_div_ps(_mm_mul_ps(mass, _mm_loadu_ps(batch->mass + n)), dist2));
+        force = _mm_and_ps(force, valid);
+
+        ax = _mm_add_ps(ax, _mm_mul_ps(force, dx));
+        ay = _mm_add_ps(ay, _mm_mul_ps(force, dy));
+        count += __builtin_popcount(_mm_movemask_ps(valid));
+    }
+
+    float lx[4], ly[4];
+    _mm_storeu_ps(lx, ax);
+    _mm_storeu_ps(ly, ay);
+    accl->x += (lx[0] + lx[1]) + (lx[2] + lx[3]);
+    accl->y += (ly[0] + ly[1]) + (ly[2] + ly[3]);
+
+    return count + _force_sum_range(body, batch, n, batch->len, accl);
+}
+
+////
+// AVX2, 8 lanes
+////
+
+__attribute__((target("avx2")))
+static __m256 _force_wrap_avx2(__m256 d, __m256 size, __m256 half) {
+    __m256 over = _mm256_and_ps(_mm256_cmp_ps(d, half, _CMP_GT_OQ), size);
+    __m256 under = _mm256_and_ps(_mm256_cmp_ps(d, _mm256_sub_ps(_mm256_setzero_ps(), half), _CMP_LT_OQ), size);
+    return _mm256_add_ps(_mm256_sub_ps(d, over), under);
+}
+
+__attribute__((target("avx2")))
+static size_t _force_sum_avx2(const ForceBody *body, const ForceBatch *batch, Vec2 *accl) {
+    __m256 zero = _mm256_setzero_ps();
+    __m256 px = _mm256_set1_ps(body->pos.x);
+    __m256 py = _mm256_set1_ps(body->pos.y);
+    __m256 mass = _mm256_set1_ps(body->mass);
+    __m256 range2 = _mm256_set1_ps(body->range2);
+    __m256 ww = _mm256_set1_ps(body->wrap.x);
+    __m256 wh = _mm256_set1_ps(body->wrap.y);
+    __m256 hw = _mm256_set1_ps(body->wrap.x / 2);
+    __m256 hh = _mm256_set1_ps(body->wrap.y / 2);
+    __m256 table = _mm256_loadu_ps(body->attraction); // FORCE_CLASSES == 8 lanes
+    __m256 ax = zero, ay = zero;
+    __m256 dx, dy, dist2, given, valid, attr, force;
+    size_t count = 0;
+    size_t n = 0;
+
+    for (; n + 8 <= batch->len; n += 8) {
+        dx = _mm256_sub_ps(px, _mm256_loadu_ps(batch->x + n));
+        dy = _mm256_sub_ps(py, _mm256_loadu_ps(batch->y + n));
+        if (body->wrap.x > 0) {
+            dx = _force_wrap_avx2(dx, ww, hw);
+        }
+        if (body->wrap.y > 0) {
+            dy = _force_wrap_avx2(dy, wh, hh);
+        }
+
+        given = _mm256_loadu_ps(batch->dist2 + n);
+        dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        dist2 = _mm256_blendv_ps(given, dist2, _mm256_cmp_ps(given, zero, _CMP_LT_OQ));
+        valid = _mm256_and_ps(_mm256_cmp_ps(dist2, zero, _CMP_NEQ_OQ), _mm256_cmp_ps(dist2, range2, _CMP_LT_OQ));
+
+        attr = _mm256_permutevar8x32_ps(table, _mm256_loadu_si256((const __m256i *) (batch->class + n)));
+        force = _mm256_mul_ps(attr, _mm256_div_ps(_mm256_mul_ps(mass, _mm256_loadu_ps(batch->mass + n)), dist2));
+        force = _mm256_and_ps(force, valid);
+
+        ax = _mm256_add_ps(ax, _mm256_mul_ps(force, dx));
+        ay = _mm256_add_ps(ay, _mm256_mul_ps(force, dy));
+        count += __builtin_popcount(_mm256_movemask_ps(valid));
+    }
+
+    float lx[8], ly[8];
+    _mm256_storeu_ps(lx, ax);
+    _mm256_storeu_ps(ly, ay);
+    accl->x += ((lx[0] + lx[1]) + (lx[2] + lx[3])) + ((lx[4] + lx[5]) + (lx[6] + lx[7]));
+    accl->y += ((ly[0] + ly[1]) + (ly[2] + ly[3])) + ((ly[4] + ly[5]) + (ly[6] + ly[7]));
+
+    // the tail is legacy SSE code, avoid the transition penalty of dirty upper halves
+    _mm256_zeroupper();
+    return count + _force_sum_range(body, batch, n, batch->len, accl);
+}
+
+////
+// AVX-512, 16 lanes, masked tail
+////
+
+__attribute__((target("avx512f")))
+static size_t _force_sum_avx512(const ForceBody *body, const ForceBatch *batch, Vec2 *accl) {
+    __m512 zero = _mm512_setzero_ps();
+    __m512 px = _mm512_set1_ps(body->pos.x);
+    __m512 py = _mm512_set1_ps(body->pos.y);
+    __m512 mass = _mm512_set1_ps(body->mass);
+    __m512 range2 = _mm512_set1_ps(body->range2);
+    __m512 ww = _mm512_set1_ps(body->wrap.x);
+    __m512 wh = _mm512_set1_ps(body->wrap.y);
+    __m512 hw = _mm512_set1_ps(body->wrap.x / 2);
+    __m512 hh = _mm512_set1_ps(body->wrap.y / 2);
+    __m512 nhw = _mm512_set1_ps(-body->wrap.x / 2);
+    __m512 nhh = _mm512_set1_ps(-body->wrap.y / 2);
+    __m512 table = _mm512_maskz_loadu_ps((1 << FORCE_CLASSES) - 1, body->attraction);
+    __m512 ax = zero, ay = zero;
+    __m512 dx, dy, dist2, given, attr, force;
+    __mmask16 lanes, valid;
+    size_t count = 0;
+
+    for (size_t n = 0; n < batch->len; n += 16) {
+        lanes = (n + 16 <= batch->len) ? 0xffff : (__mmask16) ((1u << (batch->len - n)) - 1);
+
+        dx = _mm512_sub_ps(px, _mm512_maskz_loadu_ps(lanes, batch->x + n));
+        dy = _mm512_sub_ps(py, _mm512_maskz_loadu_ps(lanes, batch->y + n));
+        if (body->wrap.x > 0) {
+            dx = _mm512_mask_sub_ps(dx, _mm512_cmp_ps_mask(dx, hw, _CMP_GT_OQ), dx, ww);
+            dx = _mm512_mask_add_ps(dx, _mm512_cmp_ps_mask(dx, nhw, _CMP_LT_OQ), dx, ww);
+        }
+        if (body->wrap.y > 0) {
+            dy = _mm512_mask_sub_ps(dy, _mm512_cmp_ps_mask(dy, hh, _CMP_GT_OQ), dy, wh);
+            dy = _mm512_mask_add_ps(dy, _mm512_cmp_ps_mask(dy, nhh, _CMP_LT_OQ), dy, wh);
+        }
+
+        given = _mm512_maskz_loadu_ps(lanes, batch->dist2 + n);
+        dist2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        dist2 = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(given, zero, _CMP_LT_OQ), given, dist2);
+        valid = lanes
+            & _mm512_cmp_ps_mask(dist2, zero, _CMP_NEQ_OQ)
+            & _mm512_cmp_ps_mask(dist2, range2, _CMP_LT_OQ);
+
+        attr = _mm512_permutexvar_ps(_mm512_maskz_loadu_epi32(lanes, batch->class + n), table);
+        force = _mm512_maskz_div_ps(valid, _mm512_mul_ps(mass, _mm512_maskz_loadu_ps(lanes, batch->mass + n)), dist2);
+        force = _mm512_mul_ps(attr, force);
+
+        ax = _mm512_add_ps(ax, _mm512_mul_ps(force, dx));
+        ay = _mm512_add_ps(ay, _mm512_mul_ps(force, dy));
+        count += __builtin_popcount(valid);
+    }
+
+    accl->x += _mm512_reduce_add_ps(ax);
+    accl->y += _mm512_reduce_add_ps(ay);
+    return count;
+}
+
+#endif
+
+////
+// Dispatch
+////
+
+/**
+ * Best force kernel the cpu (CPUID) and the OS (saved AVX state) support
+ */
+ForceLevel force_detect() {
+#ifdef FORCE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return FORCE_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return FORCE_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return FORCE_SSE2;
+    }
+#endif
+    return FORCE_SCALAR;
+}
+
+/**
+ * Adds the sum of force * delta of a batch of neighbours to accl, returns the number of neighbours which affected the body.
+ * level: kernel, at most force_detect(). The vector kernels sum in lanes (and the compiler may fuse multiply-adds),
+ * so they differ from the scalar one by rounding only: |accl - scalar| <= 1e-5 * sum(|force * delta|) per component.
+ */
+size_t force_sum(ForceLevel level, const ForceBody *body, const ForceBatch *batch, Vec2 *accl) {
+    if (!body || !batch || !accl || !batch->len) {
+        return 0;
+    }
+
+    switch (level) {
+#ifdef FORCE_X86
+    case FORCE_AVX512:
+        return _force_sum_avx512(body, batch, accl);
+    case FORCE_AVX2:
+        return _force_sum_avx2(body, batch, accl);
+    case FORCE_SSE2:
+        return _force_sum_sse2(body, batch, accl);
+#endif
+    default:
+        return _force_sum_range(body, batch, 0, batch->len, accl);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __FORCE_H__
+#define __FORCE_H__
+
+#include <stddef.h>
+
+#include "vec2.h"
+
+#define FORCE_CLASSES 8 // attraction table entries, neighbour classes must be < FORCE_CLASSES
+
+/**
+ * Instruction sets of the force kernels, ascending
+ */
+typedef enum ForceLevel {
+    FORCE_SCALAR,
+    FORCE_SSE2,
+    FORCE_AVX2,
+    FORCE_AVX512,
+    FORCE_LEVEL_MAX
+} ForceLevel;
+
+extern const char force_level_names[][16];
+
+/**
+ * The body the forces act on, set up once for all its batches
+ */
+typedef struct ForceBody {
+    Vec2 pos;
+    float mass;
+    float range2; // squared perception, neighbours at or beyond are ignored
+    Vec2 wrap;    // toroidal world size (shortest delta), {0, 0}: no wrapping
+    float attraction[FORCE_CLASSES]; // by neighbour class
+} ForceBody;
+
+/**
+ * Neighbours of a body as structure of arrays (not owned)
+ */
+typedef struct ForceBatch {
+    size_t len;
+    const float *x;
+    const float *y;
+    const float *mass;
+    const float *dist2; // squared (wrapped) distance to the body, < 0: computed from the positions
+    const int *class;
+} ForceBatch;
+
+ForceLevel force_detect();
+size_t force_sum(ForceLevel level, const ForceBody *body, const ForceBatch *batch, Vec2 *accl);
+
+#endif
@@ -0,0 +1,406 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <assert.h>
+
+#include "lqtree.h"
+#include "qtree.h"
+#include "utils.h"
+
+////
+// Morton codes
+//
+//   Child order follows the 2 bit digits (y << 1 | x) of the code, which matches the quadrants in qtree.h
+//
+//   ┌────────────┬────────────┐
+//   │     nw     │     ne     │
+//   │     00     │     01     │
+//   ├────────────┼────────────┤
+//   │     sw     │     se     │
+//   │     10     │     11     │
+//   └────────────┴────────────┘
+////
+
+/**
+ * Spreads the lower 16 bits of v to the even bits of the result
+ */
+static uint32_t _spread(uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+uint32_t lqtree_morton(uint32_t x, uint32_t y) {
+    return _spread(x) | (_spread(y) << 1);
+}
+
+/**
+ * Maps a coordinate to its grid cell, clamped to the grid.
+ * The mapping is monotonic, which the area query relies on.
+ */
+static uint32_t _cell(float v, float min, float scale) {
+    float c = (v - min) * scale;
+    if (!(c >= 0)) { // also catches NAN
+        return 0;
+    }
+    if (c >= LQUAD_CELLS) {
+        return LQUAD_CELLS - 1;
+    }
+    return (uint32_t)c;
+}
+
+/**
+ * First index in [begin, end) with codes[i] >= code
+ */
+static size_t _lower_bound(uint32_t *codes, size_t begin, size_t end, uint64_t code) {
+    size_t mid;
+    while (begin < end) {
+        mid = begin + (end - begin) / 2;
+        if (codes[mid] < code) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return begin;
+}
+
+////
+// Area search
+////
+
+typedef struct LQuadArea {
+    // cell range of the search area (inclusive)
+    uint32_t x0, y0;
+    uint32_t x1, y1;
+    // search area
+    Vec2 nw;
+    Vec2 se;
+    // circle queries: items are filtered by their squared distance to pos instead of the area
+    int circle;
+    Vec2 pos;
+    float radius2;
+} LQuadArea;
+
+/**
+ * Appends an item if it is within the search area (or circle)
+ */
+static void _lqtree_test_item(QuadItem *item, LQuadArea *area, QuadList *list) {
+    if (!area->circle) {
+        if (vec2_within(item->pos, area->nw, area->se)) {
+            qlist_append(list, item);
+        }
+        return;
+    }
+
+    Vec2 delta = vec2_sub(item->pos, area->pos);
+    float dist2 = delta.x * delta.x + delta.y * delta.y;
+    if (dist2 <= area->radius2) {
+        qlist_append_dist(list, item, dist2);
+    }
+}
+
+/**
+ * Recursively searches the implicit node covering cells [x, x + size) x [y, y + size), whose items are [begin, end).
+ */
+static void _lnode_find_in_area(LinearQuadTree *tree, size_t begin, size_t end, uint32_t x, uint32_t y, uint32_t size, LQuadArea *area, QuadList *list) {
+    if (begin >= end) {
+        return;
+    }
+
+    uint32_t last_x = x + (size - 1);
+    uint32_t last_y = y + (size - 1);
+
+    // this node does not interesect with the search boundary
+    if (last_x < area->x0 || x > area->x1 || last_y < area->y0 || y > area->y1) {
+        return;
+    }
+
+    // strictly inside the area's cells: all items are within the search area, no need to test them
+    if (!area->circle && x > area->x0 && last_x < area->x1 && y > area->y0 && last_y < area->y1) {
+        for (size_t i = begin; i < end; i++) {
+            qlist_append(list, &tree->items[i]);
+        }
+        return;
+    }
+
+    // small enough: test the items
+    if (end - begin <= tree->bucket || size == 1) {
+        for (size_t i = begin; i < end; i++) {
+            _lqtree_test_item(&tree->items[i], area, list);
+        }
+        return;
+    }
+
+    // split into the four children, each child covers a quarter of this node's code range
+    uint32_t half = size / 2;
+    uint64_t span = (uint64_t)half * half;
+    uint64_t code = lqtree_morton(x, y);
+
+    uint32_t cx, cy;
+    size_t first, last;
+
+    for (int k = 0; k < 4; k++) {
+        cx = x + (k & 1) * half;
+        cy = y + (k >> 1) * half;
+
+        // skip the binary search for children outside of the search area
+        if (cx + (half - 1) < area->x0 || cx > area->x1 || cy + (half - 1) < area->y0 || cy > area->y1) {
+            continue;
+        }
+
+        first = (k == 0) ? begin : _lower_bound(tree->codes, begin, end, code + k * span);
+        last = (k == 3) ? end : _lower_bound(tree->codes, first, end, code + (k + 1) * span);
+        _lnode_find_in_area(tree, first, last, cx, cy, half, area, list);
+        begin = last;
+    }
+}
+
+////
+// LinearQuadTree
+////
+
+/**
+ * Grows item and scratch arrays (geometric)
+ */
+static int _lqtree_grow(LinearQuadTree *tree) {
+    size_t max = (tree->max) ? tree->max * 2 : 64;
+
+    uint32_t *codes = realloc(tree->codes, max * sizeof(uint32_t));
+    if (!codes) {
+        return -1;
+    }
+    tree->codes = codes;
+
+    QuadItem *items = realloc(tree->items, max * sizeof(QuadItem));
+    if (!items) {
+        return -1;
+    }
+    tree->items = items;
+
+    freez(tree->tmp_codes);
+    freez(tree->tmp_items);
+    tree->tmp_codes = malloc(max * sizeof(uint32_t));
+    tree->tmp_items = malloc(max * sizeof(QuadItem));
+    if (!tree->tmp_codes || !tree->tmp_items) {
+        return -1;
+    }
+
+    tree->max = max;
+    return 0;
+}
+
+LinearQuadTree *lqtree_create(Vec2 window_nw, Vec2 window_se) {
+    assert(window_nw.x < window_se.x);
+    assert(window_nw.y < window_se.y);
+
+    LinearQuadTree *tree = calloc(1, sizeof(LinearQuadTree));
+    if (!tree) {
+        LOG_ERROR("failed to allocate memory for LinearQuadTree");
+        return NULL;
+    }
+
+    tree->nw = window_nw;
+    tree->se = window_se;
+    tree->scale = (Vec2){
+        LQUAD_CELLS / (window_se.x - window_nw.x),
+        LQUAD_CELLS / (window_se.y - window_nw.y),
+    };
+
+    tree->bucket = LQUAD_BUCKET;
+    tree->sorted = 1;
+
+    return tree;
+}
+
+/**
+ * Empties the tree, keeps the allocated capacity
+ */
+void lqtree_reset(LinearQuadTree *tree) {
+    if (!tree) {
+        return;
+    }
+    tree->length = 0;
+    tree->sorted = 1;
+}
+
+void lqtree_destroy(LinearQuadTree *tree) {
+    if (!tree) {
+        return;
+    }
+    freez(tree->codes);
+    freez(tree->items);
+    freez(tree->tmp_codes);
+    freez(tree->tmp_items);
+    freez(tree);
+}
+
+/**
+ * Appends an entity, the tree needs to be (re-)built before it can be queried.
+ * Unlike qtree_insert() this does not check for an already indexed item (never QUAD_REPLACED).
+ */
+int lqtree_insert(LinearQuadTree *tree, void *data, Vec2 pos) {
+    if (!tree || !data) {
+        return QUAD_FAILED;
+    }
+
+    // same bounds as the root of a QuadTree
+    if (!(pos.x >= tree->nw.x && pos.x < tree->se.x && pos.y >= tree->nw.y && pos.y < tree->se.y)) {
+        return QUAD_FAILED;
+    }
+
+    if (tree->length >= tree->max && _lqtree_grow(tree) != 0) {
+        LOG_ERROR("failed to allocate memory for LinearQuadTree items");
+        return QUAD_FAILED;
+    }
+
+    uint32_t x = _cell(pos.x, tree->nw.x, tree->scale.x);
+    uint32_t y = _cell(pos.y, tree->nw.y, tree->scale.y);
+
+    tree->codes[tree->length] = lqtree_morton(x, y);
+    tree->items[tree->length] = (QuadItem){pos, data};
+    tree->length++;
+    tree->sorted = 0;
+
+    return QUAD_INSERTED;
+}
+
+/**
+ * Sorts the items by morton code (LSD radix sort, 4 passes of 8 bits), which builds the implicit tree.
+ */
+int lqtree_build(LinearQuadTree *tree) {
+    if (!tree) {
+        return -1;
+    }
+    if (tree->sorted) {
+        return 0;
+    }
+    if (tree->length < 2) {
+        tree->sorted = 1;
+        return 0;
+    }
+
+    size_t count[256];
+    size_t offset, tmp;
+    uint32_t digit;
+
+    uint32_t *codes = tree->codes;
+    QuadItem *items = tree->items;
+    uint32_t *out_codes = tree->tmp_codes;
+    QuadItem *out_items = tree->tmp_items;
+    uint32_t *swap_codes;
+    QuadItem *swap_items;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        for (int d = 0; d < 256; d++) {
+            count[d] = 0;
+        }
+        for (size_t i = 0; i < tree->length; i++) {
+            count[(codes[i] >> shift) & 0xff]++;
+        }
+
+        // all codes share this digit: nothing to move
+        if (count[(codes[0] >> shift) & 0xff] == tree->length) {
+            continue;
+        }
+
+        offset = 0;
+        for (int d = 0; d < 256; d++) {
+            tmp = count[d];
+            count[d] = offset;
+            offset += tmp;
+        }
+
+        for (size_t i = 0; i < tree->length; i++) {
+            digit = (codes[i] >> shift) & 0xff;
+            out_codes[count[digit]] = codes[i];
+            out_items[count[digit]] = items[i];
+            count[digit]++;
+        }
+
+        swap_codes = codes;
+        codes = out_codes;
+        out_codes = swap_codes;
+
+        swap_items = items;
+        items = out_items;
+        out_items = swap_items;
+    }
+
+    // the sorted data might have ended up in the scratch buffers
+    tree->codes = codes;
+    tree->items = items;
+    tree->tmp_codes = out_codes;
+    tree->tmp_items = out_items;
+
+    tree->sorted = 1;
+    return 0;
+}
+
+QuadItem *lqtree_find(LinearQuadTree *tree, Vec2 pos) {
+    if (!tree || !tree->length) {
+        return NULL;
+    }
+    if (!(pos.x >= tree->nw.x && pos.x < tree->se.x && pos.y >= tree->nw.y && pos.y < tree->se.y)) {
+        return NULL;
+    }
+
+    lqtree_build(tree);
+
+    uint32_t x = _cell(pos.x, tree->nw.x, tree->scale.x);
+    uint32_t y = _cell(pos.y, tree->nw.y, tree->scale.y);
+    uint32_t code = lqtree_morton(x, y);
+
+    for (size_t i = _lower_bound(tree->codes, 0, tree->length, code); i < tree->length && tree->codes[i] == code; i++) {
+        if (vec2_equals(tree->items[i].pos, pos)) {
+            return &tree->items[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void _lqtree_find(LinearQuadTree *tree, Vec2 pos, float radius, int circle, QuadList *list) {
+    lqtree_build(tree);
+
+    LQuadArea area;
+    area.nw = (Vec2){pos.x - radius, pos.y - radius};
+    area.se = (Vec2){pos.x + radius, pos.y + radius};
+    area.x0 = _cell(area.nw.x, tree->nw.x, tree->scale.x);
+    area.y0 = _cell(area.nw.y, tree->nw.y, tree->scale.y);
+    area.x1 = _cell(area.se.x, tree->nw.x, tree->scale.x);
+    area.y1 = _cell(area.se.y, tree->nw.y, tree->scale.y);
+
+    area.circle = circle;
+    area.pos = pos;
+    area.radius2 = radius * radius;
+
+    _lnode_find_in_area(tree, 0, tree->length, 0, 0, LQUAD_CELLS, &area, list);
+}
+
+QuadList *lqtree_find_in_area(LinearQuadTree *tree, Vec2 pos, float radius, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
+    }
+    _lqtree_find(tree, pos, radius, 0, list);
+    return list;
+}
+
+/**
+ * Circle query, same as qtree_find_in_radius()
+ */
+QuadList *lqtree_find_in_radius(LinearQuadTree *tree, Vec2 pos, float radius, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
+    }
+    if (radius < 0) {
+        return list;
+    }
+    _lqtree_find(tree, pos, radius, 1, list);
+    return list;
+}
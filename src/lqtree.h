@@ -0,0 +1,55 @@
+/**
+ * Linear (pointer-free) quadtree: entities are sorted by the Morton code of their grid cell, the tree is implicit in the sorted array.
+ * A node is a range of codes sharing a prefix, its items are found by binary search within the parent's range.
+ *
+ * Same query semantics as QuadTree (qtree.h), but built in one go:
+ * insert everything, then sort (lqtree_build(), called lazily by the queries). There is no incremental update.
+ */
+
+#ifndef __LQTREE_H__
+#define __LQTREE_H__
+
+#include <stdint.h>
+
+#include "qtree.h"
+#include "vec2.h"
+
+#define LQUAD_BITS 16                  // bits per axis of the morton grid, codes are 2 * LQUAD_BITS wide
+#define LQUAD_CELLS (1u << LQUAD_BITS) // cells per axis
+
+#ifndef LQUAD_BUCKET
+#define LQUAD_BUCKET 32 // item ranges up to this size are scanned instead of descending further
+#endif
+
+typedef struct LinearQuadTree {
+    Vec2 nw;
+    Vec2 se;
+    Vec2 scale; // world units to cells
+
+    unsigned int length;
+    size_t max;
+    unsigned int bucket; // see LQUAD_BUCKET
+    int sorted;
+
+    uint32_t *codes; // morton codes, sorted after build
+    QuadItem *items; // in the same order as codes
+
+    // radix sort scratch
+    uint32_t *tmp_codes;
+    QuadItem *tmp_items;
+} LinearQuadTree;
+
+LinearQuadTree *lqtree_create(Vec2 window_nw, Vec2 window_se);
+void lqtree_reset(LinearQuadTree *tree);
+void lqtree_destroy(LinearQuadTree *tree);
+
+int lqtree_insert(LinearQuadTree *tree, void *data, Vec2 pos);
+int lqtree_build(LinearQuadTree *tree);
+
+QuadItem *lqtree_find(LinearQuadTree *tree, Vec2 pos);
+QuadList *lqtree_find_in_area(LinearQuadTree *tree, Vec2 pos, float radius, QuadList *list);
+QuadList *lqtree_find_in_radius(LinearQuadTree *tree, Vec2 pos, float radius, QuadList *list);
+
+uint32_t lqtree_morton(uint32_t x, uint32_t y);
+
+#endif
@@ -0,0 +1,417 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <assert.h>
+
+#include "ltree.h"
+#include "qtree.h"
+#include "utils.h"
+
+/**
+ * Root to target node of an entity
+ */
+typedef struct LoosePath {
+    LooseNode *nodes[QUAD_DEPTH_LIMIT + 1];
+    QuadBounds bounds[QUAD_DEPTH_LIMIT + 1];
+    unsigned int len;
+} LoosePath;
+
+typedef struct LooseStackEntry {
+    LooseNode *node;
+    QuadBounds bounds;
+} LooseStackEntry;
+
+static inline Vec2 _box_center(QuadBounds box) {
+    return (Vec2){box.nw.x + (box.se.x - box.nw.x) / 2, box.nw.y + (box.se.y - box.nw.y) / 2};
+}
+
+/**
+ * Rejects inverted and NAN boxes and boxes whose center is outside of the tree (se edges excluded, like QuadTree)
+ */
+static int _box_valid(LooseQuadTree *tree, QuadBounds box) {
+    if (!(box.nw.x <= box.se.x && box.nw.y <= box.se.y)) {
+        return 0;
+    }
+    Vec2 ctr = _box_center(box);
+    return ctr.x >= tree->bounds.nw.x && ctr.x < tree->bounds.se.x && ctr.y >= tree->bounds.nw.y && ctr.y < tree->bounds.se.y;
+}
+
+/**
+ * Depth of the node an entity is stored at: the deepest level whose loose margin still covers the box's half extent.
+ * Depends on the box size only, not on the contents of the tree.
+ */
+static unsigned int _box_depth(LooseQuadTree *tree, QuadBounds box) {
+    float margin = (tree->looseness - 1) / 2;
+    float hx = (box.se.x - box.nw.x) / 2;
+    float hy = (box.se.y - box.nw.y) / 2;
+    float w = tree->bounds.se.x - tree->bounds.nw.x;
+    float h = tree->bounds.se.y - tree->bounds.nw.y;
+
+    unsigned int depth = 0;
+    while (depth < tree->max_depth) {
+        w /= 2;
+        h /= 2;
+        if (hx > margin * w || hy > margin * h) {
+            break;
+        }
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * Node bounds enlarged by (looseness - 1) / 2 of the node size on each side
+ */
+static inline QuadBounds _loose_bounds(LooseQuadTree *tree, QuadBounds bounds) {
+    float margin = (tree->looseness - 1) / 2;
+    float mx = (bounds.se.x - bounds.nw.x) * margin;
+    float my = (bounds.se.y - bounds.nw.y) * margin;
+    return (QuadBounds){{bounds.nw.x - mx, bounds.nw.y - my}, {bounds.se.x + mx, bounds.se.y + my}};
+}
+
+////
+// LooseNode
+////
+
+/**
+ * Descends to the node of a box, recording the path. Missing children are created if create is set, otherwise NULL is returned.
+ */
+static LooseNode *_node_place(LooseQuadTree *tree, QuadBounds box, int create, LoosePath *path) {
+    unsigned int depth = _box_depth(tree, box);
+    Vec2 ctr = _box_center(box);
+
+    LooseNode *node = tree->root;
+    QuadBounds bounds = tree->bounds;
+    Vec2 mid;
+    int quadrant;
+
+    path->len = 0;
+    path->nodes[path->len] = node;
+    path->bounds[path->len] = bounds;
+    path->len++;
+
+    while (node->depth < depth) {
+        if (!node->children) {
+            if (!create) {
+                return NULL;
+            }
+            node->children = calloc(4, sizeof(LooseNode));
+            if (!node->children) {
+                LOG_ERROR("failed to allocate memory for LooseNode children");
+                return NULL;
+            }
+            for (int i = 0; i < 4; i++) {
+                node->children[i].depth = node->depth + 1;
+            }
+        }
+
+        mid = (Vec2){bounds.nw.x + (bounds.se.x - bounds.nw.x) / 2, bounds.nw.y + (bounds.se.y - bounds.nw.y) / 2};
+        quadrant = ((ctr.y >= mid.y) << 1) | (ctr.x >= mid.x);
+
+        bounds = qbounds_quadrant(bounds, quadrant);
+        node = &node->children[quadrant];
+
+        path->nodes[path->len] = node;
+        path->bounds[path->len] = bounds;
+        path->len++;
+    }
+
+    return node;
+}
+
+static int _node_append(LooseNode *node, void *data, QuadBounds box) {
+    if (node->len >= node->max) {
+        unsigned int max = (node->max) ? node->max * 2 : 4;
+        LooseItem *items = realloc(node->items, max * sizeof(LooseItem));
+        if (!items) {
+            LOG_ERROR("failed to allocate memory for LooseNode items");
+            return QUAD_FAILED;
+        }
+        node->items = items;
+        node->max = max;
+    }
+
+    node->items[node->len++] = (LooseItem){{_box_center(box), data}, box};
+    return QUAD_INSERTED;
+}
+
+static LooseItem *_node_find_item(LooseNode *node, void *data) {
+    for (unsigned int i = 0; i < node->len; i++) {
+        if (node->items[i].item.data == data) {
+            return &node->items[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Frees the descendants of a node, depth first on an explicit stack
+ */
+static void _node_free_children(LooseNode *node) {
+    if (!node->children) {
+        return;
+    }
+
+    LooseNode *stack[QUAD_STACK_MAX];
+    size_t top = 0;
+    LooseNode *block;
+
+    stack[top++] = node->children;
+    node->children = NULL;
+
+    while (top) {
+        block = stack[--top];
+        for (int i = 0; i < 4; i++) {
+            freez(block[i].items);
+            if (block[i].children) {
+                assert(top < QUAD_STACK_MAX);
+                stack[top++] = block[i].children;
+            }
+        }
+        freez(block);
+    }
+}
+
+static void _path_count(LoosePath *path, int delta) {
+    for (unsigned int i = 0; i < path->len; i++) {
+        path->nodes[i]->count += delta;
+    }
+}
+
+/**
+ * Frees the highest subtree along a path whose descendants are empty
+ */
+static void _path_collapse(LoosePath *path) {
+    for (unsigned int i = 0; i < path->len; i++) {
+        if (path->nodes[i]->children && path->nodes[i]->count == path->nodes[i]->len) {
+            _node_free_children(path->nodes[i]);
+            return;
+        }
+    }
+}
+
+/**
+ * Overlap query, depth first on an explicit stack (bounded by QUAD_DEPTH_LIMIT)
+ */
+static int _node_visit_overlapping(LooseQuadTree *tree, Vec2 nw, Vec2 se, QuadItemVisitor fn, void *ctx) {
+    LooseStackEntry stack[QUAD_STACK_MAX];
+    size_t top = 0;
+    stack[top++] = (LooseStackEntry){tree->root, tree->bounds};
+
+    LooseNode *node;
+    QuadBounds bounds;
+    int res = QUAD_VISIT_CONTINUE;
+
+    while (top && res != QUAD_VISIT_STOP) {
+        top--;
+        node = stack[top].node;
+        bounds = stack[top].bounds;
+
+        // the root also holds boxes larger than its loose bounds
+        if (!node->count || (node->depth && !qbounds_overlaps_area(_loose_bounds(tree, bounds), nw, se))) {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < node->len; i++) {
+            if (!qbounds_overlaps_area(node->items[i].box, nw, se)) {
+                continue;
+            }
+            if (fn(&node->items[i].item, -1.f, ctx) == QUAD_VISIT_STOP) {
+                res = QUAD_VISIT_STOP;
+                break;
+            }
+        }
+
+        if (!node->children || node->count == node->len) {
+            continue;
+        }
+
+        assert(top + 4 <= QUAD_STACK_MAX);
+        for (int q = QUAD_SE; q >= QUAD_NW; q--) {
+            stack[top++] = (LooseStackEntry){&node->children[q], qbounds_quadrant(bounds, q)};
+        }
+    }
+
+    return res;
+}
+
+static int _visit_append(QuadItem *item, float dist2, void *ctx) {
+    qlist_append_dist((QuadList *)ctx, item, dist2);
+    return QUAD_VISIT_CONTINUE;
+}
+
+////
+// LooseQuadTree
+////
+
+LooseQuadTree *ltree_create(Vec2 window_nw, Vec2 window_se) {
+    assert(window_nw.x < window_se.x);
+    assert(window_nw.y < window_se.y);
+
+    LooseQuadTree *tree = malloc(sizeof(LooseQuadTree));
+    if (!tree) {
+        LOG_ERROR("failed to allocate memory for LooseQuadTree");
+        return NULL;
+    }
+
+    tree->root = calloc(1, sizeof(LooseNode));
+    if (!tree->root) {
+        LOG_ERROR("failed to allocate memory for LooseQuadTree root");
+        freez(tree);
+        return NULL;
+    }
+
+    tree->bounds = (QuadBounds){window_nw, window_se};
+    tree->length = 0;
+    tree->looseness = LTREE_LOOSENESS;
+    tree->max_depth = QUAD_DEPTH_MAX;
+    return tree;
+}
+
+/**
+ * Sets the looseness factor (>= 1, 1: a plain quadtree where only points descend) and the depth cap of an empty tree.
+ */
+int ltree_configure(LooseQuadTree *tree, float looseness, unsigned int max_depth) {
+    if (!tree || tree->length) {
+        return -1;
+    }
+    if (!(looseness >= 1)) {
+        LOG_ERROR_F("invalid looseness %f (>= 1)", looseness);
+        return -1;
+    }
+    if (max_depth > QUAD_DEPTH_LIMIT) {
+        LOG_ERROR_F("invalid max depth %d (0..%d)", max_depth, QUAD_DEPTH_LIMIT);
+        return -1;
+    }
+
+    tree->looseness = looseness;
+    tree->max_depth = max_depth;
+    return 0;
+}
+
+/**
+ * Empties a tree, the root keeps its item capacity
+ */
+void ltree_reset(LooseQuadTree *tree) {
+    if (!tree) {
+        return;
+    }
+    _node_free_children(tree->root);
+    tree->root->len = 0;
+    tree->root->count = 0;
+    tree->length = 0;
+}
+
+void ltree_destroy(LooseQuadTree *tree) {
+    if (!tree) {
+        return;
+    }
+    _node_free_children(tree->root);
+    freez(tree->root->items);
+    freez(tree->root);
+    freez(tree);
+}
+
+/**
+ * Inserts an entity with its bounding box. Like lqtree_insert() this does not check for an already indexed entity (never QUAD_REPLACED).
+ */
+int ltree_insert(LooseQuadTree *tree, void *data, QuadBounds box) {
+    if (!tree || !data || !_box_valid(tree, box)) {
+        return QUAD_FAILED;
+    }
+
+    LoosePath path;
+    LooseNode *node = _node_place(tree, box, 1, &path);
+    if (!node || _node_append(node, data, box) != QUAD_INSERTED) {
+        _path_collapse(&path); // children created for nothing
+        return QUAD_FAILED;
+    }
+
+    _path_count(&path, 1);
+    tree->length++;
+    return QUAD_INSERTED;
+}
+
+/**
+ * Removes an entity, box is the box it was inserted (or last moved) with.
+ */
+int ltree_remove(LooseQuadTree *tree, void *data, QuadBounds box) {
+    if (!tree || !data || !_box_valid(tree, box)) {
+        return QUAD_FAILED;
+    }
+
+    LoosePath path;
+    LooseNode *node = _node_place(tree, box, 0, &path);
+    LooseItem *item = (node) ? _node_find_item(node, data) : NULL;
+    if (!item) {
+        return QUAD_FAILED;
+    }
+
+    *item = node->items[--node->len];
+    tree->length--;
+    _path_count(&path, -1);
+    _path_collapse(&path);
+    return QUAD_REMOVED;
+}
+
+/**
+ * Moves an entity from old_box to box. Stays in place if box maps to the same node.
+ * If the entity is not found at old_box it is inserted. If box is invalid the entity is removed (QUAD_FAILED).
+ */
+int ltree_move(LooseQuadTree *tree, void *data, QuadBounds old_box, QuadBounds box) {
+    if (!tree || !data) {
+        return QUAD_FAILED;
+    }
+
+    LoosePath path;
+    LooseNode *node = (_box_valid(tree, old_box)) ? _node_place(tree, old_box, 0, &path) : NULL;
+    LooseItem *item = (node) ? _node_find_item(node, data) : NULL;
+    if (!item) {
+        return ltree_insert(tree, data, box);
+    }
+
+    // same depth and the center still within the node's bounds: same node
+    Vec2 ctr = _box_center(box);
+    QuadBounds bounds = path.bounds[path.len - 1];
+    if (_box_valid(tree, box) && _box_depth(tree, box) == node->depth &&
+        ctr.x >= bounds.nw.x && ctr.x < bounds.se.x && ctr.y >= bounds.nw.y && ctr.y < bounds.se.y) {
+        *item = (LooseItem){{ctr, data}, box};
+        return QUAD_INSERTED;
+    }
+
+    ltree_remove(tree, data, old_box);
+    return ltree_insert(tree, data, box);
+}
+
+/**
+ * Loose bounds of a node covering bounds, see ltree.h
+ */
+QuadBounds ltree_loose_bounds(LooseQuadTree *tree, QuadBounds bounds) {
+    if (!tree) {
+        return bounds;
+    }
+    return _loose_bounds(tree, bounds);
+}
+
+/**
+ * Streams all entities whose box overlaps the area nw-se (inclusive) to fn (dist2: -1), without collecting them.
+ * Returns QUAD_VISIT_STOP if fn terminated the query, QUAD_FAILED on invalid arguments.
+ */
+int ltree_visit_overlapping(LooseQuadTree *tree, Vec2 nw, Vec2 se, QuadItemVisitor fn, void *ctx) {
+    if (!tree || !fn) {
+        return QUAD_FAILED;
+    }
+    return _node_visit_overlapping(tree, nw, se, fn, ctx);
+}
+
+/**
+ * Appends all entities whose box overlaps the area nw-se (inclusive), a point query with nw == se picks the entities covering it.
+ */
+QuadList *ltree_find_overlapping(LooseQuadTree *tree, Vec2 nw, Vec2 se, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
+    }
+    _node_visit_overlapping(tree, nw, se, _visit_append, list);
+    return list;
+}
@@ -0,0 +1,65 @@
+/**
+ * Loose quadtree for entities with spatial extent (axis aligned bounding boxes).
+ *
+ * An entity is stored in the smallest node whose loose bounds fully contain its box: the node's bounds enlarged by
+ * (looseness - 1) / 2 of the node size on each side. The node is picked by the box size only: the deepest level whose margin
+ * covers the box's half extent, and within that level the node which contains the box center. Boxes larger than
+ * the root's children stay at the root.
+ *
+ * Because a node's loose bounds contain the loose bounds of its children, an overlap query prunes every subtree
+ * whose loose bounds don't overlap the query area - no inflation of the query by a maximum entity size.
+ *
+ * Same conventions as QuadTree (qtree.h): QUAD_* return values, QuadList results and QuadItemVisitor callbacks.
+ */
+
+#ifndef __LTREE_H__
+#define __LTREE_H__
+
+#include "qtree.h"
+#include "vec2.h"
+
+#ifndef LTREE_LOOSENESS
+#define LTREE_LOOSENESS 2.f // default looseness factor k (loose bounds = k * node size), >= 1
+#endif
+
+/**
+ * Stored entity: item.pos is the center of the box. Lists returned by the queries point to item (first member),
+ * cast them to LooseItem to access the box. Valid until the next insert, remove or move.
+ */
+typedef struct LooseItem {
+    QuadItem item;
+    QuadBounds box;
+} LooseItem;
+
+typedef struct LooseNode {
+    struct LooseNode *children; // block of 4 (QUAD_NW..QUAD_SE), NULL for leaves
+    LooseItem *items;           // entities stored at this node
+    unsigned int len;
+    unsigned int max;
+    unsigned int count; // entities in this subtree (including len)
+    unsigned int depth;
+} LooseNode;
+
+typedef struct LooseQuadTree {
+    LooseNode *root;
+    QuadBounds bounds;
+    unsigned int length;
+    float looseness;
+    unsigned int max_depth; // entities smaller than the margin of this depth are stored at this depth
+} LooseQuadTree;
+
+LooseQuadTree *ltree_create(Vec2 window_nw, Vec2 window_se);
+int ltree_configure(LooseQuadTree *tree, float looseness, unsigned int max_depth);
+void ltree_reset(LooseQuadTree *tree);
+void ltree_destroy(LooseQuadTree *tree);
+
+int ltree_insert(LooseQuadTree *tree, void *data, QuadBounds box);
+int ltree_remove(LooseQuadTree *tree, void *data, QuadBounds box);
+int ltree_move(LooseQuadTree *tree, void *data, QuadBounds old_box, QuadBounds box);
+
+QuadBounds ltree_loose_bounds(LooseQuadTree *tree, QuadBounds bounds);
+
+int ltree_visit_overlapping(LooseQuadTree *tree, Vec2 nw, Vec2 se, QuadItemVisitor fn, void *ctx);
+QuadList *ltree_find_overlapping(LooseQuadTree *tree, Vec2 nw, Vec2 se, QuadList *list);
+
+#endif
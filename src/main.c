@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h> // getopt
 
 #include <GL/glew.h>
@@ -28,16 +29,17 @@
 
 double then;
 
-static void configure(App *app, World *world, int argc, char **argv) {
-    if (!app || !world) {
+static void configure(App *app, World *world, size_t *population, int argc, char **argv) {
+    if (!app || !world || !population) {
         return;
     }
 
     int opt;
     int ival;
+    float fval;
 
-    char usage[] = "usage: %s [-h] [-c creatures:number] [-P paused]\n";
-    while ((opt = getopt(argc, argv, "f:c:Ph")) != -1) {
+    char usage[] = "usage: %s [-h] [-c creatures:number] [-P paused] [-i incremental index] [-b backend:qtree|linear|grid] [-k nearest neighbours:number] [-a all-pairs neighbour table] [-j threads:number] [-t barnes-hut theta:number] [-w toroidal world] [-s force kernel:scalar|sse2|avx2|avx512]\n";
+    while ((opt = getopt(argc, argv, "f:c:Pib:k:aj:t:ws:h")) != -1) {
         switch (opt) {
         case 'c':
             ival = atoi(optarg);
@@ -45,11 +47,7 @@ static void configure(App *app, World *world, int argc, char **argv) {
                 fprintf(stderr, "invalid '%c' option value\n", opt);
                 exit(1);
             }
-            if (ival > WORLD_POP_MAX) {
-                fprintf(stderr, "invalid '%c' option value: pop > max (%d > %d)\n", opt, ival, WORLD_POP_MAX);
-                exit(1);
-            }
-            world->len = ival;
+            *population = ival;
             break;
 
         case 'f':
@@ -69,6 +67,77 @@ static void configure(App *app, World *world, int argc, char **argv) {
             app->paused = 1;
             break;
 
+        case 'i':
+            world->index_mode = WORLD_INDEX_INCREMENTAL;
+            break;
+
+        case 'b':
+            ival = -1;
+            for (int i = 0; i < WORLD_BACKEND_MAX; i++) {
+                if (strcmp(optarg, world_backend_names[i]) == 0) {
+                    ival = i;
+                }
+            }
+            if (ival < 0) {
+                fprintf(stderr, "invalid '%c' option value: unknown backend '%s'\n", opt, optarg);
+                exit(1);
+            }
+            world->backend = ival;
+            break;
+
+        case 'k':
+            ival = atoi(optarg);
+            if (!ival || ival < 0) {
+                fprintf(stderr, "invalid '%c' option value\n", opt);
+                exit(1);
+            }
+            world->knn = ival;
+            break;
+
+        case 'a':
+            world->all_pairs = 1;
+            break;
+
+        case 'j':
+            ival = atoi(optarg);
+            if (!ival || ival < 0) {
+                fprintf(stderr, "invalid '%c' option value\n", opt);
+                exit(1);
+            }
+            world->threads = ival;
+            break;
+
+        case 't':
+            fval = atof(optarg);
+            if (!(fval > 0)) {
+                fprintf(stderr, "invalid '%c' option value\n", opt);
+                exit(1);
+            }
+            world->theta = fval;
+            break;
+
+        case 'w':
+            world->wrap = 1;
+            break;
+
+        case 's':
+            ival = -1;
+            for (int i = 0; i < FORCE_LEVEL_MAX; i++) {
+                if (strcmp(optarg, force_level_names[i]) == 0) {
+                    ival = i;
+                }
+            }
+            if (ival < 0) {
+                fprintf(stderr, "invalid '%c' option value: unknown force kernel '%s'\n", opt, optarg);
+                exit(1);
+            }
+            if (ival > (int) force_detect()) {
+                fprintf(stderr, "invalid '%c' option value: '%s' is not supported by this cpu (max: %s)\n", opt, optarg, force_level_names[force_detect()]);
+                exit(1);
+            }
+            world->simd = ival;
+            break;
+
         case 'h':
         case '?':
             fprintf(stderr, usage, argv[0]);
@@ -82,8 +151,9 @@ int main(int argc, char **argv) {
 
     // world
 
+    size_t population = rand_range(15, 200);
     World *world = world_create(
-        rand_range(15, 200),
+        population,
         (Vec2){0},
         (Vec2){DEFAULT_WIDTH, DEFAULT_HEIGHT});
 
@@ -101,7 +171,7 @@ int main(int argc, char **argv) {
     app->show_quads = 1;
     app->paused = 0;
 
-    configure(app, world, argc, argv);
+    configure(app, world, &population, argc, argv);
 
     // glfw, glew, gui
     ui_init(app, world);
@@ -115,33 +185,37 @@ int main(int argc, char **argv) {
 
     // population
 
-    Creature *crt;
+    CrtStore *crts = world->crts;
     CrtType type;
     char name[CRT_NAME_LEN];
     Vec2 pos = {0};
 
-    for (int i = 0; i < world->len; i++) {
+    size_t i;
+
+    for (size_t n = 0; n < population; n++) {
         rand_str(name, CRT_NAME_LEN);
         type = rand_range(1, CRT_TYPE_MAX - 1);
         pos.x = rand_range_f(0, ww);
         pos.y = rand_range_f(0, wh);
 
-        crt = crt_birth(i, name, type, pos);
-        crt->mass = rand_range_f(CRT_MIN_MASS, 5.f);
-        crt->size = crt->mass;
-        crt->agility = rand_range_f(.1, 2.f) * (1 / (crt->mass + crt->size)); // inverse proportional to mass (rand_range_f(.1, 2.f));
+        EXIT_IF(crt_birth(world, name, type, pos).gen == 0, "failed to allocate memory for population");
+        i = crts->len - 1;
+        crts->mass[i] = rand_range_f(CRT_MIN_MASS, 5.f);
+        crts->size[i] = crts->mass[i];
+        crts->agility[i] = rand_range_f(.1, 2.f) * (1 / (crts->mass[i] + crts->size[i])); // inverse proportional to mass (rand_range_f(.1, 2.f));
 
-        // printf(" -%d(%d): m: %f, s: %f, a: %f\n", crt->id, crt->type, crt->mass, crt->size, crt->agility);
+        // printf(" -%d(%d): m: %f, s: %f, a: %f\n", i, crts->type[i], crts->mass[i], crts->size[i], crts->agility[i]);
 
-        crt->perception = (ww > wh) ? wh / 10.f : ww / 10.f;
-        crt_random_targ(crt, world, 100.f);
-        world->population[i] = crt;
+        crts->perception[i] = (ww > wh) ? wh / 10.f : ww / 10.f;
+        crt_random_targ(world, i, 100.f);
     }
 
     // main loop
 
-    QuadList *neighbours = qlist_create(5);
-    EXIT_IF(neighbours == NULL, "failed to allocate memory for QuadList");
+    CrtNeighbours *neighbours = crt_neighbours_create(16);
+    EXIT_IF(neighbours == NULL, "failed to allocate memory for CrtNeighbours");
+    QuadList *contacts = qlist_create(5);
+    EXIT_IF(contacts == NULL, "failed to allocate memory for QuadList");
 
     double now, delta;
     double max = 1.0 / app->fps;
@@ -163,12 +237,20 @@ int main(int argc, char **argv) {
             world_update(app, world);
             world_draw(app, world);
 
-            for (int i = 0; i < world->len; i++) {
-                crt_find_neighbours(world->population[i], app, world, neighbours);
-                crt_update(world->population[i], app, world, neighbours);
+            crt_update_all(app, world);
+            for (size_t i = 0; i < crts->len; i++) {
+                crt_draw(i, app, world);
+                if (app->show_neighbours) {
+                    crt_find_neighbours(i, app, world, neighbours);
+                }
+                crt_draw_neighbours(i, neighbours, app, world);
+            }
+            world_swap(world);
 
-                crt_draw(world->population[i], app, world);
-                crt_draw_neighbours(world->population[i], neighbours, app, world);
+            // body contacts (loose quad tree)
+            for (size_t i = 0; i < crts->len && app->show_contacts; i++) {
+                crt_find_contacts(i, world, contacts);
+                crt_draw_contacts(i, contacts, app, world);
             }
 
             gui_draw(app, world);
@@ -183,7 +265,8 @@ int main(int argc, char **argv) {
 
     } // while
 
-    qlist_destroy(neighbours);
+    crt_neighbours_destroy(neighbours);
+    qlist_destroy(contacts);
     world_destroy(world);
     ui_exit(app->window);
     gui_exit(app->gui);
@@ -0,0 +1,275 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "utils.h"
+
+#define POOL_EMPTY -1 // deque is empty
+#define POOL_ABORT -2 // lost a race for the top item, retry
+
+////
+// Deque
+////
+
+/**
+ * Owner: takes the bottom item
+ */
+static long _deque_take(PoolDeque *deque) {
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return POOL_EMPTY;
+    }
+
+    long item = deque->items[b];
+    if (t == b) {
+        // last item: thieves might take it at the same time
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            item = POOL_EMPTY;
+        }
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+/**
+ * Thief: takes the top item
+ */
+static long _deque_steal(PoolDeque *deque) {
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return POOL_EMPTY;
+    }
+
+    long item = deque->items[t];
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return POOL_ABORT;
+    }
+    return item;
+}
+
+/**
+ * Fills a deque with the chunks lo..hi-1 (not shared yet), the owner takes them in ascending order, thieves from the end
+ */
+static void _deque_fill(PoolDeque *deque, size_t lo, size_t hi) {
+    long len = hi - lo;
+    for (long i = 0; i < len; i++) {
+        deque->items[i] = hi - 1 - i;
+    }
+    atomic_store_explicit(&deque->top, 0, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, len, memory_order_relaxed);
+}
+
+////
+// Workers
+////
+
+/**
+ * Runs chunks of the current loop, its own first, then stolen ones, until every chunk was taken
+ */
+static void _pool_run(ThreadPool *pool, unsigned int id) {
+    PoolDeque *own = &pool->deques[id];
+    size_t begin, end;
+    long chunk;
+
+    while (atomic_load(&pool->pending) > 0) {
+        chunk = _deque_take(own);
+        for (unsigned int i = 1; chunk < 0 && i < pool->threads; i++) {
+            chunk = _deque_steal(&pool->deques[(id + i) % pool->threads]);
+            if (chunk >= 0) {
+                atomic_fetch_add(&pool->steals, 1);
+            }
+        }
+        if (chunk < 0) {
+            sched_yield(); // the last chunks are being taken
+            continue;
+        }
+
+        atomic_fetch_sub(&pool->pending, 1);
+        begin = chunk * pool->chunk;
+        end = (begin + pool->chunk < pool->n) ? begin + pool->chunk : pool->n;
+        pool->fn(begin, end, id, pool->ctx);
+    }
+}
+
+static void *_pool_worker(void *arg) {
+    PoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        _pool_run(pool, worker->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * Makes sure every deque holds (at least) max chunks
+ */
+static int _pool_reserve(ThreadPool *pool, size_t max) {
+    long *items;
+    for (unsigned int i = 0; i < pool->threads; i++) {
+        if (pool->deques[i].max >= max) {
+            continue;
+        }
+        items = realloc(pool->deques[i].items, max * sizeof(long));
+        if (!items) {
+            LOG_ERROR("failed to allocate memory for ThreadPool deque");
+            return -1;
+        }
+        pool->deques[i].items = items;
+        pool->deques[i].max = max;
+    }
+    return 0;
+}
+
+////
+// ThreadPool
+////
+
+/**
+ * Starts threads - 1 worker threads, the calling thread is the first worker of every loop
+ */
+ThreadPool *pool_create(unsigned int threads) {
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        LOG_ERROR("failed to allocate memory for ThreadPool");
+        return NULL;
+    }
+
+    pool->threads = (threads) ? threads : 1;
+    pool->started = 1;
+    pool->tids = calloc(pool->threads, sizeof(pthread_t));
+    pool->workers = calloc(pool->threads, sizeof(PoolWorker));
+    pool->deques = calloc(pool->threads, sizeof(PoolDeque));
+    if (!pool->tids || !pool->workers || !pool->deques) {
+        LOG_ERROR("failed to allocate memory for ThreadPool workers");
+        freez(pool->tids);
+        freez(pool->workers);
+        freez(pool->deques);
+        freez(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->steals, 0);
+
+    for (unsigned int i = 0; i < pool->threads; i++) {
+        pool->workers[i] = (PoolWorker){pool, i};
+        atomic_init(&pool->deques[i].top, 0);
+        atomic_init(&pool->deques[i].bottom, 0);
+    }
+    for (unsigned int i = 1; i < pool->threads; i++) {
+        if (pthread_create(&pool->tids[pool->started], NULL, _pool_worker, &pool->workers[i]) != 0) {
+            LOG_ERROR("failed to create ThreadPool worker thread");
+            break; // the chunks of the missing workers are stolen
+        }
+        pool->started++;
+    }
+    return pool;
+}
+
+/**
+ * Parallel loop: runs fn over 0..n-1 in chunks of (up to) chunk indices and returns when all of them are done.
+ * Every worker starts with a contiguous share of the chunks and steals from the others once it ran out.
+ * Returns -1 if the deques could not grow, nothing was run.
+ */
+int pool_for(ThreadPool *pool, size_t n, size_t chunk, PoolRangeFn fn, void *ctx) {
+    if (!pool || !fn) {
+        return -1;
+    }
+    if (!n) {
+        return 0;
+    }
+
+    chunk = (chunk) ? chunk : 1;
+    size_t chunks = (n + chunk - 1) / chunk;
+    if (pool->started <= 1 || chunks <= 1) {
+        fn(0, n, 0, ctx);
+        return 0;
+    }
+
+    if (_pool_reserve(pool, (chunks + pool->threads - 1) / pool->threads) != 0) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < pool->threads; i++) {
+        _deque_fill(&pool->deques[i], chunks * i / pool->threads, chunks * (i + 1) / pool->threads);
+    }
+
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->n = n;
+    pool->chunk = chunk;
+    atomic_store(&pool->pending, chunks);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = pool->started - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    _pool_run(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void pool_destroy(ThreadPool *pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 1; i < pool->started; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+
+    for (unsigned int i = 0; i < pool->threads; i++) {
+        freez(pool->deques[i].items);
+    }
+    freez(pool->tids);
+    freez(pool->workers);
+    freez(pool->deques);
+    freez(pool);
+}
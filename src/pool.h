@@ -0,0 +1,65 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define POOL_CACHE_LINE 64
+
+/**
+ * Loop body over the indices begin..end-1.
+ * worker: 0..threads-1 (0: the calling thread), for per worker scratch data.
+ */
+typedef void (*PoolRangeFn)(size_t begin, size_t end, unsigned int worker, void *ctx);
+
+/**
+ * Work-stealing deque of chunk indices (Chase-Lev): the owner takes from the bottom, thieves steal from the top.
+ * It is filled before a loop is published and does not grow while it is shared.
+ */
+typedef struct PoolDeque {
+    atomic_long top;
+    char pad_top[POOL_CACHE_LINE - sizeof(atomic_long)];
+    atomic_long bottom;
+    char pad_bottom[POOL_CACHE_LINE - sizeof(atomic_long)];
+    long *items;
+    size_t max;
+} PoolDeque;
+
+typedef struct PoolWorker {
+    struct ThreadPool *pool;
+    unsigned int id;
+} PoolWorker;
+
+/**
+ * Persistent worker threads for parallel loops (pool_for()), the calling thread is worker 0
+ */
+typedef struct ThreadPool {
+    unsigned int threads; // workers, the calling thread included
+    unsigned int started; // workers running (threads which failed to start leave their chunks to the thieves)
+    pthread_t *tids;
+    PoolWorker *workers;
+    PoolDeque *deques;    // one per worker
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;  // workers: a loop was published, or stop
+    pthread_cond_t done;  // calling thread: the workers left the loop
+    unsigned long generation; // loops published
+    unsigned int busy;        // workers in the current loop
+    int stop;
+
+    // current loop
+    PoolRangeFn fn;
+    void *ctx;
+    size_t n;
+    size_t chunk;
+    atomic_size_t pending; // chunks not taken yet
+
+    atomic_size_t steals; // chunks run by another worker than their owner, since pool_create()
+} ThreadPool;
+
+ThreadPool *pool_create(unsigned int threads);
+int pool_for(ThreadPool *pool, size_t n, size_t chunk, PoolRangeFn fn, void *ctx);
+void pool_destroy(ThreadPool *pool);
+
+#endif
@@ -1,430 +1,2070 @@
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <assert.h>
 
 #include "qtree.h"
 #include "utils.h"
 
+// forward declarations
+static int _node_split(QuadTree *tree, QuadArena *nodes, QuadArena *buckets, QuadNode *node, QuadBounds bounds);
+void qnode_print(FILE *fp, QuadNode *node);
+
+////
+// QuadArena
+////
+
+/**
+ * size: element size, release: elements per run handed back with _arena_release(), only runs of that length are re-used
+ */
+static void _arena_init(QuadArena *arena, size_t size, size_t release) {
+    *arena = (QuadArena){0};
+    arena->size = size;
+    arena->release = release;
+}
+
+/**
+ * Takes n contiguous elements from the arena, allocates a new block only if all existing blocks are used up.
+ * Elements are returned uninitialized. Released runs are re-used first if n is the arena's release length.
+ */
+static void *_arena_alloc(QuadArena *arena, size_t n) {
+    assert(n <= QUAD_ARENA_BLOCK);
+
+    if (arena->free && n == arena->release) {
+        void *elements = arena->free;
+        arena->free = *(void **)elements;
+        return elements;
+    }
+
+    if (arena->blocks_len && arena->used + n <= QUAD_ARENA_BLOCK) {
+        void *elements = &arena->blocks[arena->block][arena->used * arena->size];
+        arena->used += n;
+        return elements;
+    }
+
+    // current block exhausted (or none yet): move on to the next one
+    size_t next = (arena->blocks_len) ? arena->block + 1 : 0;
+
+    if (next >= arena->blocks_len) {
+        char **blocks = realloc(arena->blocks, (arena->blocks_len + 1) * sizeof(char *));
+        if (!blocks) {
+            LOG_ERROR("failed to allocate memory for QuadArena blocks");
+            return NULL;
+        }
+        arena->blocks = blocks;
+
+        arena->blocks[arena->blocks_len] = malloc(QUAD_ARENA_BLOCK * arena->size);
+        if (!arena->blocks[arena->blocks_len]) {
+            LOG_ERROR("failed to allocate memory for QuadArena block");
+            return NULL;
+        }
+        arena->blocks_len++;
+    }
+
+    arena->block = next;
+    arena->used = n;
+    return &arena->blocks[arena->block][0];
+}
+
+/**
+ * Hands a run of arena->release elements back: four children (as allocated by _node_split()) or a bucket.
+ */
+static void _arena_release(QuadArena *arena, void *elements) {
+    *(void **)elements = arena->free;
+    arena->free = elements;
+}
+
+/**
+ * Rewinds the arena, allocated blocks are kept for re-use.
+ */
+static void _arena_reset(QuadArena *arena) {
+    arena->block = 0;
+    arena->used = 0;
+    arena->free = NULL;
+}
+
+static void _arena_destroy(QuadArena *arena) {
+    for (size_t i = 0; i < arena->blocks_len; i++) {
+        freez(arena->blocks[i]);
+    }
+    freez(arena->blocks);
+    arena->blocks = NULL;
+    arena->blocks_len = 0;
+    _arena_reset(arena);
+}
+
+////
+// QuadBounds
+////
+
+/**
+ * Checks if a pos is within bounds (se edges excluded).
+ */
+static inline int _bounds_contains(QuadBounds bounds, Vec2 pos) {
+    return pos.x >= bounds.nw.x && pos.x < bounds.se.x && pos.y >= bounds.nw.y && pos.y < bounds.se.y;
+}
+
+static inline Vec2 _bounds_center(QuadBounds bounds) {
+    return (Vec2){bounds.nw.x + fabsf(bounds.nw.x - bounds.se.x) / 2, bounds.nw.y + fabsf(bounds.nw.y - bounds.se.y) / 2};
+}
+
+/**
+ * Gets the quadrant (QUAD_NW..QUAD_SE) of a position within bounds.
+ */
+static inline int _bounds_quadrant(QuadBounds bounds, Vec2 pos) {
+    Vec2 ctr = _bounds_center(bounds);
+    return ((pos.y >= ctr.y) << 1) | (pos.x >= ctr.x);
+}
+
+/**
+ * Squared distance from pos to the closest point of an area
+ */
+static inline float _bounds_mindist2(QuadBounds bounds, Vec2 pos) {
+    float dx = fmaxf(fmaxf(bounds.nw.x - pos.x, 0), pos.x - bounds.se.x);
+    float dy = fmaxf(fmaxf(bounds.nw.y - pos.y, 0), pos.y - bounds.se.y);
+    return dx * dx + dy * dy;
+}
+
+////
+// QuadNode
+////
+
+/**
+ * Initializes a (freshly allocated) node
+ */
+static void _node_init(QuadNode *node, unsigned int depth) {
+    node->children = NULL;
+    node->bucket = NULL;
+    node->len = 0;
+    node->depth = depth;
+    node->mask = 0;
+#if QUAD_CLASSES > 0
+    memset(node->classes, 0, sizeof(node->classes));
+#endif
+}
+
+/**
+ * Class of an item's data (0..QUAD_MASK_BITS - 1), -1 if it is not classified
+ */
+static inline int _tree_class(QuadTree *tree, void *data) {
+    if (tree->classify) {
+        int c = tree->classify(data, tree->classify_ctx);
+        return (c >= 0 && c < QUAD_MASK_BITS) ? c : -1;
+    }
+    return -1;
+}
+
+/**
+ * Checks an item's data against a query mask
+ */
+static inline int _tree_matches(QuadTree *tree, unsigned int mask, void *data) {
+    if (mask == QUAD_MASK_ALL) {
+        return 1;
+    }
+    int c = _tree_class(tree, data);
+    return c >= 0 && (mask & (1u << c));
+}
+
+/**
+ * Checks if a node's subtree might contain items matching a query mask
+ */
+static inline int _node_matches(QuadNode *node, unsigned int mask) {
+    return mask == QUAD_MASK_ALL || (node->mask & mask);
+}
+
+/**
+ * Adds delta entities of class c (-1: none) to the subtree counts of a node.
+ * Adding sets the class in the node's mask, removing leaves it to _path_mask().
+ */
+static inline void _node_count(QuadNode *node, int c, int delta) {
+    node->len += delta;
+    if (c >= 0 && delta > 0) {
+        node->mask |= 1u << c;
+    }
+#if QUAD_CLASSES > 0
+    if (c >= 0 && c < QUAD_CLASSES) {
+        node->classes[c] += delta;
+    }
+#endif
+}
+
+/**
+ * Gets a bucket from the bucket arena
+ */
+static QuadBucket *_bucket_alloc(QuadArena *buckets) {
+    QuadBucket *bucket = _arena_alloc(buckets, 1);
+    if (bucket) {
+        bucket->next = NULL;
+        bucket->len = 0;
+    }
+    return bucket;
+}
+
+/**
+ * Finds an item in a leaf (and its overflow buckets) by data and position
+ */
+static QuadItem *_node_find_item(QuadNode *node, void *data, Vec2 pos) {
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            if (bucket->items[i].data == data && vec2_equals(bucket->items[i].pos, pos)) {
+                return &bucket->items[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Checks if all entities of a leaf are located at pos, in which case splitting would not separate them
+ */
+static int _node_coincident(QuadNode *node, Vec2 pos) {
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            if (!vec2_equals(bucket->items[i].pos, pos)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * Appends an entity to a leaf: the first bucket takes up to tree->bucket entities, overflow buckets always use the full capacity.
+ * Allocates a new bucket if all are full.
+ */
+static int _node_append(QuadTree *tree, QuadArena *buckets, QuadNode *node, int c, void *data, Vec2 pos) {
+    if (!node->bucket) {
+        node->bucket = _bucket_alloc(buckets);
+        if (!node->bucket) {
+            return QUAD_FAILED;
+        }
+    }
+
+    QuadBucket *bucket = node->bucket;
+    if (bucket->len >= tree->bucket) {
+        while (bucket->next && bucket->next->len >= QUAD_BUCKET_MAX) {
+            bucket = bucket->next;
+        }
+        if (!bucket->next) {
+            bucket->next = _bucket_alloc(buckets);
+            if (!bucket->next) {
+                return QUAD_FAILED;
+            }
+        }
+        bucket = bucket->next;
+    }
+
+    bucket->items[bucket->len] = (QuadItem){pos, data};
+    bucket->len++;
+    _node_count(node, c, 1);
+    return QUAD_INSERTED;
+}
+
+/**
+ * Removes an item from a leaf. The hole is filled with the last item of the leaf's buckets, an emptied bucket is released.
+ */
+static int _node_remove_item(QuadTree *tree, QuadNode *node, void *data, Vec2 pos) {
+    QuadItem *item = _node_find_item(node, data, pos);
+    if (!item) {
+        return QUAD_FAILED;
+    }
+
+    QuadBucket *prev = NULL;
+    QuadBucket *tail = node->bucket;
+    while (tail->next) {
+        prev = tail;
+        tail = tail->next;
+    }
+
+    tail->len--;
+    *item = tail->items[tail->len];
+    _node_count(node, _tree_class(tree, data), -1);
+
+    if (!tail->len) {
+        if (prev) {
+            prev->next = NULL;
+        } else {
+            node->bucket = NULL;
+        }
+        _arena_release(&tree->buckets, tail);
+    }
+    return QUAD_REMOVED;
+}
+
+/**
+ * Inserts an entity into a tree node. A full leaf might be split into four childs, or keep the entity in an overflow bucket
+ * if splitting can't help (all entities at the same position, or max depth reached).
+ * Inserting an already indexed data item at the same position again is a no-op (QUAD_REPLACED).
+ * Counts the entity in the subtree counts from node down, the caller counts it in the ancestors of node.
+ * Note: The position bounds must be checked by callee (qtree_insert())
+ */
+static int _node_insert(QuadTree *tree, QuadArena *nodes, QuadArena *buckets, QuadNode *node, QuadBounds bounds, void *data, Vec2 pos) {
+    if (!tree || !node || !data) {
+        return QUAD_FAILED;
+    }
+
+    QuadNode *start = node;
+    QuadBounds start_bounds = bounds;
+    int c = _tree_class(tree, data);
+    int status;
+    int quadrant;
+
+    while (1) {
+        // 1. descend into the quadrant of THIS CHILDREN
+        while (node->children) {
+            _node_count(node, c, 1);
+            quadrant = _bounds_quadrant(bounds, pos);
+            bounds = qbounds_quadrant(bounds, quadrant);
+            node = &node->children[quadrant];
+        }
+
+        // 2. already indexed at this pos
+        if (_node_find_item(node, data, pos)) {
+            status = QUAD_REPLACED;
+            break;
+        }
+
+        // 3. insert into THIS (empty or not yet full) node, or
+        // 4. keep in THIS full node if splitting would not separate the entities
+        if (node->len < tree->bucket || node->depth >= tree->max_depth || _node_coincident(node, pos)) {
+            status = _node_append(tree, buckets, node, c, data, pos);
+            break;
+        }
+
+        // 5. split node (and also mv previous entities), then continue with the new children
+        if (_node_split(tree, nodes, buckets, node, bounds) == QUAD_FAILED) {
+            status = QUAD_FAILED;
+            break;
+        }
+    }
+
+    if (status == QUAD_INSERTED) {
+        return status;
+    }
+
+    // not inserted: uncount from the nodes passed on the way down
+    while (start != node) {
+        _node_count(start, c, -1);
+        quadrant = _bounds_quadrant(start_bounds, pos);
+        start_bounds = qbounds_quadrant(start_bounds, quadrant);
+        start = &start->children[quadrant];
+    }
+    return status;
+}
+
+/**
+ * Spits a leaf into 4 child quadrants, allocated as one contiguous block.
+ * Moves the existing entities (including overflow buckets) into the matching quadrants.
+ */
+static int _node_split(QuadTree *tree, QuadArena *nodes, QuadArena *buckets, QuadNode *node, QuadBounds bounds) {
+    if (!tree || !node) {
+        return QUAD_FAILED;
+    }
+
+    QuadNode *children = _arena_alloc(nodes, 4);
+    if (!children) {
+        return QUAD_FAILED;
+    }
+    for (int i = 0; i < 4; i++) {
+        _node_init(&children[i], node->depth + 1);
+    }
+
+    // inserting into the children counts the entities in node again
+    QuadBucket *payload = node->bucket;
+    _node_init(node, node->depth);
+    node->children = children;
+
+    QuadBucket *next;
+    for (QuadBucket *bucket = payload; bucket; bucket = next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            if (_node_insert(tree, nodes, buckets, node, bounds, bucket->items[i].data, bucket->items[i].pos) == QUAD_FAILED) {
+                return QUAD_FAILED;
+            }
+        }
+        next = bucket->next;
+        _arena_release(buckets, bucket);
+    }
+
+    return QUAD_INSERTED;
+}
+
+/**
+ * Find an item for a given position
+ */
+static QuadItem *_node_find(QuadNode *node, QuadBounds bounds, Vec2 pos) {
+    while (node->children) {
+        int quadrant = _bounds_quadrant(bounds, pos);
+        bounds = qbounds_quadrant(bounds, quadrant);
+        node = &node->children[quadrant];
+    }
+
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            if (vec2_equals(bucket->items[i].pos, pos)) {
+                return &bucket->items[i];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Nodes from the root down to a leaf, with their bounds. Replaces parent pointers for climbing back up.
+ */
+typedef struct QuadPath {
+    QuadNode *nodes[QUAD_DEPTH_LIMIT + 1];
+    QuadBounds bounds[QUAD_DEPTH_LIMIT + 1];
+    unsigned int len;
+} QuadPath;
+
+/**
+ * Find the leaf node holding a given data item at a given position, records the path to it
+ */
+static QuadNode *_node_find_data(QuadTree *tree, void *data, Vec2 pos, QuadPath *path) {
+    if (!_bounds_contains(tree->bounds, pos)) {
+        return NULL;
+    }
+
+    QuadNode *node = tree->root;
+    QuadBounds bounds = tree->bounds;
+
+    path->len = 0;
+    while (1) {
+        path->nodes[path->len] = node;
+        path->bounds[path->len] = bounds;
+        path->len++;
+
+        if (!node->children) {
+            break;
+        }
+
+        int quadrant = _bounds_quadrant(bounds, pos);
+        bounds = qbounds_quadrant(bounds, quadrant);
+        node = &node->children[quadrant];
+    }
+
+    return (_node_find_item(node, data, pos)) ? node : NULL;
+}
+
+/**
+ * Adds delta entities of class c to the subtree counts of the first n nodes of a path
+ */
+static void _path_count(QuadPath *path, unsigned int n, int c, int delta) {
+    for (unsigned int i = 0; i < n && i < path->len; i++) {
+        _node_count(path->nodes[i], c, delta);
+    }
+}
+
+/**
+ * Merges the children of a node back into the node if their entities fit into a single bucket.
+ * Continues upwards along the path (from index i) until a node with a populated subtree is reached.
+ */
+static void _node_collapse(QuadTree *tree, QuadPath *path, int i) {
+    QuadNode *node, *children;
+    QuadBucket *bucket, *child;
+
+    for (; i >= 0; i--) {
+        node = path->nodes[i];
+        children = node->children;
+        if (!children || node->len > tree->bucket) {
+            return;
+        }
+
+        for (int k = 0; k < 4; k++) {
+            if (children[k].children) {
+                return;
+            }
+        }
+
+        // children of a collapsible node have no overflow buckets (count <= bucket): keep the first bucket, merge the others into it
+        bucket = NULL;
+        for (int k = 0; k < 4; k++) {
+            child = children[k].bucket;
+            if (!child) {
+                continue;
+            }
+            if (!bucket) {
+                bucket = child;
+                continue;
+            }
+            for (unsigned int j = 0; j < child->len; j++) {
+                bucket->items[bucket->len++] = child->items[j];
+            }
+            _arena_release(&tree->buckets, child);
+        }
+
+        // subtree counts stay the same
+        node->children = NULL;
+        node->bucket = bucket;
+        _arena_release(&tree->nodes, children);
+    }
+}
+
+/**
+ * Pushes a node's children onto an explicit traversal stack, in reverse so that they are popped nw, ne, se, sw
+ */
+typedef struct QuadStackEntry {
+    QuadNode *node;
+    QuadBounds bounds;
+} QuadStackEntry;
+
+static inline size_t _stack_push_children(QuadStackEntry *stack, size_t top, QuadNode *node, QuadBounds bounds) {
+    assert(top + 4 <= QUAD_STACK_MAX);
+    stack[top++] = (QuadStackEntry){&node->children[QUAD_SW], qbounds_quadrant(bounds, QUAD_SW)};
+    stack[top++] = (QuadStackEntry){&node->children[QUAD_SE], qbounds_quadrant(bounds, QUAD_SE)};
+    stack[top++] = (QuadStackEntry){&node->children[QUAD_NE], qbounds_quadrant(bounds, QUAD_NE)};
+    stack[top++] = (QuadStackEntry){&node->children[QUAD_NW], qbounds_quadrant(bounds, QUAD_NW)};
+    return top;
+}
+
+/**
+ * Gets the query counters of a tree if counting is enabled
+ */
+static inline QuadCounters *_tree_counters(QuadTree *tree) {
+    return (tree->counting) ? &tree->counters : NULL;
+}
+
+/**
+ * Adds the counts of a query to the tree's counters (if enabled)
+ */
+static inline void _counters_add(QuadCounters *counters, QuadCounters *query) {
+    if (!counters) {
+        return;
+    }
+    counters->queries += query->queries;
+    counters->nodes += query->nodes;
+    counters->leaves += query->leaves;
+    counters->tested += query->tested;
+    counters->hits += query->hits;
+}
+
+/**
+ * Area query, depth first on an explicit stack (bounded by QUAD_DEPTH_LIMIT)
+ */
+static int _node_visit_area(QuadTree *tree, QuadNode *node, QuadBounds bounds, Vec2 nw, Vec2 se, unsigned int mask, QuadItemVisitor fn, void *ctx, QuadCounters *counters) {
+    if (!node) {
+        return QUAD_VISIT_CONTINUE;
+    }
+
+    QuadStackEntry stack[QUAD_STACK_MAX];
+    size_t top = 0;
+    stack[top++] = (QuadStackEntry){node, bounds};
+
+    QuadCounters count = {1, 0, 0, 0, 0};
+    int res = QUAD_VISIT_CONTINUE;
+
+    while (top && res != QUAD_VISIT_STOP) {
+        top--;
+        node = stack[top].node;
+        bounds = stack[top].bounds;
+        count.nodes++;
+
+        // this node does not interesect with the search boundary (or has no matching items)
+        // stop searching this branch
+        if (!node->len || !_node_matches(node, mask) || !qbounds_overlaps_area(bounds, nw, se)) {
+            continue;
+        }
+
+        // this is a data node (and thus without children)
+        if (qnode_isleaf(node)) {
+            count.leaves++;
+            count.tested += node->len;
+            for (QuadBucket *bucket = node->bucket; bucket && res != QUAD_VISIT_STOP; bucket = bucket->next) {
+                for (unsigned int i = 0; i < bucket->len; i++) {
+                    if (!vec2_within(bucket->items[i].pos, nw, se) || !_tree_matches(tree, mask, bucket->items[i].data)) {
+                        continue;
+                    }
+                    count.hits++;
+                    if (fn(&bucket->items[i], -1.f, ctx) == QUAD_VISIT_STOP) {
+                        res = QUAD_VISIT_STOP;
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+
+        top = _stack_push_children(stack, top, node, bounds);
+    }
+
+    _counters_add(counters, &count);
+    return res;
+}
+
+/**
+ * Circle query: prunes nodes by their distance to pos (circle-rectangle test), filters items by squared distance.
+ */
+static int _node_visit_radius(QuadTree *tree, QuadNode *node, QuadBounds bounds, Vec2 pos, float radius2, unsigned int mask, QuadItemVisitor fn, void *ctx, QuadCounters *counters) {
+    if (!node) {
+        return QUAD_VISIT_CONTINUE;
+    }
+
+    QuadStackEntry stack[QUAD_STACK_MAX];
+    size_t top = 0;
+    stack[top++] = (QuadStackEntry){node, bounds};
+
+    QuadCounters count = {1, 0, 0, 0, 0};
+    int res = QUAD_VISIT_CONTINUE;
+    Vec2 delta;
+    float dist2;
+
+    while (top && res != QUAD_VISIT_STOP) {
+        top--;
+        node = stack[top].node;
+        bounds = stack[top].bounds;
+        count.nodes++;
+
+        // this node does not interesect with the search circle (or has no matching items)
+        if (!node->len || !_node_matches(node, mask) || _bounds_mindist2(bounds, pos) > radius2) {
+            continue;
+        }
+
+        if (qnode_isleaf(node)) {
+            count.leaves++;
+            count.tested += node->len;
+            for (QuadBucket *bucket = node->bucket; bucket && res != QUAD_VISIT_STOP; bucket = bucket->next) {
+                for (unsigned int i = 0; i < bucket->len; i++) {
+                    delta = vec2_sub(bucket->items[i].pos, pos);
+                    dist2 = delta.x * delta.x + delta.y * delta.y;
+                    if (dist2 > radius2 || !_tree_matches(tree, mask, bucket->items[i].data)) {
+                        continue;
+                    }
+                    count.hits++;
+                    if (fn(&bucket->items[i], dist2, ctx) == QUAD_VISIT_STOP) {
+                        res = QUAD_VISIT_STOP;
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+
+        top = _stack_push_children(stack, top, node, bounds);
+    }
+
+    _counters_add(counters, &count);
+    return res;
+}
+
+/**
+ * Range count: nodes fully inside the area contribute their subtree counts without being descended into,
+ * only the entities of partially covered leaves are tested.
+ */
+static size_t _node_count_area(QuadTree *tree, QuadNode *node, QuadBounds bounds, Vec2 nw, Vec2 se, size_t *classes, QuadCounters *counters) {
+    QuadStackEntry stack[QUAD_STACK_MAX];
+    size_t top = 0;
+    stack[top++] = (QuadStackEntry){node, bounds};
+
+    QuadCounters count = {1, 0, 0, 0, 0};
+    size_t total = 0;
+    int c;
+
+    while (top) {
+        top--;
+        node = stack[top].node;
+        bounds = stack[top].bounds;
+        count.nodes++;
+
+        if (!node->len || !qbounds_overlaps_area(bounds, nw, se)) {
+            continue;
+        }
+
+        if (qbounds_within_area(bounds, nw, se)) {
+            total += node->len;
+#if QUAD_CLASSES > 0
+            for (int i = 0; classes && i < QUAD_CLASSES; i++) {
+                classes[i] += node->classes[i];
+            }
+#endif
+            continue;
+        }
+
+        if (qnode_isleaf(node)) {
+            count.leaves++;
+            count.tested += node->len;
+            for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+                for (unsigned int i = 0; i < bucket->len; i++) {
+                    if (!vec2_within(bucket->items[i].pos, nw, se)) {
+                        continue;
+                    }
+                    total++;
+                    c = (classes) ? _tree_class(tree, bucket->items[i].data) : -1;
+                    if (c >= 0 && c < QUAD_CLASSES) {
+                        classes[c]++;
+                    }
+                }
+            }
+            continue;
+        }
+
+        top = _stack_push_children(stack, top, node, bounds);
+    }
+
+    count.hits = total;
+    _counters_add(counters, &count);
+    return total;
+}
+
+/**
+ * Slab test of the segment a + t * dir (t in 0..1) against bounds grown by r on each side.
+ * Sets the parameter where the segment enters the bounds (0 if a is inside).
+ */
+static int _bounds_segment(QuadBounds bounds, float r, Vec2 a, Vec2 dir, float *enter) {
+    float t0 = 0.f, t1 = 1.f;
+    float lo[2] = {bounds.nw.x - r, bounds.nw.y - r};
+    float hi[2] = {bounds.se.x + r, bounds.se.y + r};
+    float from[2] = {a.x, a.y};
+    float d[2] = {dir.x, dir.y};
+    float ta, tb, tmp;
+
+    for (int k = 0; k < 2; k++) {
+        if (d[k] == 0) {
+            if (from[k] < lo[k] || from[k] > hi[k]) {
+                return 0;
+            }
+            continue;
+        }
+        ta = (lo[k] - from[k]) / d[k];
+        tb = (hi[k] - from[k]) / d[k];
+        if (ta > tb) {
+            tmp = ta;
+            ta = tb;
+            tb = tmp;
+        }
+        t0 = fmaxf(t0, ta);
+        t1 = fminf(t1, tb);
+        if (t0 > t1) {
+            return 0;
+        }
+    }
+
+    *enter = t0;
+    return 1;
+}
+
+/**
+ * Segment query: front to back, children are visited in the order the segment (grown by r) enters them.
+ * Hits are items within r of the segment, appended with the squared distance of their projection from a.
+ */
+static void _node_find_segment(QuadNode *node, QuadBounds bounds, Vec2 a, Vec2 dir, float r, QuadList *list, QuadCounters *counters) {
+    QuadStackEntry stack[QUAD_STACK_MAX];
+    size_t top = 0;
+    stack[top++] = (QuadStackEntry){node, bounds};
+
+    QuadCounters count = {1, 0, 0, 0, 0};
+    QuadStackEntry children[4];
+    float enter[4];
+    float len2 = dir.x * dir.x + dir.y * dir.y;
+    float r2 = r * r;
+    float t;
+    Vec2 delta;
+    size_t n, j;
+
+    while (top) {
+        top--;
+        node = stack[top].node;
+        bounds = stack[top].bounds;
+        count.nodes++;
+
+        if (!node->len || !_bounds_segment(bounds, r, a, dir, &t)) {
+            continue;
+        }
+
+        if (qnode_isleaf(node)) {
+            count.leaves++;
+            count.tested += node->len;
+            for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+                for (unsigned int i = 0; i < bucket->len; i++) {
+                    // closest point on the segment
+                    delta = vec2_sub(bucket->items[i].pos, a);
+                    t = (len2 > 0) ? fminf(fmaxf((delta.x * dir.x + delta.y * dir.y) / len2, 0.f), 1.f) : 0.f;
+                    delta.x -= t * dir.x;
+                    delta.y -= t * dir.y;
+                    if (delta.x * delta.x + delta.y * delta.y > r2) {
+                        continue;
+                    }
+                    count.hits++;
+                    qlist_append_dist(list, &bucket->items[i], t * t * len2);
+                }
+            }
+            continue;
+        }
+
+        // children entered by the segment, furthest first: the nearest is popped next
+        n = 0;
+        for (int i = 0; i < 4; i++) {
+            QuadBounds child = qbounds_quadrant(bounds, i);
+            if (!node->children[i].len || !_bounds_segment(child, r, a, dir, &t)) {
+                continue;
+            }
+            for (j = n; j > 0 && enter[j - 1] < t; j--) {
+                enter[j] = enter[j - 1];
+                children[j] = children[j - 1];
+            }
+            enter[j] = t;
+            children[j] = (QuadStackEntry){&node->children[i], child};
+            n++;
+        }
+
+        assert(top + n <= QUAD_STACK_MAX);
+        for (j = 0; j < n; j++) {
+            stack[top++] = children[j];
+        }
+    }
+
+    _counters_add(counters, &count);
+}
+
+/**
+ * Item visitor collecting into a QuadList (ctx)
+ */
+static int _visit_append(QuadItem *item, float dist2, void *ctx) {
+    qlist_append_dist((QuadList *)ctx, item, dist2);
+    return QUAD_VISIT_CONTINUE;
+}
+
+////
+// Nearest neighbours
+////
+
+#define QUAD_KNN_STACK 64 // heap entries kept on the stack before falling back to malloc
+
+typedef struct QuadKnnEntry {
+    float dist2;
+    void *ptr;         // QuadNode (frontier) or QuadItem (results)
+    QuadBounds bounds; // frontier only
+} QuadKnnEntry;
+
+typedef struct QuadKnnHeap {
+    size_t len;
+    size_t max;
+    QuadKnnEntry *entries;
+    int owned; // entries have been malloc'ed
+} QuadKnnHeap;
+
+int quad_alloc_fail = -1;
+
+/**
+ * realloc() of the knn search: fails once quad_alloc_fail more allocations succeeded (test hook, see qtree.h)
+ */
+static void *_knn_realloc(void *ptr, size_t size) {
+    if (quad_alloc_fail == 0) {
+        return NULL;
+    }
+    if (quad_alloc_fail > 0) {
+        quad_alloc_fail--;
+    }
+    return realloc(ptr, size);
+}
+
+/**
+ * Grows the capacity of a list to (at least) max items, the list keeps its items and capacity if that fails
+ */
+static int _list_reserve(QuadList *list, size_t max) {
+    if (max <= list->max) {
+        return 0;
+    }
+    QuadItem **items = _knn_realloc(list->items, max * sizeof(QuadItem *));
+    if (!items) {
+        LOG_ERROR("error re-allocating memory for quadlist items");
+        return -1;
+    }
+    list->items = items;
+    float *dist2 = _knn_realloc(list->dist2, max * sizeof(float));
+    if (!dist2) {
+        LOG_ERROR("error re-allocating memory for quadlist distances");
+        return -1;
+    }
+    list->dist2 = dist2;
+    list->max = max;
+    return 0;
+}
+
+/**
+ * Binary heap, ordered by dist2: min heap (frontier) if sign is 1, max heap (results) if sign is -1
+ */
+static int _heap_push(QuadKnnHeap *heap, QuadKnnEntry entry, float sign) {
+    if (heap->len >= heap->max) {
+        size_t max = heap->max * 2;
+        QuadKnnEntry *entries = _knn_realloc((heap->owned) ? heap->entries : NULL, max * sizeof(QuadKnnEntry));
+        if (!entries) {
+            LOG_ERROR("failed to allocate memory for knn heap");
+            return -1;
+        }
+        if (!heap->owned) {
+            for (size_t i = 0; i < heap->len; i++) {
+                entries[i] = heap->entries[i];
+            }
+        }
+        heap->entries = entries;
+        heap->max = max;
+        heap->owned = 1;
+    }
+
+    size_t i = heap->len++;
+    size_t parent;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (sign * heap->entries[parent].dist2 <= sign * entry.dist2) {
+            break;
+        }
+        heap->entries[i] = heap->entries[parent];
+        i = parent;
+    }
+    heap->entries[i] = entry;
+    return 0;
+}
+
+static QuadKnnEntry _heap_pop(QuadKnnHeap *heap, float sign) {
+    QuadKnnEntry top = heap->entries[0];
+    QuadKnnEntry last = heap->entries[--heap->len];
+
+    size_t i = 0;
+    size_t child;
+    while ((child = 2 * i + 1) < heap->len) {
+        if (child + 1 < heap->len && sign * heap->entries[child + 1].dist2 < sign * heap->entries[child].dist2) {
+            child++;
+        }
+        if (sign * last.dist2 <= sign * heap->entries[child].dist2) {
+            break;
+        }
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+    if (heap->len) {
+        heap->entries[i] = last;
+    }
+    return top;
+}
+
+/**
+ * Best-first search: nodes are visited in order of their distance to pos, the k best items so far are kept in a bounded max heap.
+ * Stops as soon as the closest unvisited node is further away than the k-th best item (or max_radius).
+ * Returns -1 if a heap or the list could not grow, nothing is appended then (the result would be incomplete).
+ */
+static int _node_find_knn(QuadTree *tree, QuadNode *root, QuadBounds bounds, Vec2 pos, size_t k, float max_radius, unsigned int mask, QuadList *list) {
+    QuadKnnEntry frontier_stack[QUAD_KNN_STACK];
+    QuadKnnEntry results_stack[QUAD_KNN_STACK];
+    QuadKnnHeap frontier = {0, QUAD_KNN_STACK, frontier_stack, 0};
+    QuadKnnHeap results = {0, QUAD_KNN_STACK, results_stack, 0};
+
+    float radius2 = max_radius * max_radius;
+    float dist2, worst;
+    QuadNode *node;
+    QuadBounds child;
+    Vec2 delta;
+
+    int failed = _heap_push(&frontier, (QuadKnnEntry){_bounds_mindist2(bounds, pos), root, bounds}, 1);
+
+    while (frontier.len && !failed) {
+        QuadKnnEntry next = _heap_pop(&frontier, 1);
+        worst = (results.len == k) ? results.entries[0].dist2 : radius2;
+        if (next.dist2 > worst) {
+            break;
+        }
+
+        node = next.ptr;
+
+        if (qnode_isleaf(node)) {
+            for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+                for (unsigned int i = 0; i < bucket->len; i++) {
+                    delta = vec2_sub(bucket->items[i].pos, pos);
+                    dist2 = delta.x * delta.x + delta.y * delta.y;
+                    if (dist2 > radius2 || !_tree_matches(tree, mask, bucket->items[i].data)) {
+                        continue;
+                    }
+                    if (results.len < k) {
+                        failed |= _heap_push(&results, (QuadKnnEntry){dist2, &bucket->items[i], {{0.f, 0.f}, {0.f, 0.f}}}, -1);
+                    } else if (dist2 < results.entries[0].dist2) {
+                        // replaces the top, the heap does not grow
+                        _heap_pop(&results, -1);
+                        _heap_push(&results, (QuadKnnEntry){dist2, &bucket->items[i], {{0.f, 0.f}, {0.f, 0.f}}}, -1);
+                    }
+                }
+            }
+            continue;
+        }
+
+        if (qnode_ispointer(node)) {
+            worst = (results.len == k) ? results.entries[0].dist2 : radius2;
+            for (int i = 0; i < 4; i++) {
+                child = qbounds_quadrant(next.bounds, i);
+                dist2 = _bounds_mindist2(child, pos);
+                if (dist2 <= worst && node->children[i].len && _node_matches(&node->children[i], mask)) {
+                    failed |= _heap_push(&frontier, (QuadKnnEntry){dist2, &node->children[i], child}, 1);
+                }
+            }
+        }
+    }
+
+    // grow the list once, then drain the max heap (furthest first) into it back to front: closest first
+    size_t offset = list->len;
+    size_t len = results.len;
+    QuadKnnEntry entry;
+    if (!failed && _list_reserve(list, offset + len) == 0) {
+        for (size_t i = len; i > 0; i--) {
+            entry = _heap_pop(&results, -1);
+            list->items[offset + i - 1] = entry.ptr;
+            list->dist2[offset + i - 1] = entry.dist2;
+        }
+        list->len = offset + len;
+    } else {
+        failed = 1;
+    }
+
+    if (frontier.owned) {
+        freez(frontier.entries);
+    }
+    if (results.owned) {
+        freez(results.entries);
+    }
+
+    return (failed) ? -1 : 0;
+}
+
+// --- public
+
+/**
+ * Creates a standalone (empty) node. Nodes of a tree live in the tree's arena.
+ */
+QuadNode *qnode_create() {
+    QuadNode *node = malloc(sizeof(QuadNode));
+    if (!node) {
+        LOG_ERROR("failed to allaocate memory for QuadNode");
+        return NULL;
+    }
+
+    _node_init(node, 0);
+    return node;
+}
+
+/**
+ * Frees a standalone node created with qnode_create().
+ * Nodes of a tree live in the tree's arena and are released with qtree_destroy()
+ */
+void qnode_destroy(QuadNode *node) {
+    if (!node) {
+        return;
+    }
+
+    // We  don not manage the memory of the data item
+    freez(node);
+}
+
+int qnode_isleaf(QuadNode *node) {
+    return node->children == NULL && node->len > 0;
+}
+
+// TODO rename
+int qnode_ispointer(QuadNode *node) {
+    return node->children != NULL;
+}
+
+int qnode_isempty(QuadNode *node) {
+    return node->len == 0;
+}
+
+/**
+ * Gets the area of a child quadrant (QUAD_NW..QUAD_SE) within bounds
+ */
+QuadBounds qbounds_quadrant(QuadBounds bounds, int quadrant) {
+    Vec2 ctr = _bounds_center(bounds);
+    QuadBounds child;
+
+    child.nw.x = (quadrant & 1) ? ctr.x : bounds.nw.x;
+    child.se.x = (quadrant & 1) ? bounds.se.x : ctr.x;
+    child.nw.y = (quadrant & 2) ? ctr.y : bounds.nw.y;
+    child.se.y = (quadrant & 2) ? bounds.se.y : ctr.y;
+    return child;
+}
+
+/**
+ * checks if bounds are fully enclosed by a given area
+ */
+int qbounds_within_area(QuadBounds bounds, Vec2 nw, Vec2 se) {
+    return bounds.nw.x >= nw.x && bounds.se.x <= se.x && bounds.nw.y >= nw.y && bounds.se.y <= se.y;
+}
+
+/**
+ * checks if bounds overlap a given area
+ */
+int qbounds_overlaps_area(QuadBounds bounds, Vec2 nw, Vec2 se) {
+    return bounds.nw.x <= se.x && bounds.se.x >= nw.x && bounds.nw.y <= se.y && bounds.se.y >= nw.y;
+}
+
+/**
+ * Splits a query area nw-se on the torus of bounds: gets the offsets to add to the area (and its query position)
+ * for each of its images which overlaps bounds, {0, 0} first. Returns the number of offsets (1..4).
+ * An area crossing the east edge is shifted west by the width of bounds, and so forth.
+ * The area must be narrower and lower than bounds: a wider one crosses both edges and needs more images than this,
+ * see qbounds_wrap_radius().
+ */
+size_t qbounds_wrap_offsets(QuadBounds bounds, Vec2 nw, Vec2 se, Vec2 offsets[4]) {
+    float width = bounds.se.x - bounds.nw.x;
+    float height = bounds.se.y - bounds.nw.y;
+    float x = (se.x >= bounds.se.x) ? -width : (nw.x < bounds.nw.x) ? width : 0.f;
+    float y = (se.y >= bounds.se.y) ? -height : (nw.y < bounds.nw.y) ? height : 0.f;
+    size_t len = 0;
+
+    offsets[len++] = (Vec2){0.f, 0.f};
+    if (x != 0) {
+        offsets[len++] = (Vec2){x, 0.f};
+    }
+    if (y != 0) {
+        offsets[len++] = (Vec2){0.f, y};
+    }
+    if (x != 0 && y != 0) {
+        offsets[len++] = (Vec2){x, y};
+    }
+    return len;
+}
+
+/**
+ * Clamps a query radius on the torus of bounds to below half of its width and height.
+ * The images of a smaller circle neither overlap (an item would be found twice) nor miss an edge, see qbounds_wrap_offsets().
+ * Nothing is further away than that along the shorter side anyway, the short way around.
+ */
+float qbounds_wrap_radius(QuadBounds bounds, float radius) {
+    float half = 0.5f * fminf(bounds.se.x - bounds.nw.x, bounds.se.y - bounds.nw.y);
+    return (radius < half) ? radius : nextafterf(half, 0.f);
+}
+
+/**
+ * An area at least as wide (or high) as the torus of bounds covers all of it along that axis: clamps it to bounds (se exclusive),
+ * so it has a single image along that axis, see qbounds_wrap_offsets()
+ */
+static void _bounds_wrap_area(QuadBounds bounds, Vec2 *nw, Vec2 *se) {
+    if (se->x - nw->x >= bounds.se.x - bounds.nw.x) {
+        nw->x = bounds.nw.x;
+        se->x = nextafterf(bounds.se.x, bounds.nw.x);
+    }
+    if (se->y - nw->y >= bounds.se.y - bounds.nw.y) {
+        nw->y = bounds.nw.y;
+        se->y = nextafterf(bounds.se.y, bounds.nw.y);
+    }
+}
+
+/**
+ * Walks trough a node's subtree (covering bounds) and applies descent (before visiting the children) and ascent (after) callbacks
+ * with a user context. Either callback may be NULL.
+ * descent can return QUAD_VISIT_SKIP to not recurse into a node's children, both can return QUAD_VISIT_STOP to end the walk.
+ * Returns QUAD_VISIT_STOP if the walk was terminated.
+ * Iterative: one stack frame (node, bounds, next child) per level, bounded by QUAD_DEPTH_LIMIT.
+ */
+int qnode_walk_ctx(QuadNode *node, QuadBounds bounds, QuadNodeVisitor descent, QuadNodeVisitor ascent, void *ctx) {
+    if (!node) {
+        return QUAD_VISIT_CONTINUE;
+    }
+
+    struct {
+        QuadNode *node;
+        QuadBounds bounds;
+        int child;
+    } stack[QUAD_DEPTH_LIMIT + 1];
+    int top = -1;
+
+    QuadNode *next = node;
+    QuadBounds next_bounds = bounds;
+    int res;
+
+    while (1) {
+        // enter next
+        if (next) {
+            res = (descent) ? (*descent)(next, next_bounds, ctx) : QUAD_VISIT_CONTINUE;
+            if (res == QUAD_VISIT_STOP) {
+                return QUAD_VISIT_STOP;
+            }
+            if (res != QUAD_VISIT_SKIP && next->children) {
+                assert(top + 1 <= QUAD_DEPTH_LIMIT);
+                top++;
+                stack[top].node = next;
+                stack[top].bounds = next_bounds;
+                stack[top].child = 0;
+            } else {
+                // nothing to descend into: leave right away
+                if (ascent && (*ascent)(next, next_bounds, ctx) == QUAD_VISIT_STOP) {
+                    return QUAD_VISIT_STOP;
+                }
+                if (top < 0) {
+                    return QUAD_VISIT_CONTINUE;
+                }
+            }
+            next = NULL;
+        }
+
+        // next child of the current node, or leave it
+        if (stack[top].child < 4) {
+            next_bounds = qbounds_quadrant(stack[top].bounds, stack[top].child);
+            next = &stack[top].node->children[stack[top].child++];
+            continue;
+        }
+
+        if (ascent && (*ascent)(stack[top].node, stack[top].bounds, ctx) == QUAD_VISIT_STOP) {
+            return QUAD_VISIT_STOP;
+        }
+        if (--top < 0) {
+            return QUAD_VISIT_CONTINUE;
+        }
+    }
+}
+
+/**
+ * qnode_walk_ctx() over a whole tree
+ */
+int qtree_walk(QuadTree *tree, QuadNodeVisitor descent, QuadNodeVisitor ascent, void *ctx) {
+    if (!tree) {
+        return QUAD_FAILED;
+    }
+    return qnode_walk_ctx(tree->root, tree->bounds, descent, ascent, ctx);
+}
+
 ////
-// QuadNode
+// Bulk build
 ////
 
-// forward declarations
-static int _node_split(QuadTree *tree, QuadNode *node);
-void qnode_print(FILE *fp, QuadNode *node);
+typedef struct QuadBuildTask {
+    QuadNode *node;
+    QuadBounds bounds;
+    QuadItem *items;
+    size_t len;
+} QuadBuildTask;
+
+typedef struct QuadBuildJob {
+    QuadTree *tree;
+    QuadBuildTask *tasks;
+    size_t tasks_len;
+    atomic_size_t next; // next task to be taken by a worker
+    atomic_int failed;
+} QuadBuildJob;
+
+typedef struct QuadBuildWorker {
+    QuadBuildJob *job;
+    QuadArena *nodes;
+    QuadArena *buckets;
+} QuadBuildWorker;
 
 /**
- * Checks if a pos is with an node boundary.
+ * Checks if all items are located at the same position, in which case splitting would not separate them
  */
-static int _node_contains(QuadNode *node, Vec2 pos) {
-    // printf(" -- nw: {%f, %f}, se: {%f, %f}, pos: {%f, %f}\n", node->self_nw.x, node->self_nw.y, node->self_se.x, node->self_se.y, pos.x, pos.y);
-    return node != NULL && pos.x >= node->self_nw.x && pos.x < node->self_se.x && pos.y >= node->self_nw.y && pos.y < node->self_se.y;
+static int _items_coincident(QuadItem *items, size_t len) {
+    for (size_t i = 1; i < len; i++) {
+        if (!vec2_equals(items[i].pos, items[0].pos)) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
 /**
- * Gets the matching quadrant child node for a given position.
+ * Moves the items before the split line (x < ctr, or y < ctr) to the front, returns their count
  */
-static QuadNode *_node_quadrant(QuadNode *node, Vec2 pos) {
-    // printf("-- nw: {%f, %f}, se: {%f, %f}, pos: {%f, %f}\n", node->self_nw.x, node->self_nw.y, node->self_se.x, node->self_se.y, pos.x, pos.y);
-    if (_node_contains(node->nw, pos)) {
-        return node->nw;
-    }
-    if (_node_contains(node->ne, pos)) {
-        return node->ne;
-    }
-    if (_node_contains(node->sw, pos)) {
-        return node->sw;
-    }
-    if (_node_contains(node->se, pos)) {
-        return node->se;
+static size_t _items_partition(QuadItem *items, size_t len, float ctr, int axis) {
+    size_t lo = 0;
+    size_t hi = len;
+    QuadItem tmp;
+
+    while (lo < hi) {
+        if (((axis) ? items[lo].pos.y : items[lo].pos.x) < ctr) {
+            lo++;
+        } else {
+            hi--;
+            tmp = items[lo];
+            items[lo] = items[hi];
+            items[hi] = tmp;
+        }
     }
-    return NULL;
+    return lo;
 }
 
 /**
- * Clears data properites in a node
+ * Fills a leaf with items, same layout as inserting them one by one: tree->bucket items in the first bucket, the rest in overflow buckets
  */
-static void _node_clear_data(QuadNode *node) {
-    node->pos = (Vec2){INFINITY, INFINITY};
-    node->data = NULL;
+static int _node_fill(QuadTree *tree, QuadArena *buckets, QuadNode *node, QuadItem *items, size_t len) {
+    QuadBucket **tail = &node->bucket;
+    size_t n = 0;
+    unsigned int max = tree->bucket;
+
+    while (n < len) {
+        QuadBucket *bucket = _bucket_alloc(buckets);
+        if (!bucket) {
+            return QUAD_FAILED;
+        }
+
+        while (n < len && bucket->len < max) {
+            bucket->items[bucket->len++] = items[n++];
+        }
+        *tail = bucket;
+        tail = &bucket->next;
+        max = QUAD_BUCKET_MAX;
+    }
+    node->len = len;
+    return QUAD_INSERTED;
 }
 
 /**
- * Inserts an entity into a tree node. The node might be split into four childs, or the  already existing entity in this node might be replaced
- * Note: The position bounds must be checked by callee (qtree_insert())
+ * Builds the subtree of an empty node top-down from a set of items (all within the node), on an explicit stack.
+ * Splits exactly where inserting the items one by one would, regardless of their order.
+ * Nodes below defer_depth which still need splitting are not built but collected into deferred (if not NULL).
  */
-static int _node_insert(QuadTree *tree, QuadNode *node, void *data, Vec2 pos) {
-    if (!tree || !node || !data) {
-        return QUAD_FAILED;
-    }
+static int _node_build(QuadTree *tree, QuadArena *nodes, QuadArena *buckets, QuadBuildTask root, unsigned int defer_depth, QuadBuildTask *deferred, size_t *deferred_len) {
+    QuadBuildTask stack[QUAD_STACK_MAX];
+    size_t top = 0;
+    stack[top++] = root;
+
+    QuadBuildTask task;
+    QuadNode *node, *children;
+    Vec2 ctr;
+    size_t north, nw, sw;
+
+    while (top) {
+        task = stack[--top];
+        node = task.node;
+
+        if (!task.len) {
+            continue;
+        }
 
-    // 1. insert into THIS (empty) node (just created before)
-    if (qnode_isempty(node)) {
-        node->pos = pos;
-        node->data = data;
-        return QUAD_INSERTED;
-    }
+        // leaf
+        if (task.len <= tree->bucket || node->depth >= tree->max_depth || _items_coincident(task.items, task.len)) {
+            if (_node_fill(tree, buckets, node, task.items, task.len) == QUAD_FAILED) {
+                return QUAD_FAILED;
+            }
+            continue;
+        }
 
-    // 2. replace THIS node OR split and insert into CHILDREN
-    if (qnode_isleaf(node)) {
-        // 2.1 pos match: replace
-        if (node->pos.x == pos.x && node->pos.y == pos.y) {
-            node->pos = pos;
-            node->data = data;
-            return QUAD_REPLACED;
+        node->len = task.len;
+        if (deferred && node->depth >= defer_depth) {
+            deferred[(*deferred_len)++] = task;
+            continue;
         }
 
-        // 2.2 split node (and also mv previous node)
-        if (_node_split(tree, node) == QUAD_FAILED) {
+        children = _arena_alloc(nodes, 4);
+        if (!children) {
             return QUAD_FAILED;
         }
+        for (int i = 0; i < 4; i++) {
+            _node_init(&children[i], node->depth + 1);
+        }
+        node->children = children;
+
+        // same quadrants as _bounds_quadrant(): north of (and west of) the center, items ordered nw, ne, sw, se
+        ctr = _bounds_center(task.bounds);
+        north = _items_partition(task.items, task.len, ctr.y, 1);
+        nw = _items_partition(task.items, north, ctr.x, 0);
+        sw = _items_partition(&task.items[north], task.len - north, ctr.x, 0);
+
+        assert(top + 4 <= QUAD_STACK_MAX);
+        stack[top++] = (QuadBuildTask){&children[QUAD_SE], qbounds_quadrant(task.bounds, QUAD_SE), &task.items[north + sw], task.len - north - sw};
+        stack[top++] = (QuadBuildTask){&children[QUAD_SW], qbounds_quadrant(task.bounds, QUAD_SW), &task.items[north], sw};
+        stack[top++] = (QuadBuildTask){&children[QUAD_NE], qbounds_quadrant(task.bounds, QUAD_NE), &task.items[nw], north - nw};
+        stack[top++] = (QuadBuildTask){&children[QUAD_NW], qbounds_quadrant(task.bounds, QUAD_NW), task.items, nw};
+    }
+    return QUAD_INSERTED;
+}
+
+/**
+ * Worker thread: builds deferred subtrees into its own arenas until there are none left
+ */
+static void *_build_worker(void *arg) {
+    QuadBuildWorker *worker = arg;
+    QuadBuildJob *job = worker->job;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->tasks_len) {
+        if (atomic_load(&job->failed)) {
+            break;
+        }
+        if (_node_build(job->tree, worker->nodes, worker->buckets, job->tasks[i], 0, NULL, NULL) == QUAD_FAILED) {
+            atomic_store(&job->failed, 1);
+        }
+    }
+    return NULL;
+}
 
-        // 2.3. insertcurrent node
-        return _node_insert(tree, node, data, pos);
+/**
+ * Makes sure the tree has (at least) one pair of node and bucket arenas per worker thread
+ */
+static int _build_arenas(QuadTree *tree, unsigned int threads) {
+    if (tree->arenas_len >= threads) {
+        return 0;
     }
 
-    // 3. insert into one of THIS CHILDREN
-    if (qnode_ispointer(node)) {
-        QuadNode *child = _node_quadrant(node, pos);
-        if (!child) {
-            return QUAD_FAILED;
+    QuadArena *arenas = realloc(tree->arenas, 2 * threads * sizeof(QuadArena));
+    if (!arenas) {
+        LOG_ERROR("failed to allocate memory for QuadTree worker arenas");
+        return -1;
+    }
+    for (unsigned int i = tree->arenas_len; i < threads; i++) {
+        _arena_init(&arenas[2 * i], sizeof(QuadNode), 4);
+        _arena_init(&arenas[2 * i + 1], sizeof(QuadBucket), 1);
+    }
+    tree->arenas = arenas;
+    tree->arenas_len = threads;
+    return 0;
+}
+
+/**
+ * Ascent visitor summing up the class mask and per-class counts of a node (ctx: tree), leaves from their items, internal nodes from their children
+ */
+static int _node_sum_classes(QuadNode *node, QuadBounds bounds, void *ctx) {
+    (void)bounds; // visitor signature
+    int c;
+    node->mask = 0;
+#if QUAD_CLASSES > 0
+    memset(node->classes, 0, sizeof(node->classes));
+#endif
+
+    if (node->children) {
+        for (int k = 0; k < 4; k++) {
+            node->mask |= node->children[k].mask;
+#if QUAD_CLASSES > 0
+            for (int i = 0; i < QUAD_CLASSES; i++) {
+                node->classes[i] += node->children[k].classes[i];
+            }
+#endif
         }
-        return _node_insert(tree, child, data, pos);
+        return QUAD_VISIT_CONTINUE;
     }
 
-    return QUAD_FAILED;
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            c = _tree_class(ctx, bucket->items[i].data);
+            if (c < 0) {
+                continue;
+            }
+            node->mask |= 1u << c;
+#if QUAD_CLASSES > 0
+            if (c < QUAD_CLASSES) {
+                node->classes[c]++;
+            }
+#endif
+        }
+    }
+    return QUAD_VISIT_CONTINUE;
 }
 
 /**
- * Spits a quadrant nodes into 4 child quadrants.
- * Moves a existing entity node into the matching quadrant.
+ * Recomputes the class masks (and counts) of a path from index i up to the root after a removal: a mask can't be decremented
  */
-static int _node_split(QuadTree *tree, QuadNode *node) {
-    if (!tree || !node) {
-        return QUAD_FAILED;
+static void _path_mask(QuadTree *tree, QuadPath *path, int i) {
+    if (!tree->classify) {
+        return;
+    }
+    for (; i >= 0; i--) {
+        _node_sum_classes(path->nodes[i], path->bounds[i], tree);
+    }
+}
+
+/**
+ * Completes a bulk build (subtree entity counts are set while partitioning)
+ */
+static int _build_done(QuadTree *tree, size_t len) {
+    tree->length = len;
+    if (tree->classify) {
+        qtree_walk(tree, NULL, _node_sum_classes, tree);
     }
+    return len;
+}
 
-    QuadNode *nw = qnode_create(node);
-    QuadNode *ne = qnode_create(node);
-    QuadNode *sw = qnode_create(node);
-    QuadNode *se = qnode_create(node);
+////
+// QuadTree
+////
 
-    if (!nw || !ne || !sw || !se) {
-        return QUAD_FAILED;
+QuadTree *qtree_create(Vec2 window_nw, Vec2 window_se) {
+    assert(window_nw.x < window_se.x);
+    assert(window_nw.y < window_se.y);
+
+    QuadTree *tree = malloc(sizeof(QuadTree));
+    if (!tree) {
+        return NULL;
     }
 
-    void *data = node->data;
-    Vec2 pos = node->pos;
+    _arena_init(&tree->nodes, sizeof(QuadNode), 4);
+    _arena_init(&tree->buckets, sizeof(QuadBucket), 1);
+
+    tree->root = _arena_alloc(&tree->nodes, 1);
+    if (!tree->root) {
+        _arena_destroy(&tree->nodes);
+        freez(tree);
+        return NULL;
+    }
 
-    // nw(x,y)            hw
-    // x────────────┬────────────┐
-    // │            │            │
-    // │            │            │
-    // │     nw     │     ne     │ hh
-    // │            │            │
-    // │            │            │
-    // ├────────────x────────────┤
-    // │            │ c(x,y)     │
-    // │            │            │
-    // │     sw     │     se     │
-    // │            │            │
-    // │            │            │
-    // └────────────┴────────────x
-    //                     se(x,y)
+    _node_init(tree->root, 0);
+    tree->bounds = (QuadBounds){window_nw, window_se};
+    tree->length = 0;
 
-    float hw = node->width / 2;
-    float hh = node->height / 2;
+    tree->bucket = 1;
+    tree->max_depth = QUAD_DEPTH_MAX;
 
-    float minx = node->self_nw.x;
-    float miny = node->self_nw.y;
-    float ctrx = minx + hw;
-    float ctry = miny + hh;
-    float maxx = node->self_se.x;
-    float maxy = node->self_se.y;
+    tree->replaced = 0;
+    tree->failed = 0;
+    tree->counting = 0;
+    tree->counters = (QuadCounters){0};
 
-    /*                         nw                     se              */
-    qnode_set_bounds(nw, (Vec2){minx, miny}, (Vec2){ctrx, ctry});
-    qnode_set_bounds(ne, (Vec2){ctrx, miny}, (Vec2){maxx, ctry});
-    qnode_set_bounds(se, (Vec2){ctrx, ctry}, (Vec2){maxx, maxy});
-    qnode_set_bounds(sw, (Vec2){minx, ctry}, (Vec2){ctrx, maxy});
+    tree->classify = NULL;
+    tree->classify_ctx = NULL;
+    tree->toroidal = 0;
 
-    node->nw = nw;
-    node->ne = ne;
-    node->sw = sw;
-    node->se = se;
+    tree->arenas = NULL;
+    tree->arenas_len = 0;
+    tree->bulk = NULL;
+    tree->bulk_max = 0;
 
-    _node_clear_data(node);
-    return _node_insert(tree, node, data, pos); // inserts into one of the children
+    return tree;
 }
 
 /**
- * Find a node for a given position
- * uses same conditions as _node_find()
+ * Sets the bucket size (entities per leaf before splitting) and the depth cap of an empty tree.
  */
-QuadNode *_node_find(QuadTree *tree, QuadNode *node, Vec2 pos) {
-    if (!tree || !node) {
-        return NULL;
+int qtree_configure(QuadTree *tree, unsigned int bucket, unsigned int max_depth) {
+    if (!tree || tree->length) {
+        return -1;
+    }
+    if (bucket < 1 || bucket > QUAD_BUCKET_MAX) {
+        LOG_ERROR_F("invalid bucket size %d (1..%d)", bucket, QUAD_BUCKET_MAX);
+        return -1;
     }
 
-    if (qnode_isleaf(node)) {
-        if (node->pos.x == pos.x && node->pos.y == pos.y) {
-            return node;
-        }
+    if (max_depth > QUAD_DEPTH_LIMIT) {
+        LOG_ERROR_F("invalid max depth %d (0..%d)", max_depth, QUAD_DEPTH_LIMIT);
+        return -1;
     }
 
-    if (qnode_ispointer(node)) {
-        QuadNode *child = _node_quadrant(node, pos);
-        if (!child) {
-            return NULL;
-        }
-        return _node_find(tree, child, pos);
+    tree->bucket = bucket;
+    tree->max_depth = max_depth;
+    return 0;
+}
+
+/**
+ * Sets the classifier of an empty tree, fn returns the class of an item's data (< 0: none).
+ * Nodes keep a mask of the classes in their subtree (0..QUAD_MASK_BITS - 1) for the *_mask() queries,
+ * and per-class subtree counts for the first QUAD_CLASSES classes (compile time, see qtree_count_in_area()).
+ */
+int qtree_classify(QuadTree *tree, QuadClassFn fn, void *ctx) {
+    if (!tree || tree->length) {
+        return -1;
     }
 
-    return NULL;
+    tree->classify = fn;
+    tree->classify_ctx = ctx;
+    return 0;
 }
 
-static void _node_collect(QuadNode *node, QuadList *list) {
-    if (!node || !list) {
+/**
+ * Makes the area and radius queries (qtree_find_in_area(), qtree_find_in_radius(), qtree_visit_*()) wrap around the
+ * tree's edges: a query crossing an edge is split into up to four sub-queries, one per image of the query on the torus,
+ * and squared distances are the wrapped ones. Radii are clamped to below half the tree's shorter side (qbounds_wrap_radius()),
+ * areas as wide (high) as the tree cover all of it along that axis.
+ * The tree still stores positions within its bounds only: wrap them before inserting.
+ * knn, segment and all-pairs queries are not affected.
+ */
+int qtree_toroidal(QuadTree *tree, int toroidal) {
+    if (!tree) {
+        return -1;
+    }
+    tree->toroidal = toroidal;
+    return 0;
+}
+
+/**
+ * Empties a tree in O(1) by rewinding its arenas. The arenas keep their capacity,
+ * so re-inserting a similar population does not allocate.
+ */
+void qtree_reset(QuadTree *tree) {
+    if (!tree) {
         return;
     }
 
-    if (node->nw) {
-        _node_collect(node->nw, list);
+    _arena_reset(&tree->nodes);
+    _arena_reset(&tree->buckets);
+    for (unsigned int i = 0; i < 2 * tree->arenas_len; i++) {
+        _arena_reset(&tree->arenas[i]);
+    }
+
+    // the root is always the first node of the first block, which survives a reset
+    tree->root = _arena_alloc(&tree->nodes, 1);
+    _node_init(tree->root, 0);
+    tree->length = 0;
+    tree->replaced = 0;
+    tree->failed = 0;
+}
+
+void qtree_destroy(QuadTree *tree) {
+    if (!tree) {
+        return;
+    }
+    _arena_destroy(&tree->nodes);
+    _arena_destroy(&tree->buckets);
+    for (unsigned int i = 0; i < 2 * tree->arenas_len; i++) {
+        _arena_destroy(&tree->arenas[i]);
     }
-    if (node->ne) {
-        _node_collect(node->nw, list);
+    freez(tree->arenas);
+    freez(tree->bulk);
+    freez(tree);
+}
+
+int qtree_insert(QuadTree *tree, void *data, Vec2 pos) {
+    if (!tree || !data) {
+        return QUAD_FAILED;
     }
-    if (node->se) {
-        _node_collect(node->nw, list);
+
+    // check if pos is in tree bounds
+    if (!_bounds_contains(tree->bounds, pos)) {
+        tree->failed++;
+        return QUAD_FAILED;
     }
-    if (node->sw) {
-        _node_collect(node->nw, list);
+
+    int status = _node_insert(tree, &tree->nodes, &tree->buckets, tree->root, tree->bounds, data, pos);
+    if (status == QUAD_INSERTED) {
+        tree->length++;
+    } else if (status == QUAD_REPLACED) {
+        tree->replaced++;
+    } else {
+        tree->failed++;
     }
+
+    return status;
 }
 
-static void _node_find_in_area(QuadNode *node, Vec2 nw, Vec2 se, QuadList *list) {
-    if (!node || !list) {
-        return;
+/**
+ * Rebuilds a tree from n items at the given positions, replacing its contents. Returns the number of indexed items or QUAD_FAILED.
+ * Items are partitioned top-down by quadrant, the upper levels are built by the calling thread, the remaining subtrees
+ * are built by up to threads worker threads (each allocating from its own arenas) and are linked under the upper levels.
+ * The result does not depend on the order of the items. NULL items and positions outside of the tree are skipped,
+ * items are expected to be distinct.
+ */
+int qtree_build_bulk(QuadTree *tree, void **items, Vec2 *positions, size_t n, unsigned int threads) {
+    if (!tree || (n && (!items || !positions))) {
+        return QUAD_FAILED;
     }
-    // printf(" --- node->nw: {%f, %f}, node->se: {%f, %f}, nw: {%f, %f}, se: {%f, %f}\n", node->self_nw.x, node->self_nw.y, node->self_se.x, node->self_se.y, nw.x, nw.y, se.x, se.y);
 
-    // this node does not interesect with the search boundary
-    // stop searching this branch
-    if (!qnode_overlaps_area(node, nw, se)) {
-        return;
+    qtree_reset(tree);
+
+    // copy the input, the scratch is partitioned in place
+    if (n > tree->bulk_max) {
+        QuadItem *bulk = realloc(tree->bulk, n * sizeof(QuadItem));
+        if (!bulk) {
+            LOG_ERROR("failed to allocate memory for QuadTree bulk build");
+            return QUAD_FAILED;
+        }
+        tree->bulk = bulk;
+        tree->bulk_max = n;
     }
 
-    // this is a data node (and thus without children)
-    if (qnode_isleaf(node)) {
-        if (vec2_within(node->pos, nw, se)) {
-            qlist_append(list, node);
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (items[i] && _bounds_contains(tree->bounds, positions[i])) {
+            tree->bulk[len++] = (QuadItem){positions[i], items[i]};
         }
-        return;
     }
+    tree->failed = n - len;
+
+    QuadBuildTask root = {tree->root, tree->bounds, tree->bulk, len};
 
-    if (node->nw) {
-        _node_find_in_area(node->nw, nw, se, list);
+    if (threads <= 1) {
+        if (_node_build(tree, &tree->nodes, &tree->buckets, root, 0, NULL, NULL) == QUAD_FAILED) {
+            qtree_reset(tree);
+            return QUAD_FAILED;
+        }
+        return _build_done(tree, len);
     }
-    if (node->ne) {
-        _node_find_in_area(node->ne, nw, se, list);
+
+    // defer subtrees at the first depth which yields (up to) 4 tasks per thread, for balancing
+    unsigned int depth = 0;
+    for (size_t tasks = 1; tasks < 4 * threads && tasks < QUAD_BUILD_TASKS_MAX; tasks *= 4) {
+        depth++;
     }
-    if (node->se) {
-        _node_find_in_area(node->se, nw, se, list);
+
+    QuadBuildTask deferred[QUAD_BUILD_TASKS_MAX];
+    QuadBuildJob job = {tree, deferred, 0, 0, 0};
+    if (_node_build(tree, &tree->nodes, &tree->buckets, root, depth, deferred, &job.tasks_len) == QUAD_FAILED || _build_arenas(tree, threads) != 0) {
+        qtree_reset(tree);
+        return QUAD_FAILED;
     }
-    if (node->sw) {
-        _node_find_in_area(node->sw, nw, se, list);
+
+    if (!job.tasks_len) {
+        return _build_done(tree, len);
     }
-}
 
-// --- public
+    // the calling thread is worker 0
+    unsigned int workers = (job.tasks_len < threads) ? job.tasks_len : threads;
+    pthread_t tids[workers];
+    QuadBuildWorker args[workers];
+    unsigned int started = 1;
 
-QuadNode *qnode_create(QuadNode *parent) {
-    QuadNode *node = malloc(sizeof(QuadNode));
-    if (!node) {
-        LOG_ERROR("failed to allaocate memory for QuadNode");
-        return NULL;
+    for (unsigned int i = 0; i < workers; i++) {
+        args[i] = (QuadBuildWorker){&job, &tree->arenas[2 * i], &tree->arenas[2 * i + 1]};
+    }
+    for (unsigned int i = 1; i < workers; i++) {
+        if (pthread_create(&tids[i], NULL, _build_worker, &args[i]) != 0) {
+            LOG_ERROR("failed to create QuadTree bulk build thread");
+            break; // the remaining tasks are taken by the started workers
+        }
+        started++;
+    }
+    _build_worker(&args[0]);
+    for (unsigned int i = 1; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    if (atomic_load(&job.failed)) {
+        qtree_reset(tree);
+        return QUAD_FAILED;
     }
 
-    node->parent = parent;
+    return _build_done(tree, len);
+}
 
-    node->ne = NULL;
-    node->nw = NULL;
-    node->se = NULL;
-    node->sw = NULL;
+/**
+ * Removes a data item indexed at pos. Emptied child quadrants are merged back into their parent.
+ */
+int qtree_remove(QuadTree *tree, void *data, Vec2 pos) {
+    if (!tree || !data) {
+        return QUAD_FAILED;
+    }
 
-    node->self_nw = (Vec2){0};
-    node->self_se = (Vec2){0};
+    QuadPath path;
+    QuadNode *leaf = _node_find_data(tree, data, pos, &path);
+    if (!leaf) {
+        return QUAD_FAILED;
+    }
 
-    node->width = 0;
-    node->height = 0;
+    _node_remove_item(tree, leaf, data, pos);
+    _path_count(&path, path.len - 1, _tree_class(tree, data), -1);
+    _path_mask(tree, &path, path.len - 1);
+    tree->length--;
 
-    _node_clear_data(node);
-    return node;
+    _node_collapse(tree, &path, (int)path.len - 2);
+    return QUAD_REMOVED;
 }
 
-void qnode_destroy(QuadNode *node) {
-    if (!node) {
-        return;
+/**
+ * Moves a data item from old_pos to new_pos. Climbs up from the item's leaf only as far as the first node containing new_pos.
+ * If the item is not found at old_pos it is inserted. If new_pos is outside the tree the item is removed (QUAD_FAILED).
+ */
+int qtree_move(QuadTree *tree, void *data, Vec2 old_pos, Vec2 new_pos) {
+    if (!tree || !data) {
+        return QUAD_FAILED;
     }
-    if (node->nw) {
-        qnode_destroy(node->nw);
+
+    QuadPath path;
+    QuadNode *leaf = _node_find_data(tree, data, old_pos, &path);
+    if (!leaf) {
+        return qtree_insert(tree, data, new_pos);
     }
-    if (node->ne) {
-        qnode_destroy(node->ne);
+
+    // still in the same quadrant: nothing to restructure
+    // (unless the leaf overflows because of coincident points, which might be separable now)
+    int i = (int)path.len - 1;
+    if (_bounds_contains(path.bounds[i], new_pos) && (!leaf->bucket->next || leaf->depth >= tree->max_depth)) {
+        _node_find_item(leaf, data, old_pos)->pos = new_pos;
+        return QUAD_INSERTED;
     }
-    if (node->sw) {
-        qnode_destroy(node->sw);
+
+    int c = _tree_class(tree, data);
+    _node_remove_item(tree, leaf, data, old_pos);
+    _path_count(&path, path.len - 1, c, -1);
+    tree->length--;
+
+    int status = QUAD_FAILED;
+    if (_bounds_contains(tree->bounds, new_pos)) {
+        while (!_bounds_contains(path.bounds[i], new_pos)) {
+            i--;
+        }
+
+        // counted from path.nodes[i] down by the insert, above by us
+        status = _node_insert(tree, &tree->nodes, &tree->buckets, path.nodes[i], path.bounds[i], data, new_pos);
+        if (status == QUAD_INSERTED) {
+            _path_count(&path, i, c, 1);
+            tree->length++;
+        }
     }
-    if (node->se) {
-        qnode_destroy(node->se);
+    if (status == QUAD_FAILED) {
+        tree->failed++;
     }
+    _path_mask(tree, &path, path.len - 1);
 
-    // We  don not manage the memory of the data item
-    _node_clear_data(node);
+    // collapse after inserting, collapsing first could release the node we climbed up to
+    _node_collapse(tree, &path, (int)path.len - 2);
+    return status;
+}
 
-    freez(node);
+QuadItem *qtree_find(QuadTree *tree, Vec2 pos) {
+    if (!tree) {
+        return NULL;
+    }
+    return _node_find(tree->root, tree->bounds, pos);
 }
 
-int qnode_isleaf(QuadNode *node) {
-    return node->data != NULL;
+QuadList *qtree_find_in_area(QuadTree *tree, Vec2 pos, float radius, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
+    }
+
+    Vec2 nw = {pos.x - radius, pos.y - radius};
+    Vec2 se = {pos.x + radius, pos.y + radius};
+    qtree_visit_area(tree, nw, se, _visit_append, list);
+
+    return list;
 }
 
-// TODO rename
-int qnode_ispointer(QuadNode *node) {
-    return node->nw != NULL && node->ne != NULL && node->sw != NULL && node->se != NULL && !qnode_isleaf(node);
+/**
+ * Appends all items within radius of pos (inclusive) together with their squared distance (list->dist2)
+ */
+QuadList *qtree_find_in_radius(QuadTree *tree, Vec2 pos, float radius, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
+    }
+    if (radius < 0) {
+        return list;
+    }
+
+    qtree_visit_radius(tree, pos, radius, _visit_append, list);
+    return list;
 }
 
-int qnode_isempty(QuadNode *node) {
-    return node->nw == NULL && node->ne == NULL && node->sw == NULL && node->se == NULL && !qnode_isleaf(node);
+/**
+ * Same as qtree_find_in_radius(), restricted to the items whose class is in mask (bit c: class c, see qtree_classify()).
+ * Subtrees without any of the classes are skipped as a whole.
+ */
+QuadList *qtree_find_in_radius_mask(QuadTree *tree, Vec2 pos, float radius, unsigned int mask, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
+    }
+    if (radius < 0) {
+        return list;
+    }
+
+    qtree_visit_radius_mask(tree, pos, radius, mask, _visit_append, list);
+    return list;
+}
+
+/**
+ * Streams all items within the area nw-se (inclusive) to fn, without collecting them.
+ * Returns QUAD_VISIT_STOP if fn terminated the query, QUAD_FAILED on invalid arguments.
+ */
+int qtree_visit_area(QuadTree *tree, Vec2 nw, Vec2 se, QuadItemVisitor fn, void *ctx) {
+    return qtree_visit_area_mask(tree, nw, se, QUAD_MASK_ALL, fn, ctx);
+}
+
+/**
+ * Streams the items within the area nw-se whose class is in mask, see qtree_visit_area() and qtree_find_in_radius_mask()
+ */
+int qtree_visit_area_mask(QuadTree *tree, Vec2 nw, Vec2 se, unsigned int mask, QuadItemVisitor fn, void *ctx) {
+    if (!tree || !fn) {
+        return QUAD_FAILED;
+    }
+
+    Vec2 offsets[4];
+    size_t len = 1;
+    int res = QUAD_VISIT_CONTINUE;
+
+    if (tree->toroidal) {
+        _bounds_wrap_area(tree->bounds, &nw, &se);
+        len = qbounds_wrap_offsets(tree->bounds, nw, se, offsets);
+    }
+
+    offsets[0] = (Vec2){0.f, 0.f};
+    for (size_t i = 0; i < len && res != QUAD_VISIT_STOP; i++) {
+        res = _node_visit_area(tree, tree->root, tree->bounds, vec2_add(nw, offsets[i]), vec2_add(se, offsets[i]), mask, fn, ctx, _tree_counters(tree));
+    }
+    return res;
+}
+
+/**
+ * Streams all items within radius of pos (inclusive) and their squared distance to fn, see qtree_visit_area()
+ */
+int qtree_visit_radius(QuadTree *tree, Vec2 pos, float radius, QuadItemVisitor fn, void *ctx) {
+    return qtree_visit_radius_mask(tree, pos, radius, QUAD_MASK_ALL, fn, ctx);
 }
 
 /**
- * checks if the area of a qnode is fully enclosed by a given area
+ * Streams the items within radius of pos whose class is in mask, see qtree_visit_radius() and qtree_find_in_radius_mask()
  */
-int qnode_within_area(QuadNode *node, Vec2 nw, Vec2 se) {
-    return node != NULL && node->self_nw.x >= nw.x && node->self_se.x <= se.x && node->self_nw.y >= nw.y && node->self_se.y <= se.y;
+int qtree_visit_radius_mask(QuadTree *tree, Vec2 pos, float radius, unsigned int mask, QuadItemVisitor fn, void *ctx) {
+    if (!tree || !fn) {
+        return QUAD_FAILED;
+    }
+    if (radius < 0) {
+        return QUAD_VISIT_CONTINUE;
+    }
+
+    // images of the circle's bounding square, distances to the shifted center are the wrapped ones
+    if (tree->toroidal) {
+        radius = qbounds_wrap_radius(tree->bounds, radius);
+    }
+    Vec2 offsets[4];
+    Vec2 nw = {pos.x - radius, pos.y - radius};
+    Vec2 se = {pos.x + radius, pos.y + radius};
+    size_t len = (tree->toroidal) ? qbounds_wrap_offsets(tree->bounds, nw, se, offsets) : 1;
+    int res = QUAD_VISIT_CONTINUE;
+
+    offsets[0] = (Vec2){0.f, 0.f};
+    for (size_t i = 0; i < len && res != QUAD_VISIT_STOP; i++) {
+        res = _node_visit_radius(tree, tree->root, tree->bounds, vec2_add(pos, offsets[i]), radius * radius, mask, fn, ctx, _tree_counters(tree));
+    }
+    return res;
 }
 
 /**
- * checks if the area of a qnode is fully overlaps a given area
+ * Appends the k items closest to pos (and no further away than max_radius, INFINITY for no limit), sorted by distance (list->dist2).
+ * Returns NULL if memory ran out during the search, the list is unchanged then.
  */
-int qnode_overlaps_area(QuadNode *node, Vec2 nw, Vec2 se) {
-    return node != NULL && node->self_nw.x < se.x && node->self_se.x >= nw.x && node->self_nw.y < se.y && node->self_se.y >= nw.y;
+QuadList *qtree_find_knn(QuadTree *tree, Vec2 pos, size_t k, float max_radius, QuadList *list) {
+    return qtree_find_knn_mask(tree, pos, k, max_radius, QUAD_MASK_ALL, list);
 }
 
-void qnode_set_bounds(QuadNode *node, Vec2 nw, Vec2 se) {
-    node->self_nw = nw;
-    node->self_se = se;
-    node->width = fabs(nw.x - se.x);
-    node->height = fabs(nw.y - se.y);
+/**
+ * Appends the k closest items whose class is in mask, see qtree_find_knn() and qtree_find_in_radius_mask()
+ */
+QuadList *qtree_find_knn_mask(QuadTree *tree, Vec2 pos, size_t k, float max_radius, unsigned int mask, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
+    }
+    if (!k || max_radius < 0) {
+        return list;
+    }
+
+    if (_node_find_knn(tree, tree->root, tree->bounds, pos, k, max_radius, mask, list) != 0) {
+        return NULL;
+    }
+    return list;
 }
 
 /**
- * recusively walk trough a quad node's children and apply on before (recusing) and on after call backs
+ * Appends the items within width / 2 of the segment a-b, ordered along the segment: list->dist2 holds the squared
+ * distance from a to an item's projection onto the segment (not to the item). Only nodes the segment's swept box
+ * passes through are visited, front to back.
  */
-void qnode_walk(QuadNode *node, void (*descent)(QuadNode *node), void (*ascent)(QuadNode *node)) {
-    (*descent)(node);
-
-    if (node->nw != NULL) {
-        qnode_walk(node->nw, descent, ascent);
+QuadList *qtree_find_on_segment(QuadTree *tree, Vec2 a, Vec2 b, float width, QuadList *list) {
+    if (!tree || !list) {
+        return NULL;
     }
-    if (node->ne != NULL) {
-        qnode_walk(node->ne, descent, ascent);
+    if (width < 0) {
+        return list;
     }
-    if (node->sw != NULL) {
-        qnode_walk(node->sw, descent, ascent);
+
+    size_t offset = list->len;
+    QuadItem *item;
+    float dist2;
+    size_t j;
+
+    _node_find_segment(tree->root, tree->bounds, a, vec2_sub(b, a), width / 2, list, _tree_counters(tree));
+
+    // nodes are visited in order, but the segment's width lets items of a later node project before those of an earlier one
+    for (size_t i = offset + 1; i < list->len; i++) {
+        item = list->items[i];
+        dist2 = list->dist2[i];
+        for (j = i; j > offset && list->dist2[j - 1] > dist2; j--) {
+            list->items[j] = list->items[j - 1];
+            list->dist2[j] = list->dist2[j - 1];
+        }
+        list->items[j] = item;
+        list->dist2[j] = dist2;
     }
-    if (node->se != NULL) {
-        qnode_walk(node->se, descent, ascent);
+
+    return list;
+}
+
+/**
+ * Counts the items within the area nw-se (inclusive) without collecting them, in O(log n) for areas aligned with nodes.
+ * classes (may be NULL) receives the counts per class (QUAD_CLASSES entries, see qtree_classify()).
+ */
+size_t qtree_count_in_area(QuadTree *tree, Vec2 nw, Vec2 se, size_t *classes) {
+    if (!tree) {
+        return 0;
     }
 
-    (*ascent)(node);
+    for (int i = 0; classes && i < QUAD_CLASSES; i++) {
+        classes[i] = 0;
+    }
+    return _node_count_area(tree, tree->root, tree->bounds, nw, se, classes, _tree_counters(tree));
 }
 
 ////
-// QuadTree
+// stats
 ////
 
-QuadTree *qtree_create(Vec2 window_nw, Vec2 window_se) {
-    assert(window_nw.x < window_se.x);
-    assert(window_nw.y < window_se.y);
+static int _stats_node(QuadNode *node, QuadBounds bounds, void *ctx) {
+    (void)bounds; // visitor signature
+    QuadStats *stats = ctx;
 
-    QuadTree *tree = malloc(sizeof(QuadTree));
-    if (!tree) {
-        return NULL;
+    if (qnode_ispointer(node)) {
+        stats->internal++;
+    } else if (qnode_isleaf(node)) {
+        stats->leaves++;
+    } else {
+        stats->empty++;
     }
-
-    tree->root = qnode_create(NULL);
-    if (!tree->root) {
-        return NULL;
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        stats->buckets++;
     }
 
-    qnode_set_bounds(tree->root, window_nw, window_se);
-    tree->length = 0;
-
-    return tree;
+    stats->depth[node->depth]++;
+    if (node->depth > stats->max_depth) {
+        stats->max_depth = node->depth;
+    }
+    return QUAD_VISIT_CONTINUE;
 }
 
-void qtree_destroy(QuadTree *tree) {
-    if (!tree) {
-        return;
-    }
-    qnode_destroy(tree->root);
-    freez(tree);
+static size_t _arena_bytes(QuadArena *arena) {
+    return arena->blocks_len * (QUAD_ARENA_BLOCK * arena->size + sizeof(char *));
 }
 
-int qtree_insert(QuadTree *tree, void *data, Vec2 pos) {
-    if (!tree || !data) {
-        return QUAD_FAILED;
-    }
+// --- public
 
-    // check if pos is in tree bounds
-    if (!_node_contains(tree->root, pos)) {
-        return QUAD_FAILED;
+/**
+ * Collects the shape of a tree (walks all nodes) and its memory footprint.
+ */
+int qtree_stats(QuadTree *tree, QuadStats *stats) {
+    if (!tree || !stats) {
+        return -1;
     }
 
-    int status = _node_insert(tree, tree->root, data, pos);
-    if (status == QUAD_INSERTED) {
-        tree->length++;
-    }
+    *stats = (QuadStats){0};
+    stats->length = tree->length;
+    stats->replaced = tree->replaced;
+    stats->failed = tree->failed;
 
-    return status;
-}
+    qtree_walk(tree, _stats_node, NULL, stats);
 
-QuadNode *qtree_find(QuadTree *tree, Vec2 pos) {
-    if (!tree) {
-        return NULL;
+    stats->bytes = sizeof(QuadTree) + _arena_bytes(&tree->nodes) + _arena_bytes(&tree->buckets);
+    for (unsigned int i = 0; i < 2 * tree->arenas_len; i++) {
+        stats->bytes += sizeof(QuadArena) + _arena_bytes(&tree->arenas[i]);
     }
-    return _node_find(tree, tree->root, pos);
+    stats->bytes += tree->bulk_max * sizeof(QuadItem);
+
+    stats->bytes_used = (stats->internal + stats->leaves + stats->empty) * sizeof(QuadNode) + stats->buckets * sizeof(QuadBucket);
+    return 0;
 }
 
-QuadList *qtree_find_in_area(QuadTree *tree, Vec2 pos, float radius, QuadList *list) {
-    if (!tree || !list) {
-        return NULL;
+/**
+ * Clears the query counters, see QuadCounters
+ */
+void qtree_reset_counters(QuadTree *tree) {
+    if (!tree) {
+        return;
     }
-
-    Vec2 nw = {pos.x - radius, pos.y - radius};
-    Vec2 se = {pos.x + radius, pos.y + radius};
-    _node_find_in_area(tree->root, nw, se, list);
-
-    return list;
+    tree->counters = (QuadCounters){0};
 }
 
 ////
 // debug
 ////
 
-FILE *_out = NULL;
-
-static void _print_desc(QuadNode *node) {
-    qnode_print(_out, node);
-    fprintf(_out, "\n");
+static int _print_node(QuadNode *node, QuadBounds bounds, void *ctx) {
+    FILE *fp = ctx;
+    fprintf(fp, "{nw: {%f, %f}, se: {%f, %f}, node: ", bounds.nw.x, bounds.nw.y, bounds.se.x, bounds.se.y);
+    qnode_print(fp, node);
+    fprintf(fp, "}\n");
+    return QUAD_VISIT_CONTINUE;
 }
 
-static void _print_asc(QuadNode *node) {}
-
 // --- public
 
 void qtree_print(FILE *fp, QuadTree *tree) {
@@ -433,9 +2073,7 @@ void qtree_print(FILE *fp, QuadTree *tree) {
         return;
     }
 
-    _out = fp;
-    qnode_walk(tree->root, _print_asc, _print_desc);
-    _out = NULL;
+    qtree_walk(tree, NULL, _print_node, fp);
 }
 
 void qnode_print(FILE *fp, QuadNode *node) {
@@ -444,21 +2082,15 @@ void qnode_print(FILE *fp, QuadNode *node) {
         return;
     }
 
-    fprintf(fp, "{self_nw: {%f, %f}, self_se: {%f, %f}, ", node->self_nw.x, node->self_nw.y, node->self_se.x, node->self_se.y);
-    fprintf(fp, "parent: '%c', ", (node->parent) ? 'y' : '-');
-    fprintf(fp, "nw: '%c', sw: '%c', se: '%c', nw: '%c', ", (node->nw) ? 'y' : '-', (node->sw) ? 'y' : '-', (node->se) ? 'y' : '-', (node->ne) ? 'y' : '-');
-
-    if (node->pos.x < INFINITY) {
-        fprintf(fp, "pos: {%f, %f}", node->pos.x, node->pos.y);
-    } else {
-        fprintf(fp, "pos: {INF..,INF..}}");
-    }
-
-    if (node->data) {
-        fprintf(fp, "data: %p}", node->data);
-    } else {
-        fprintf(fp, "data: '-'}");
+    fprintf(fp, "{children: '%c', ", (node->children) ? 'y' : '-');
+    fprintf(fp, "depth: %d, len: %d, items: [", node->depth, node->len);
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            fprintf(fp, "{pos: {%f, %f}, data: %p}", bucket->items[i].pos.x, bucket->items[i].pos.y, bucket->items[i].data);
+            fprintf(fp, "%s", (i < bucket->len - 1 || bucket->next) ? ", " : "");
+        }
     }
+    fprintf(fp, "]}");
 }
 
 ////
@@ -476,30 +2108,52 @@ QuadList *qlist_create(size_t max) {
     list->grow = max;
     list->max = max;
 
-    list->nodes = calloc(sizeof(QuadNode *), max);
-    if (!list->nodes) {
-        LOG_ERROR("error re-allocating memory for quadlist nodes");
+    list->items = calloc(sizeof(QuadItem *), max);
+    list->dist2 = calloc(sizeof(float), max);
+    if (!list->items || !list->dist2) {
+        LOG_ERROR("error re-allocating memory for quadlist items");
+        freez(list->items);
+        freez(list->dist2);
         freez(list);
         return NULL;
     }
     return list;
 }
 
-QuadList *qlist_append(QuadList *list, QuadNode *node) {
-    if (!list || !node) {
+QuadList *qlist_append(QuadList *list, QuadItem *item) {
+    return qlist_append_dist(list, item, -1.f);
+}
+
+/**
+ * Appends an item together with its squared distance to the query position.
+ * Grows geometrically (by the current capacity, at least by grow). On allocation failure the item is not appended and
+ * NULL is returned, the list stays valid and keeps its items.
+ */
+QuadList *qlist_append_dist(QuadList *list, QuadItem *item, float dist2) {
+    if (!list || !item) {
         return NULL;
     }
 
     if (list->len >= list->max) {
-        list->max += list->grow;
-        list->nodes = realloc(list->nodes, list->max * sizeof(QuadNode *));
-        if (!list->nodes) {
-            LOG_ERROR("error re-allocating memory for quadlist nodes");
-            freez(list);
+        size_t max = list->max + ((list->max > list->grow) ? list->max : list->grow);
+
+        QuadItem **items = realloc(list->items, max * sizeof(QuadItem *));
+        if (!items) {
+            LOG_ERROR("error re-allocating memory for quadlist items");
             return NULL;
         }
+        list->items = items;
+
+        float *d2 = realloc(list->dist2, max * sizeof(float));
+        if (!d2) {
+            LOG_ERROR("error re-allocating memory for quadlist items");
+            return NULL; // items grew already, max is only raised once both did
+        }
+        list->dist2 = d2;
+        list->max = max;
     }
-    list->nodes[list->len] = node;
+    list->items[list->len] = item;
+    list->dist2[list->len] = dist2;
     list->len++;
 
     return list;
@@ -510,7 +2164,7 @@ void qlist_reset(QuadList *list) {
         return;
     }
     for (size_t i = 0; i < list->len; i++) {
-        list->nodes[i] = NULL; // leave allocated mem
+        list->items[i] = NULL; // leave allocated mem
     }
     list->len = 0;
 }
@@ -519,7 +2173,8 @@ void qlist_destroy(QuadList *list) {
     if (!list) {
         return;
     }
-    freez(list->nodes); // free the list, not the nodes!
+    freez(list->items); // free the list, not the items!
+    freez(list->dist2);
     freez(list);
 }
 
@@ -537,17 +2192,507 @@ void qlist_print(FILE *fp, QuadList *list) {
         "  len: %ld\n"
         "  max: %ld\n"
         "  grow: %ld\n"
-        "  nodes: [",
+        "  items: [",
         list->len,
         list->max,
         list->grow);
-    if (list->nodes) {
+    if (list->items) {
         for (size_t i = 0; i < list->len; i++) {
-            if (list->nodes[i]) {
-                printf("{pos:{%f, %f}}", list->nodes[i]->pos.x, list->nodes[i]->pos.y);
+            if (list->items[i]) {
+                printf("{pos:{%f, %f}}", list->items[i]->pos.x, list->items[i]->pos.y);
             }
             printf("%s", (i < list->len - 1) ? ", " : "");
         }
     }
     printf("]\n}\n");
 }
+
+////
+// QuadPairs
+////
+
+typedef struct QuadPairsQuery {
+    QuadPairs *pairs;
+    float radius2;
+    int failed;
+} QuadPairsQuery;
+
+static float _bounds_bounds_mindist2(QuadBounds a, QuadBounds b) {
+    float dx = fmaxf(fmaxf(a.nw.x - b.se.x, b.nw.x - a.se.x), 0);
+    float dy = fmaxf(fmaxf(a.nw.y - b.se.y, b.nw.y - a.se.y), 0);
+    return dx * dx + dy * dy;
+}
+
+static inline float _bounds_area(QuadBounds bounds) {
+    return (bounds.se.x - bounds.nw.x) * (bounds.se.y - bounds.nw.y);
+}
+
+static void _pairs_test(QuadItem *a, QuadItem *b, QuadPairsQuery *query) {
+    Vec2 delta = vec2_sub(a->pos, b->pos);
+    float dist2 = delta.x * delta.x + delta.y * delta.y;
+    if (dist2 > query->radius2 || query->failed) {
+        return;
+    }
+
+    QuadPairs *pairs = query->pairs;
+    if (pairs->scratch_len >= pairs->scratch_max) {
+        size_t max = (pairs->scratch_max) ? pairs->scratch_max * 2 : 64;
+        QuadPair *scratch = realloc(pairs->scratch, max * sizeof(QuadPair));
+        if (!scratch) {
+            LOG_ERROR("error re-allocating memory for quadpairs");
+            query->failed = 1;
+            return;
+        }
+        pairs->scratch = scratch;
+        pairs->scratch_max = max;
+    }
+    pairs->scratch[pairs->scratch_len++] = (QuadPair){a, b, dist2};
+}
+
+/**
+ * All pairs between the items of two distinct nodes. Recurses into the larger node until both are leaves,
+ * node pairs further apart than the radius are pruned as a whole.
+ */
+static void _pairs_cross(QuadNode *a, QuadBounds ab, QuadNode *b, QuadBounds bb, QuadPairsQuery *query) {
+    if (!a->len || !b->len || _bounds_bounds_mindist2(ab, bb) > query->radius2) {
+        return;
+    }
+
+    if (qnode_isleaf(a) && qnode_isleaf(b)) {
+        for (QuadBucket *ba = a->bucket; ba; ba = ba->next) {
+            for (unsigned int i = 0; i < ba->len; i++) {
+                for (QuadBucket *bb = b->bucket; bb; bb = bb->next) {
+                    for (unsigned int j = 0; j < bb->len; j++) {
+                        _pairs_test(&ba->items[i], &bb->items[j], query);
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    // split the larger one (leaves can't be split)
+    if (qnode_isleaf(b) || (!qnode_isleaf(a) && _bounds_area(ab) >= _bounds_area(bb))) {
+        for (int i = 0; i < 4; i++) {
+            _pairs_cross(&a->children[i], qbounds_quadrant(ab, i), b, bb, query);
+        }
+    } else {
+        for (int i = 0; i < 4; i++) {
+            _pairs_cross(a, ab, &b->children[i], qbounds_quadrant(bb, i), query);
+        }
+    }
+}
+
+/**
+ * All pairs within a node: pairs within each child plus pairs across each two children
+ */
+static void _pairs_self(QuadNode *node, QuadBounds bounds, QuadPairsQuery *query) {
+    if (!node->len) {
+        return;
+    }
+
+    if (qnode_isleaf(node)) {
+        for (QuadBucket *ba = node->bucket; ba; ba = ba->next) {
+            for (unsigned int i = 0; i < ba->len; i++) {
+                // items after i: rest of this bucket, then the following buckets of the chain
+                for (unsigned int j = i + 1; j < ba->len; j++) {
+                    _pairs_test(&ba->items[i], &ba->items[j], query);
+                }
+                for (QuadBucket *bb = ba->next; bb; bb = bb->next) {
+                    for (unsigned int j = 0; j < bb->len; j++) {
+                        _pairs_test(&ba->items[i], &bb->items[j], query);
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    QuadBounds children[4];
+    for (int i = 0; i < 4; i++) {
+        children[i] = qbounds_quadrant(bounds, i);
+    }
+    for (int i = 0; i < 4; i++) {
+        _pairs_self(&node->children[i], children[i], query);
+        for (int j = i + 1; j < 4; j++) {
+            _pairs_cross(&node->children[i], children[i], &node->children[j], children[j], query);
+        }
+    }
+}
+
+/**
+ * Grows a table's arrays to at least rows rows and max entries
+ */
+static int _pairs_reserve(QuadPairs *pairs, size_t rows, size_t max) {
+    if (rows + 1 > pairs->max_rows) {
+        size_t *offsets = realloc(pairs->offsets, (rows + 1) * sizeof(size_t));
+        if (!offsets) {
+            return -1;
+        }
+        pairs->offsets = offsets;
+        pairs->max_rows = rows + 1;
+    }
+
+    if (max > pairs->max) {
+        size_t *indices = realloc(pairs->indices, max * sizeof(size_t));
+        if (!indices) {
+            return -1;
+        }
+        pairs->indices = indices;
+
+        float *dist2 = realloc(pairs->dist2, max * sizeof(float));
+        if (!dist2) {
+            return -1;
+        }
+        pairs->dist2 = dist2;
+        pairs->max = max;
+    }
+    return 0;
+}
+
+// --- public
+
+QuadPairs *qpairs_create() {
+    QuadPairs *pairs = calloc(sizeof(QuadPairs), 1);
+    if (!pairs) {
+        LOG_ERROR("error allocating memory for quadpairs");
+        return NULL;
+    }
+    return pairs;
+}
+
+void qpairs_reset(QuadPairs *pairs) {
+    if (!pairs) {
+        return;
+    }
+    pairs->len = 0;
+    pairs->count = 0;
+    pairs->scratch_len = 0;
+}
+
+void qpairs_destroy(QuadPairs *pairs) {
+    if (!pairs) {
+        return;
+    }
+    freez(pairs->offsets);
+    freez(pairs->indices);
+    freez(pairs->dist2);
+    freez(pairs->scratch);
+    freez(pairs);
+}
+
+/**
+ * Finds all pairs of items within radius of each other (inclusive) in a single dual-tree traversal
+ * and stores them as a CSR neighbour table with one row per item, see QuadPairs.
+ * index maps an item's data to its row (0..rows-1), items mapped outside are ignored.
+ * The table keeps its memory between calls.
+ */
+QuadPairs *qtree_find_all_pairs(QuadTree *tree, float radius, size_t rows, QuadIndexFn index, void *ctx, QuadPairs *pairs) {
+    if (!tree || !index || !pairs) {
+        return NULL;
+    }
+
+    qpairs_reset(pairs);
+
+    // negative radius: no pairs, but still a valid table
+    QuadPairsQuery query = {pairs, radius * radius, 0};
+    if (radius >= 0) {
+        _pairs_self(tree->root, tree->bounds, &query);
+    }
+    if (query.failed || _pairs_reserve(pairs, rows, pairs->scratch_len * 2) != 0) {
+        LOG_ERROR("error re-allocating memory for quadpairs");
+        qpairs_reset(pairs);
+        return NULL;
+    }
+
+    // counting sort of the unordered pairs into rows, every pair is listed in both of its rows
+    size_t a, b;
+    size_t *offsets = pairs->offsets;
+    memset(offsets, 0, (rows + 1) * sizeof(size_t));
+
+    for (size_t i = 0; i < pairs->scratch_len; i++) {
+        a = index(pairs->scratch[i].a->data, ctx);
+        b = index(pairs->scratch[i].b->data, ctx);
+        if (a >= rows || b >= rows) {
+            continue;
+        }
+        offsets[a + 1]++;
+        offsets[b + 1]++;
+    }
+    for (size_t i = 0; i < rows; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    // scatter, using offsets[row] as insert position (shifted back afterwards)
+    size_t pos;
+    for (size_t i = 0; i < pairs->scratch_len; i++) {
+        a = index(pairs->scratch[i].a->data, ctx);
+        b = index(pairs->scratch[i].b->data, ctx);
+        if (a >= rows || b >= rows) {
+            continue;
+        }
+        pos = offsets[a]++;
+        pairs->indices[pos] = b;
+        pairs->dist2[pos] = pairs->scratch[i].dist2;
+
+        pos = offsets[b]++;
+        pairs->indices[pos] = a;
+        pairs->dist2[pos] = pairs->scratch[i].dist2;
+    }
+    for (size_t i = rows; i > 0; i--) {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+
+    pairs->len = rows;
+    pairs->count = offsets[rows];
+    return pairs;
+}
+
+////
+// QuadMass
+////
+
+typedef struct QuadMassBuild {
+    QuadMass *mass;
+    unsigned int stack[QUAD_DEPTH_LIMIT + 1]; // indices of the nodes being built
+    int top;
+    int failed;
+} QuadMassBuild;
+
+static int _mass_reserve(QuadMass *mass, size_t max) {
+    if (max <= mass->max) {
+        return 0;
+    }
+    max = (max < 2 * mass->max) ? 2 * mass->max : max;
+
+    QuadMassNode *nodes = realloc(mass->nodes, max * sizeof(QuadMassNode));
+    if (!nodes) {
+        return -1;
+    }
+    mass->nodes = nodes;
+
+    float *masses = realloc(mass->mass, max * mass->classes * sizeof(float));
+    if (!masses) {
+        return -1;
+    }
+    mass->mass = masses;
+
+    Vec2 *com = realloc(mass->com, max * mass->classes * sizeof(Vec2));
+    if (!com) {
+        return -1;
+    }
+    mass->com = com;
+
+    mass->max = max;
+    return 0;
+}
+
+static inline int _mass_class(QuadMass *mass, void *data) {
+    int c = (mass->class_fn) ? mass->class_fn(data, mass->ctx) : 0;
+    return (c >= 0 && c < (int)mass->classes) ? c : -1;
+}
+
+/**
+ * Descent visitor: appends the non-empty nodes in pre-order
+ */
+static int _mass_descent(QuadNode *node, QuadBounds bounds, void *ctx) {
+    QuadMassBuild *build = ctx;
+    QuadMass *mass = build->mass;
+
+    if (!node->len) {
+        return QUAD_VISIT_SKIP;
+    }
+    if (_mass_reserve(mass, mass->len + 1) != 0) {
+        build->failed = 1;
+        return QUAD_VISIT_STOP;
+    }
+
+    float w = bounds.se.x - bounds.nw.x;
+    float h = bounds.se.y - bounds.nw.y;
+    float size = (w > h) ? w : h;
+
+    mass->nodes[mass->len] = (QuadMassNode){node, bounds, size * size, 0, {0, 0}, 0};
+    build->stack[++build->top] = mass->len;
+    mass->len++;
+    return QUAD_VISIT_CONTINUE;
+}
+
+/**
+ * Ascent visitor: aggregates a node from its items (leaves) or from its children, which precede it in pre-order
+ */
+static int _mass_ascent(QuadNode *node, QuadBounds bounds, void *ctx) {
+    (void)bounds; // visitor signature
+    QuadMassBuild *build = ctx;
+    QuadMass *mass = build->mass;
+
+    if (!node->len) {
+        return QUAD_VISIT_CONTINUE;
+    }
+
+    unsigned int i = build->stack[build->top--];
+    QuadMassNode *mn = &mass->nodes[i];
+    float *m = &mass->mass[i * mass->classes];
+    Vec2 *com = &mass->com[i * mass->classes];
+    float im;
+    int c;
+
+    mn->next = mass->len;
+    for (unsigned int k = 0; k < mass->classes; k++) {
+        m[k] = 0;
+        com[k] = (Vec2){0, 0};
+    }
+
+    // weighted positions first, divided by the mass below
+    if (!node->children) {
+        for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+            for (unsigned int j = 0; j < bucket->len; j++) {
+                c = _mass_class(mass, bucket->items[j].data);
+                if (c < 0) {
+                    continue;
+                }
+                im = mass->mass_fn(bucket->items[j].data, mass->ctx);
+                m[c] += im;
+                com[c].x += im * bucket->items[j].pos.x;
+                com[c].y += im * bucket->items[j].pos.y;
+            }
+        }
+    } else {
+        for (unsigned int child = i + 1; child < mn->next; child = mass->nodes[child].next) {
+            for (unsigned int k = 0; k < mass->classes; k++) {
+                im = mass->mass[child * mass->classes + k];
+                m[k] += im;
+                com[k].x += im * mass->com[child * mass->classes + k].x;
+                com[k].y += im * mass->com[child * mass->classes + k].y;
+            }
+        }
+    }
+
+    for (unsigned int k = 0; k < mass->classes; k++) {
+        mn->mass += m[k];
+        mn->com.x += com[k].x;
+        mn->com.y += com[k].y;
+        if (m[k] > 0) {
+            com[k].x /= m[k];
+            com[k].y /= m[k];
+        }
+    }
+    if (mn->mass > 0) {
+        mn->com.x /= mn->mass;
+        mn->com.y /= mn->mass;
+    }
+    return QUAD_VISIT_CONTINUE;
+}
+
+// --- public
+
+/**
+ * Creates an (empty) aggregate table for items of classes classes (>= 1)
+ */
+QuadMass *qmass_create(unsigned int classes) {
+    if (classes < 1) {
+        LOG_ERROR_F("invalid number of classes %d", classes);
+        return NULL;
+    }
+
+    QuadMass *mass = calloc(sizeof(QuadMass), 1);
+    if (!mass) {
+        LOG_ERROR("error allocating memory for quadmass");
+        return NULL;
+    }
+    mass->classes = classes;
+    return mass;
+}
+
+void qmass_destroy(QuadMass *mass) {
+    if (!mass) {
+        return;
+    }
+    freez(mass->nodes);
+    freez(mass->mass);
+    freez(mass->com);
+    freez(mass);
+}
+
+/**
+ * (Re-)builds the aggregates of a tree in O(n): mass_fn gives the mass of an item's data, class_fn its class (0..classes - 1,
+ * other classes are left out), NULL puts all items into class 0. Keeps its memory between builds.
+ */
+int qmass_build(QuadMass *mass, QuadTree *tree, QuadMassFn mass_fn, QuadClassFn class_fn, void *ctx) {
+    if (!mass || !tree || !mass_fn) {
+        return -1;
+    }
+
+    mass->len = 0;
+    mass->mass_fn = mass_fn;
+    mass->class_fn = class_fn;
+    mass->ctx = ctx;
+
+    QuadMassBuild build = {mass, {0}, -1, 0};
+    qtree_walk(tree, _mass_descent, _mass_ascent, &build);
+    if (build.failed) {
+        LOG_ERROR("error re-allocating memory for quadmass");
+        mass->len = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Barnes-Hut traversal for a position: a node whose size s and distance d (to its center of mass) satisfy s / d < theta
+ * is passed to fn as one aggregate per class, closer nodes are opened down to their items. Nodes containing pos are always opened.
+ * theta 0 visits every item (exact), larger values trade accuracy for fewer visits (typically 0.3 - 1).
+ * Returns QUAD_VISIT_STOP if fn terminated the traversal, QUAD_FAILED on invalid arguments.
+ */
+int qmass_visit(QuadMass *mass, Vec2 pos, float theta, QuadMassVisitor fn, void *ctx) {
+    if (!mass || !fn || theta < 0) {
+        return QUAD_FAILED;
+    }
+
+    float theta2 = theta * theta;
+    QuadMassNode *mn;
+    QuadBucket *bucket;
+    Vec2 delta;
+    float dist2;
+    int c;
+    size_t i = 0;
+
+    while (i < mass->len) {
+        mn = &mass->nodes[i];
+        delta = vec2_sub(mn->com, pos);
+        dist2 = delta.x * delta.x + delta.y * delta.y;
+
+        // far enough: aggregates, skip the subtree
+        if (!_bounds_contains(mn->bounds, pos) && mn->size2 < theta2 * dist2) {
+            for (unsigned int k = 0; k < mass->classes; k++) {
+                if (mass->mass[i * mass->classes + k] > 0 &&
+                    fn(mass->com[i * mass->classes + k], mass->mass[i * mass->classes + k], k, NULL, ctx) == QUAD_VISIT_STOP) {
+                    return QUAD_VISIT_STOP;
+                }
+            }
+            i = mn->next;
+            continue;
+        }
+
+        // too close: open, internal nodes are followed by their children
+        if (mn->node->children) {
+            i++;
+            continue;
+        }
+
+        for (bucket = mn->node->bucket; bucket; bucket = bucket->next) {
+            for (unsigned int j = 0; j < bucket->len; j++) {
+                c = _mass_class(mass, bucket->items[j].data);
+                if (c < 0) {
+                    continue;
+                }
+                if (fn(bucket->items[j].pos, mass->mass_fn(bucket->items[j].data, mass->ctx), c, &bucket->items[j], ctx) == QUAD_VISIT_STOP) {
+                    return QUAD_VISIT_STOP;
+                }
+            }
+        }
+        i = mn->next;
+    }
+
+    return QUAD_VISIT_CONTINUE;
+}
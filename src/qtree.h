@@ -14,6 +14,41 @@
 #define QUAD_FAILED -1
 #define QUAD_INSERTED 0
 #define QUAD_REPLACED 2
+#define QUAD_REMOVED 3
+
+// visitor return values
+#define QUAD_VISIT_CONTINUE 0
+#define QUAD_VISIT_STOP 1 // terminates the traversal
+#define QUAD_VISIT_SKIP 2 // walk descent only: don't descend into this node's children
+
+#define QUAD_ARENA_BLOCK 256 // elements per arena block, keep a multiple of 4
+
+#ifndef QUAD_BUCKET_MAX
+#define QUAD_BUCKET_MAX 8 // entity capacity of a leaf payload bucket, the per-tree bucket size can be set up to this
+#endif
+
+#ifndef QUAD_DEPTH_MAX
+#define QUAD_DEPTH_MAX 16 // default depth cap, leaves at this depth do not split any more
+#endif
+
+#ifndef QUAD_DEPTH_LIMIT
+#define QUAD_DEPTH_LIMIT 32 // upper bound for the depth cap, sizes the explicit traversal stacks
+#endif
+
+#ifndef QUAD_CLASSES
+#define QUAD_CLASSES 0 // per-class subtree counts kept in every node (see qtree_classify()), 0 disables them
+#endif
+
+#define QUAD_MASK_BITS 16        // classes kept in the per-node class masks (QuadNode.mask), see qtree_classify()
+#define QUAD_MASK_ALL 0xffffffffu // query mask: no class filter
+
+#if QUAD_DEPTH_MAX > QUAD_DEPTH_LIMIT
+#error "QUAD_DEPTH_MAX exceeds QUAD_DEPTH_LIMIT"
+#endif
+
+#define QUAD_STACK_MAX (3 * QUAD_DEPTH_LIMIT + 4) // depth first: at most 3 pending siblings per level
+
+#define QUAD_BUILD_TASKS_MAX 256 // subtrees handed to worker threads by qtree_build_bulk(), a power of 4
 
 ////
 //   Quadrants
@@ -35,47 +70,169 @@
 //                        se(x,y)
 ////
 
-typedef struct QuadNode {
-    struct QuadNode *parent;
+// order of the children in their block: (south << 1) | east
+#define QUAD_NW 0
+#define QUAD_NE 1
+#define QUAD_SW 2
+#define QUAD_SE 3
 
-    struct QuadNode *ne;
-    struct QuadNode *nw;
-    struct QuadNode *se;
-    struct QuadNode *sw;
+typedef struct QuadItem {
+    Vec2 pos;
+    void *data;
+} QuadItem;
 
-    Vec2 self_nw;
-    Vec2 self_se;
+/**
+ * Area of a node, nodes don't store it: it is derived from the tree's bounds while descending (qbounds_quadrant())
+ */
+typedef struct QuadBounds {
+    Vec2 nw;
+    Vec2 se;
+} QuadBounds;
 
-    float width;
-    float height;
+/**
+ * Leaf payload, kept apart from the nodes. A leaf holds up to tree->bucket entities in its first bucket,
+ * leaves whose entities can't be separated by splitting (coincident points, max depth) chain full sized overflow buckets.
+ */
+typedef struct QuadBucket {
+    struct QuadBucket *next;
+    unsigned int len;
+    QuadItem items[QUAD_BUCKET_MAX];
+} QuadBucket;
 
-    Vec2 pos;
-    void *data;
+/**
+ * Compact node: internal nodes only point to the first of their four children, which are allocated as one block (QUAD_NW..QUAD_SE).
+ */
+typedef struct QuadNode {
+    struct QuadNode *children; // NULL for leaves
+    QuadBucket *bucket;        // leaf payload, NULL if empty
+    unsigned int len;          // entities in the subtree (leaves: all buckets)
+    unsigned short depth;
+    unsigned short mask; // classes present in the subtree (bit c: class c), see qtree_classify()
+#if QUAD_CLASSES > 0
+    unsigned int classes[QUAD_CLASSES]; // entities in the subtree per class
+#endif
 } QuadNode;
 
+/**
+ * Pool owned by a tree, for either nodes or buckets: fixed size blocks of elements which are never moved (elements keep pointing to each other)
+ * and which are kept on reset, so that rebuilding a tree of the same size does not allocate any memory.
+ */
+typedef struct QuadArena {
+    char **blocks;
+    size_t size;       // element size
+    size_t blocks_len; // allocated blocks
+    size_t block;      // current block
+    size_t used;       // used elements in current block
+    size_t release;    // elements per released run: 4 (children of a node) or 1 (a bucket)
+    void *free;        // released runs of release elements, linked via their first pointer
+} QuadArena;
+
+/**
+ * Opt-in query counters (tree->counting), accumulated by area, radius and segment queries until cleared with qtree_reset_counters().
+ * Not synchronized: enable for single threaded queries only.
+ */
+typedef struct QuadCounters {
+    size_t queries;
+    size_t nodes;  // nodes visited
+    size_t leaves; // leaves whose entities were tested
+    size_t tested; // entities tested
+    size_t hits;   // entities passed to the visitor (appended to the list)
+} QuadCounters;
+
+/**
+ * Maps the data of an item to its class (0..QUAD_CLASSES - 1), other values are not counted per class
+ */
+typedef int (*QuadClassFn)(void *data, void *ctx);
+
 typedef struct QuadTree {
     QuadNode *root;
+    QuadBounds bounds;
     unsigned int length;
+    unsigned int bucket;    // max entities per leaf before it splits (1..QUAD_BUCKET_MAX)
+    unsigned int max_depth; // leaves at this depth overflow instead of splitting
+    QuadArena nodes;
+    QuadArena buckets;
+
+    // insert outcomes since the last reset
+    size_t replaced;
+    size_t failed;
+
+    int counting; // enables counters
+    QuadCounters counters;
+
+    QuadClassFn classify; // class masks and per-class counts, see qtree_classify()
+    void *classify_ctx;
+
+    int toroidal; // area and radius queries wrap around the edges, see qtree_toroidal()
+
+    // qtree_build_bulk(): node and bucket arena per worker thread (reset and freed with the tree), input scratch
+    QuadArena *arenas; // worker i: nodes at 2 * i, buckets at 2 * i + 1
+    unsigned int arenas_len;
+    QuadItem *bulk;
+    size_t bulk_max;
 } QuadTree;
 
+/**
+ * Callbacks with a user context, see QUAD_VISIT_*.
+ * Item visitors receive the squared distance to the query position, -1 if the query doesn't compute it (area queries).
+ */
+typedef int (*QuadItemVisitor)(QuadItem *item, float dist2, void *ctx);
+typedef int (*QuadNodeVisitor)(QuadNode *node, QuadBounds bounds, void *ctx);
+
 QuadTree *qtree_create(Vec2 window_nw, Vec2 window_se);
+int qtree_configure(QuadTree *tree, unsigned int bucket, unsigned int max_depth);
+int qtree_classify(QuadTree *tree, QuadClassFn fn, void *ctx);
+int qtree_toroidal(QuadTree *tree, int toroidal);
+void qtree_reset(QuadTree *tree);
 void qtree_destroy(QuadTree *tree);
 
 int qtree_insert(QuadTree *tree, void *data, Vec2 pos);
-QuadNode *qtree_find(QuadTree *tree, Vec2 pos);
+int qtree_build_bulk(QuadTree *tree, void **items, Vec2 *positions, size_t n, unsigned int threads);
+int qtree_remove(QuadTree *tree, void *data, Vec2 pos);
+int qtree_move(QuadTree *tree, void *data, Vec2 old_pos, Vec2 new_pos);
+QuadItem *qtree_find(QuadTree *tree, Vec2 pos);
 
-QuadNode *qnode_create(QuadNode *parent);
+QuadNode *qnode_create();
 void qnode_destroy(QuadNode *node);
 
 int qnode_isempty(QuadNode *node);
 int qnode_isleaf(QuadNode *node);
 int qnode_ispointer(QuadNode *node);
 
-int qnode_within_area(QuadNode *node, Vec2 nw, Vec2 se);
-int qnode_overlaps_area(QuadNode *node, Vec2 nw, Vec2 se);
+QuadBounds qbounds_quadrant(QuadBounds bounds, int quadrant);
+int qbounds_within_area(QuadBounds bounds, Vec2 nw, Vec2 se);
+int qbounds_overlaps_area(QuadBounds bounds, Vec2 nw, Vec2 se);
+size_t qbounds_wrap_offsets(QuadBounds bounds, Vec2 nw, Vec2 se, Vec2 offsets[4]);
+float qbounds_wrap_radius(QuadBounds bounds, float radius);
+
+int qnode_walk_ctx(QuadNode *node, QuadBounds bounds, QuadNodeVisitor descent, QuadNodeVisitor ascent, void *ctx);
+int qtree_walk(QuadTree *tree, QuadNodeVisitor descent, QuadNodeVisitor ascent, void *ctx);
 
-void qnode_set_bounds(QuadNode *node, Vec2 nw, Vec2 se);
-void qnode_walk(QuadNode *node, void (*descent)(QuadNode *node), void (*ascent)(QuadNode *node));
+int qtree_visit_area(QuadTree *tree, Vec2 nw, Vec2 se, QuadItemVisitor fn, void *ctx);
+int qtree_visit_radius(QuadTree *tree, Vec2 pos, float radius, QuadItemVisitor fn, void *ctx);
+int qtree_visit_area_mask(QuadTree *tree, Vec2 nw, Vec2 se, unsigned int mask, QuadItemVisitor fn, void *ctx);
+int qtree_visit_radius_mask(QuadTree *tree, Vec2 pos, float radius, unsigned int mask, QuadItemVisitor fn, void *ctx);
+
+////
+// QuadStats
+////
+
+typedef struct QuadStats {
+    size_t length;
+    size_t internal; // nodes with children
+    size_t leaves;   // nodes with entities
+    size_t empty;    // nodes without children or entities
+    size_t buckets;  // leaf payload buckets, overflow buckets included
+    size_t depth[QUAD_DEPTH_LIMIT + 1]; // nodes per depth
+    unsigned int max_depth;             // deepest node
+    size_t replaced;                    // see QuadTree
+    size_t failed;
+    size_t bytes;      // memory held by the tree, including the reserve of the arenas
+    size_t bytes_used; // nodes and buckets in use
+} QuadStats;
+
+int qtree_stats(QuadTree *tree, QuadStats *stats);
+void qtree_reset_counters(QuadTree *tree);
 
 void qtree_print(FILE *fp, QuadTree *tree);
 void qnode_print(FILE *fp, QuadNode *node);
@@ -86,17 +243,112 @@ void qnode_print(FILE *fp, QuadNode *node);
 
 typedef struct QuadList {
     size_t len;
-    size_t grow;
+    size_t grow; // minimum growth, the capacity doubles beyond it
     size_t max;
-    QuadNode **nodes;
+    QuadItem **items;
+    float *dist2; // squared distances to the query position, -1 if the query doesn't compute them (area queries), see qtree_find_on_segment()
 } QuadList;
 
 QuadList *qlist_create(size_t max);
-QuadList *qlist_append(QuadList *list, QuadNode *node);
+QuadList *qlist_append(QuadList *list, QuadItem *item);
+QuadList *qlist_append_dist(QuadList *list, QuadItem *item, float dist2);
 void qlist_reset(QuadList *list);
 void qlist_print(FILE *fp, QuadList *list);
 void qlist_destroy(QuadList *list);
 
 QuadList *qtree_find_in_area(QuadTree *tree, Vec2 pos, float radius, QuadList *list); // TODO
+QuadList *qtree_find_in_radius(QuadTree *tree, Vec2 pos, float radius, QuadList *list);
+QuadList *qtree_find_knn(QuadTree *tree, Vec2 pos, size_t k, float max_radius, QuadList *list);
+QuadList *qtree_find_in_radius_mask(QuadTree *tree, Vec2 pos, float radius, unsigned int mask, QuadList *list);
+QuadList *qtree_find_knn_mask(QuadTree *tree, Vec2 pos, size_t k, float max_radius, unsigned int mask, QuadList *list);
+QuadList *qtree_find_on_segment(QuadTree *tree, Vec2 a, Vec2 b, float width, QuadList *list);
+size_t qtree_count_in_area(QuadTree *tree, Vec2 nw, Vec2 se, size_t *classes);
+
+// test hook: >= 0 that many more allocations of the knn search succeed, then they fail; < 0 off (default)
+extern int quad_alloc_fail;
+
+////
+// QuadPairs
+////
+
+typedef struct QuadPair {
+    QuadItem *a;
+    QuadItem *b;
+    float dist2;
+} QuadPair;
+
+/**
+ * All-pairs neighbour table (CSR): row i lists the neighbours of the item with index i,
+ * indices[offsets[i]] .. indices[offsets[i + 1] - 1] with their squared distances in dist2.
+ */
+typedef struct QuadPairs {
+    size_t len;      // rows
+    size_t count;    // entries, every pair is listed in both of its rows
+    size_t *offsets; // len + 1
+    size_t *indices;
+    float *dist2;
+
+    // capacities, unordered pairs collected by the traversal
+    size_t max_rows;
+    size_t max;
+    QuadPair *scratch;
+    size_t scratch_len;
+    size_t scratch_max;
+} QuadPairs;
+
+typedef size_t (*QuadIndexFn)(void *data, void *ctx);
+
+QuadPairs *qpairs_create();
+void qpairs_reset(QuadPairs *pairs);
+void qpairs_destroy(QuadPairs *pairs);
+
+QuadPairs *qtree_find_all_pairs(QuadTree *tree, float radius, size_t rows, QuadIndexFn index, void *ctx, QuadPairs *pairs);
+
+////
+// QuadMass
+////
+
+typedef float (*QuadMassFn)(void *data, void *ctx);
+
+/**
+ * Node of a QuadMass: the non-empty nodes of a tree in pre-order, the subtree of nodes[i] ends before nodes[nodes[i].next].
+ */
+typedef struct QuadMassNode {
+    QuadNode *node;
+    QuadBounds bounds;
+    float size2;       // squared longest side
+    float mass;        // all classes
+    Vec2 com;          // center of mass, all classes
+    unsigned int next; // skip index
+} QuadMassNode;
+
+/**
+ * Mass aggregates of a tree for Barnes-Hut approximations: total mass and center of mass per node and per class.
+ * A snapshot, rebuilt with qmass_build() after the tree changed.
+ */
+typedef struct QuadMass {
+    size_t len;
+    size_t max;
+    QuadMassNode *nodes;
+    unsigned int classes;
+    float *mass; // len * classes
+    Vec2 *com;   // len * classes
+
+    // item mass and class, see qmass_build()
+    QuadMassFn mass_fn;
+    QuadClassFn class_fn;
+    void *ctx;
+} QuadMass;
+
+/**
+ * Barnes-Hut visitor: receives either a single item (item != NULL) or the aggregate of a far node's items of one class.
+ */
+typedef int (*QuadMassVisitor)(Vec2 com, float mass, int class, QuadItem *item, void *ctx);
+
+QuadMass *qmass_create(unsigned int classes);
+void qmass_destroy(QuadMass *mass);
+
+int qmass_build(QuadMass *mass, QuadTree *tree, QuadMassFn mass_fn, QuadClassFn class_fn, void *ctx);
+int qmass_visit(QuadMass *mass, Vec2 pos, float theta, QuadMassVisitor fn, void *ctx);
 
 #endif
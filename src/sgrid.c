@@ -0,0 +1,300 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <assert.h>
+
+#include "qtree.h"
+#include "sgrid.h"
+#include "utils.h"
+
+/**
+ * Maps a coordinate to its cell column (or row), clamped to the grid.
+ */
+static uint32_t _cell(float v, float min, float scale, uint32_t cells) {
+    float c = (v - min) * scale;
+    if (!(c >= 0)) { // also catches NAN
+        return 0;
+    }
+    if (c >= cells) {
+        return cells - 1;
+    }
+    return (uint32_t)c;
+}
+
+/**
+ * Grows item arrays (geometric)
+ */
+static int _sgrid_grow(SpatialGrid *grid) {
+    size_t max = (grid->max) ? grid->max * 2 : 64;
+
+    uint32_t *cells = realloc(grid->cells, max * sizeof(uint32_t));
+    if (!cells) {
+        return -1;
+    }
+    grid->cells = cells;
+
+    QuadItem *pending = realloc(grid->pending, max * sizeof(QuadItem));
+    if (!pending) {
+        return -1;
+    }
+    grid->pending = pending;
+
+    // sorted items are rebuilt from pending
+    freez(grid->items);
+    grid->items = malloc(max * sizeof(QuadItem));
+    if (!grid->items) {
+        return -1;
+    }
+
+    grid->max = max;
+    return 0;
+}
+
+////
+// Area search
+////
+
+typedef struct SGridArea {
+    // cell range of the search area (inclusive)
+    uint32_t x0, y0;
+    uint32_t x1, y1;
+    // search area
+    Vec2 nw;
+    Vec2 se;
+    // circle queries: items are filtered by their squared distance to pos instead of the area
+    int circle;
+    Vec2 pos;
+    float radius2;
+} SGridArea;
+
+/**
+ * Scans the cells of the search area row by row. The cells of a row are adjacent in items, so each row is one contiguous range.
+ */
+static void _sgrid_find(SpatialGrid *grid, Vec2 pos, float radius, int circle, QuadList *list) {
+    sgrid_build(grid);
+
+    SGridArea area;
+    area.nw = (Vec2){pos.x - radius, pos.y - radius};
+    area.se = (Vec2){pos.x + radius, pos.y + radius};
+
+    // search area outside of the grid
+    if (area.se.x < grid->nw.x || area.nw.x >= grid->se.x || area.se.y < grid->nw.y || area.nw.y >= grid->se.y) {
+        return;
+    }
+
+    area.x0 = _cell(area.nw.x, grid->nw.x, grid->scale, grid->cols);
+    area.y0 = _cell(area.nw.y, grid->nw.y, grid->scale, grid->rows);
+    area.x1 = _cell(area.se.x, grid->nw.x, grid->scale, grid->cols);
+    area.y1 = _cell(area.se.y, grid->nw.y, grid->scale, grid->rows);
+
+    area.circle = circle;
+    area.pos = pos;
+    area.radius2 = radius * radius;
+
+    QuadItem *item;
+    Vec2 delta;
+    float dist2;
+    uint32_t row;
+
+    for (uint32_t y = area.y0; y <= area.y1; y++) {
+        row = y * grid->cols;
+        for (uint32_t i = grid->offsets[row + area.x0]; i < grid->offsets[row + area.x1 + 1]; i++) {
+            item = &grid->items[i];
+            if (!area.circle) {
+                if (vec2_within(item->pos, area.nw, area.se)) {
+                    qlist_append(list, item);
+                }
+                continue;
+            }
+
+            delta = vec2_sub(item->pos, area.pos);
+            dist2 = delta.x * delta.x + delta.y * delta.y;
+            if (dist2 <= area.radius2) {
+                qlist_append_dist(list, item, dist2);
+            }
+        }
+    }
+}
+
+////
+// SpatialGrid
+////
+
+/**
+ * Creates a grid covering the window with (roughly) square cells of the given size, typically the query radius.
+ */
+SpatialGrid *sgrid_create(Vec2 window_nw, Vec2 window_se, float cell) {
+    assert(window_nw.x < window_se.x);
+    assert(window_nw.y < window_se.y);
+
+    if (!(cell > 0)) {
+        LOG_ERROR_F("invalid cell size %f", cell);
+        return NULL;
+    }
+
+    float width = window_se.x - window_nw.x;
+    float height = window_se.y - window_nw.y;
+
+    // too many cells: grow them
+    while ((ceilf(width / cell) * ceilf(height / cell)) > SGRID_CELLS_MAX) {
+        cell *= 2;
+    }
+
+    SpatialGrid *grid = calloc(1, sizeof(SpatialGrid));
+    if (!grid) {
+        LOG_ERROR("failed to allocate memory for SpatialGrid");
+        return NULL;
+    }
+
+    grid->nw = window_nw;
+    grid->se = window_se;
+    grid->cell = cell;
+    grid->scale = 1.f / cell;
+    grid->cols = (uint32_t)ceilf(width / cell);
+    grid->rows = (uint32_t)ceilf(height / cell);
+
+    grid->offsets = calloc(grid->cols * grid->rows + 1, sizeof(uint32_t));
+    if (!grid->offsets) {
+        LOG_ERROR("failed to allocate memory for SpatialGrid cells");
+        freez(grid);
+        return NULL;
+    }
+
+    grid->sorted = 1;
+    return grid;
+}
+
+/**
+ * Empties the grid, keeps the allocated capacity
+ */
+void sgrid_reset(SpatialGrid *grid) {
+    if (!grid) {
+        return;
+    }
+    grid->length = 0;
+    grid->sorted = 0; // clears the cell ranges on the next build
+}
+
+void sgrid_destroy(SpatialGrid *grid) {
+    if (!grid) {
+        return;
+    }
+    freez(grid->cells);
+    freez(grid->pending);
+    freez(grid->items);
+    freez(grid->offsets);
+    freez(grid);
+}
+
+/**
+ * Appends an entity, the grid needs to be (re-)built before it can be queried.
+ * Like lqtree_insert() this does not check for an already indexed item (never QUAD_REPLACED).
+ */
+int sgrid_insert(SpatialGrid *grid, void *data, Vec2 pos) {
+    if (!grid || !data) {
+        return QUAD_FAILED;
+    }
+
+    // same bounds as the root of a QuadTree
+    if (!(pos.x >= grid->nw.x && pos.x < grid->se.x && pos.y >= grid->nw.y && pos.y < grid->se.y)) {
+        return QUAD_FAILED;
+    }
+
+    if (grid->length >= grid->max && _sgrid_grow(grid) != 0) {
+        LOG_ERROR("failed to allocate memory for SpatialGrid items");
+        return QUAD_FAILED;
+    }
+
+    uint32_t x = _cell(pos.x, grid->nw.x, grid->scale, grid->cols);
+    uint32_t y = _cell(pos.y, grid->nw.y, grid->scale, grid->rows);
+
+    grid->cells[grid->length] = y * grid->cols + x;
+    grid->pending[grid->length] = (QuadItem){pos, data};
+    grid->length++;
+    grid->sorted = 0;
+
+    return QUAD_INSERTED;
+}
+
+/**
+ * Groups the items by cell (counting sort), O(n + cells).
+ */
+int sgrid_build(SpatialGrid *grid) {
+    if (!grid) {
+        return -1;
+    }
+    if (grid->sorted) {
+        return 0;
+    }
+
+    uint32_t len = grid->cols * grid->rows;
+    uint32_t *offsets = grid->offsets;
+    memset(offsets, 0, (len + 1) * sizeof(uint32_t));
+
+    for (size_t i = 0; i < grid->length; i++) {
+        offsets[grid->cells[i] + 1]++;
+    }
+    for (uint32_t c = 0; c < len; c++) {
+        offsets[c + 1] += offsets[c];
+    }
+
+    // scatter, using offsets[cell] as insert position (shifted back afterwards)
+    for (size_t i = 0; i < grid->length; i++) {
+        grid->items[offsets[grid->cells[i]]++] = grid->pending[i];
+    }
+    for (uint32_t c = len; c > 0; c--) {
+        offsets[c] = offsets[c - 1];
+    }
+    offsets[0] = 0;
+
+    grid->sorted = 1;
+    return 0;
+}
+
+QuadItem *sgrid_find(SpatialGrid *grid, Vec2 pos) {
+    if (!grid || !grid->length) {
+        return NULL;
+    }
+    if (!(pos.x >= grid->nw.x && pos.x < grid->se.x && pos.y >= grid->nw.y && pos.y < grid->se.y)) {
+        return NULL;
+    }
+
+    sgrid_build(grid);
+
+    uint32_t x = _cell(pos.x, grid->nw.x, grid->scale, grid->cols);
+    uint32_t y = _cell(pos.y, grid->nw.y, grid->scale, grid->rows);
+    uint32_t cell = y * grid->cols + x;
+
+    for (uint32_t i = grid->offsets[cell]; i < grid->offsets[cell + 1]; i++) {
+        if (vec2_equals(grid->items[i].pos, pos)) {
+            return &grid->items[i];
+        }
+    }
+
+    return NULL;
+}
+
+QuadList *sgrid_find_in_area(SpatialGrid *grid, Vec2 pos, float radius, QuadList *list) {
+    if (!grid || !list) {
+        return NULL;
+    }
+    _sgrid_find(grid, pos, radius, 0, list);
+    return list;
+}
+
+/**
+ * Circle query, same as qtree_find_in_radius()
+ */
+QuadList *sgrid_find_in_radius(SpatialGrid *grid, Vec2 pos, float radius, QuadList *list) {
+    if (!grid || !list) {
+        return NULL;
+    }
+    if (radius < 0) {
+        return list;
+    }
+    _sgrid_find(grid, pos, radius, 1, list);
+    return list;
+}
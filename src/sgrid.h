@@ -0,0 +1,50 @@
+/**
+ * Uniform grid (a spatial hash over the bounded world): entities are bucketed by the cell of their position.
+ * With the cell size set to the query radius, a neighbour query scans (at most) the 3x3 cells around its position.
+ *
+ * Same query semantics as QuadTree (qtree.h), built in one go like LinearQuadTree (lqtree.h):
+ * insert everything, then bucket (sgrid_build(), called lazily by the queries). There is no incremental update.
+ */
+
+#ifndef __SGRID_H__
+#define __SGRID_H__
+
+#include <stdint.h>
+
+#include "qtree.h"
+#include "vec2.h"
+
+#ifndef SGRID_CELLS_MAX
+#define SGRID_CELLS_MAX (1u << 20) // cells per grid, larger cell sizes are used for tiny cells in a large world
+#endif
+
+typedef struct SpatialGrid {
+    Vec2 nw;
+    Vec2 se;
+    float cell;  // cell size (world units)
+    float scale; // world units to cells
+    uint32_t cols;
+    uint32_t rows;
+
+    unsigned int length;
+    size_t max;
+    int sorted;
+
+    uint32_t *cells;   // cell (row major) of each inserted item, insertion order
+    QuadItem *pending; // inserted items, insertion order
+    QuadItem *items;   // grouped by cell after build
+    uint32_t *offsets; // cols * rows + 1: items of cell c are items[offsets[c]] .. items[offsets[c + 1] - 1]
+} SpatialGrid;
+
+SpatialGrid *sgrid_create(Vec2 window_nw, Vec2 window_se, float cell);
+void sgrid_reset(SpatialGrid *grid);
+void sgrid_destroy(SpatialGrid *grid);
+
+int sgrid_insert(SpatialGrid *grid, void *data, Vec2 pos);
+int sgrid_build(SpatialGrid *grid);
+
+QuadItem *sgrid_find(SpatialGrid *grid, Vec2 pos);
+QuadList *sgrid_find_in_area(SpatialGrid *grid, Vec2 pos, float radius, QuadList *list);
+QuadList *sgrid_find_in_radius(SpatialGrid *grid, Vec2 pos, float radius, QuadList *list);
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "app.h"
 #include "crt.h"
+#include "qtree.h"
 #include "ui.h"
 #include "utils.h"
 #include "world.h"
@@ -30,6 +31,7 @@
 static void _draw_menu_toggle(App *app, struct nk_glfw *gui, struct nk_context *ctx);
 static void _draw_menu(App *app, struct nk_glfw *gui, struct nk_context *ctx, World *world);
 static void _draw_crt_info(App *app, struct nk_glfw *gui, struct nk_context *ctx, World *world);
+static void _draw_qtree_stats(struct nk_context *ctx, QuadTree *tree);
 
 // TODO mv to nk_glfw3.h
 struct nk_canvas {
@@ -194,7 +196,7 @@ int gui_draw(App *app, World *world) {
 static void _draw_menu(App *app, struct nk_glfw *gui, struct nk_context *ctx, World *world) {
     // params tested before
     int w = 550;
-    int h = 250;
+    int h = 470;
     char msg[256];
     char sval[16];
     Rule *rule;
@@ -215,6 +217,7 @@ static void _draw_menu(App *app, struct nk_glfw *gui, struct nk_context *ctx, Wo
     nk_checkbox_label(ctx, "show quads", &app->show_quads);
     nk_checkbox_label(ctx, "show neighbours", &app->show_neighbours);
     nk_checkbox_label(ctx, "show perception", &app->show_perception);
+    nk_checkbox_label(ctx, "show contacts", &app->show_contacts);
 
     snprintf(msg, 256, "max fps: %ld", app->fps);
     nk_label(ctx, msg, NK_TEXT_LEFT);
@@ -222,6 +225,10 @@ static void _draw_menu(App *app, struct nk_glfw *gui, struct nk_context *ctx, Wo
     snprintf(msg, 256, "version: %s", app->version);
     nk_label(ctx, msg, NK_TEXT_LEFT);
 
+    if (world->qtree && world->backend == WORLD_BACKEND_QTREE) {
+        _draw_qtree_stats(ctx, world->qtree);
+    }
+
     if (world->rules) {
         for (size_t i = 0; i < world->rules->len; i++) {
             rule = world->rules->rules[i];
@@ -235,6 +242,49 @@ static void _draw_menu(App *app, struct nk_glfw *gui, struct nk_context *ctx, Wo
     nk_end(ctx);
 }
 
+/**
+ * Tree shape and (opt-in) query costs of the current frame, to tell if slow frames are caused by the tree
+ */
+static void _draw_qtree_stats(struct nk_context *ctx, QuadTree *tree) {
+    char msg[256];
+    QuadStats stats;
+    QuadCounters *counters = &tree->counters;
+    int len;
+
+    if (qtree_stats(tree, &stats) != 0) {
+        return;
+    }
+
+    snprintf(msg, 256, "qtree: %zu entities, %u bucket, max depth %u", stats.length, tree->bucket, tree->max_depth);
+    nk_label(ctx, msg, NK_TEXT_LEFT);
+
+    snprintf(msg, 256, "nodes: %zu internal, %zu leaf, %zu empty, %zu buckets", stats.internal, stats.leaves, stats.empty, stats.buckets);
+    nk_label(ctx, msg, NK_TEXT_LEFT);
+
+    len = snprintf(msg, 256, "depth:");
+    for (unsigned int i = 0; i <= stats.max_depth && len < 256; i++) {
+        len += snprintf(msg + len, 256 - len, " %zu", stats.depth[i]);
+    }
+    nk_label(ctx, msg, NK_TEXT_LEFT);
+
+    snprintf(msg, 256, "inserts: %zu replaced, %zu failed", stats.replaced, stats.failed);
+    nk_label(ctx, msg, NK_TEXT_LEFT);
+
+    snprintf(msg, 256, "memory: %.1f KiB (%.1f KiB used)", stats.bytes / 1024.f, stats.bytes_used / 1024.f);
+    nk_label(ctx, msg, NK_TEXT_LEFT);
+
+    nk_checkbox_label(ctx, "query counters", &tree->counting);
+    if (tree->counting && counters->queries) {
+        snprintf(msg, 256, "queries: %zu, per query: %.1f nodes, %.1f leaves, %.1f tested, %.1f hits",
+                 counters->queries,
+                 (float)counters->nodes / counters->queries,
+                 (float)counters->leaves / counters->queries,
+                 (float)counters->tested / counters->queries,
+                 (float)counters->hits / counters->queries);
+        nk_label(ctx, msg, NK_TEXT_LEFT);
+    }
+}
+
 static void _draw_menu_toggle(App *app, struct nk_glfw *gui, struct nk_context *ctx) {
     // params tested before
     int w = 100;
@@ -254,7 +304,7 @@ static void _draw_menu_toggle(App *app, struct nk_glfw *gui, struct nk_context *
 }
 
 static void _draw_crt_info(App *app, struct nk_glfw *gui, struct nk_context *ctx, World *world) {
-    if (world->len <= 0) {
+    if (world->crts->len <= 0) {
         return;
     }
 
@@ -268,16 +318,13 @@ static void _draw_crt_info(App *app, struct nk_glfw *gui, struct nk_context *ctx
 
     _nk_canvas_begin("crt info", ctx, &canvas, NK_WINDOW_BACKGROUND, 0, 0, gui->display_width, gui->display_height, bg);
 
-    for (size_t i = 0; i < world->len; i++) {
-        if (!world->population[i]) {
-            continue;
-        }
-
+    CrtStore *crts = world->crts;
+    for (size_t i = 0; i < crts->len; i++) {
         rect = nk_rect(
-            world->population[i]->pos.x - (world->population[i]->size / 2),
-            world->population[i]->pos.y - (world->population[i]->size / 2) - 25,
+            crts->pos[i].x - (crts->size[i] / 2),
+            crts->pos[i].y - (crts->size[i] / 2) - 25,
             50, 20);
-        snprintf(msg, 128, "%d", world->population[i]->id);
+        snprintf(msg, 128, "%d", crts->info[i].handle.slot);
         nk_draw_text(canvas.painter, rect, msg, strlen(msg), &font->handle, bg, fg);
     }
 
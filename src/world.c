@@ -1,33 +1,64 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <GLFW/glfw3.h>
 
 #include "app.h"
 #include "crt.h"
+#include "lqtree.h"
+#include "ltree.h"
+#include "pool.h"
 #include "qtree.h"
+#include "sgrid.h"
 #include "ui.h"
 #include "utils.h"
 #include "world.h"
 
+const char world_backend_names[][16] = {"qtree", "linear", "grid"};
+
 RuleSet *rules_create();
 
-World *world_create(size_t len, Vec2 nw, Vec2 se) {
+/**
+ * max: initial capacity of the population, which grows with births (see crt_birth())
+ */
+World *world_create(size_t max, Vec2 nw, Vec2 se) {
     World *world = calloc(sizeof(World), 1);
     EXIT_IF(world == NULL, "failed to allocate memory for world(1)");
 
     // dimensions
     world->nw = nw;
     world->se = se;
+    world->wrap = 0;
 
     // population
-    world->len = len;
-    for (size_t i = 0; i < WORLD_POP_MAX; i++) {
-        world->population[i] = NULL; // dumb fill until we have a memory managed population array (TODO)
-    }
-
-    // qtree
+    world->crts = crt_store_create(max);
+    world->max = 0;
+    world->index_data = NULL;
+    world->indexed = NULL;
+    world->bodies_pos = NULL;
+    world->bodies_size = NULL;
+
+    // spatial index
+    world->backend = WORLD_BACKEND_DEFAULT;
     world->qtree = NULL; // created in runtime
+    world->lqtree = NULL;
+    world->sgrid = NULL;
+    world->sgrid_perception = 0;
+    world->index_mode = WORLD_INDEX_REBUILD;
+    world->knn = 0;
+    world->threads = 1;
+    world->pool = NULL;
+    world->neighbours = NULL;
+    world->workers = 0;
+    world->all_pairs = 0;
+    world->pairs = NULL;
+    world->theta = 0;
+    world->mass = NULL;
+    world->simd = force_detect();
+    world->bodies = NULL; // created on demand
+    EXIT_IF(world_reserve(world, world->crts->max) != 0, "failed to allocate memory for world index arrays");
 
     // ruleset
     world->rules = rules_create();
@@ -43,7 +74,6 @@ void world_print(FILE *fp, World *world) {
     if (!world) {
         fprintf(fp, "<NULL>\n");
     }
-    Creature *crt;
 
     fprintf(fp,
             "{\n"
@@ -52,17 +82,12 @@ void world_print(FILE *fp, World *world) {
             "  len: %ld,\n",
             world->nw.x, world->nw.y,
             world->se.x, world->se.y,
-            world->len);
+            world->crts->len);
 
     fprintf(fp, "  population: [");
-    for (int i = 0; i < world->len; i++) {
-        crt = world->population[i];
-        if (!crt) {
-            fprintf(fp, "NULL");
-        } else {
-            fprintf(fp, "{%d, \"%s\", %s}", crt->id, crt->name, CRT_TYPE_NAME(crt->type));
-        }
-        fprintf(fp, "%s", (i < world->len - 1) ? ", " : "");
+    for (size_t i = 0; i < world->crts->len; i++) {
+        fprintf(fp, "{%d, \"%s\", %s}", world->crts->info[i].handle.slot, world->crts->info[i].name, CRT_TYPE_NAME(world->crts->type[i]));
+        fprintf(fp, "%s", (i < world->crts->len - 1) ? ", " : "");
     }
     fprintf(fp, "],\n");
 
@@ -77,15 +102,26 @@ void world_destroy(World *world) {
     }
 
     // population
-    if (world->population) {
-        for (int i = 0; i < world->len; i++) {
-            crt_destroy(world->population[i]);
-        }
-    }
-    world->len = 0;
+    crt_store_destroy(world->crts);
+    freez(world->index_data);
+    freez(world->indexed);
+    freez(world->bodies_pos);
+    freez(world->bodies_size);
 
-    // quad tree
+    // quad trees
     qtree_destroy(world->qtree);
+    lqtree_destroy(world->lqtree);
+    sgrid_destroy(world->sgrid);
+    qpairs_destroy(world->pairs);
+    qmass_destroy(world->mass);
+    ltree_destroy(world->bodies);
+
+    // workers
+    pool_destroy(world->pool);
+    for (unsigned int i = 0; i < world->workers; i++) {
+        crt_neighbours_destroy(world->neighbours[i]);
+    }
+    freez(world->neighbours);
 
     // rules
     rules_destroy(world->rules);
@@ -94,6 +130,113 @@ void world_destroy(World *world) {
     freez(world);
 }
 
+////
+// Population
+////
+
+/**
+ * Grows the per creature index arrays to (at least) max creatures, follows the capacity of the population.
+ * Returns -1 if an allocation failed, the world keeps its capacity.
+ */
+int world_reserve(World *world, size_t max) {
+    if (!world) {
+        return -1;
+    }
+    if (max <= world->max) {
+        return 0;
+    }
+
+    void **index_data = realloc(world->index_data, max * sizeof(void *));
+    if (index_data) {
+        world->index_data = index_data;
+    }
+    Vec2 *indexed = realloc(world->indexed, max * sizeof(Vec2));
+    if (indexed) {
+        world->indexed = indexed;
+    }
+    Vec2 *bodies_pos = realloc(world->bodies_pos, max * sizeof(Vec2));
+    if (bodies_pos) {
+        world->bodies_pos = bodies_pos;
+    }
+    float *bodies_size = realloc(world->bodies_size, max * sizeof(float));
+    if (bodies_size) {
+        world->bodies_size = bodies_size;
+    }
+    if (!index_data || !indexed || !bodies_pos || !bodies_size) {
+        LOG_ERROR_F("failed to re-allocate memory for the index arrays of %ld creatures", max);
+        return -1;
+    }
+
+    for (size_t i = world->max; i < max; i++) {
+        world->index_data[i] = CRT_DATA(i);
+        world->indexed[i] = (Vec2){INFINITY, INFINITY};
+        world->bodies_size[i] = -1;
+    }
+    world->max = max;
+    return 0;
+}
+
+/**
+ * Removes creature i from the incrementally maintained indices (qtree, bodies), before it dies.
+ * The rebuilt indices follow with the next world_update().
+ */
+void world_unindex(World *world, size_t i) {
+    if (!world || i >= world->max) {
+        return;
+    }
+
+    if (world->qtree && isfinite(world->indexed[i].x)) {
+        qtree_remove(world->qtree, CRT_DATA(i), world->indexed[i]);
+    }
+    world->indexed[i] = (Vec2){INFINITY, INFINITY};
+
+    if (world->bodies && world->bodies_size[i] >= 0) {
+        ltree_remove(world->bodies, CRT_DATA(i), crt_body(world->bodies_pos[i], world->bodies_size[i]));
+    }
+    world->bodies_size[i] = -1;
+}
+
+/**
+ * Re-indexes a creature which was moved from index from to index to in the population (see crt_store_despawn()),
+ * at the position and size it is currently indexed with.
+ */
+void world_reindex(World *world, size_t from, size_t to) {
+    if (!world || from >= world->max || to >= world->max) {
+        return;
+    }
+
+    Vec2 pos = world->indexed[from];
+    Vec2 body_pos = world->bodies_pos[from];
+    float body_size = world->bodies_size[from];
+    int res;
+
+    world_unindex(world, from);
+
+    if (world->qtree && isfinite(pos.x)) {
+        res = qtree_insert(world->qtree, CRT_DATA(to), pos);
+        world->indexed[to] = (res == QUAD_FAILED) ? (Vec2){INFINITY, INFINITY} : pos;
+    }
+
+    if (world->bodies && body_size >= 0) {
+        res = ltree_insert(world->bodies, CRT_DATA(to), crt_body(body_pos, body_size));
+        world->bodies_pos[to] = body_pos;
+        world->bodies_size[to] = (res == QUAD_FAILED) ? -1 : body_size;
+    }
+}
+
+static size_t _world_crt_index(void *data, void *ctx) {
+    (void)ctx; // QuadIndexFn signature
+    return CRT_INDEX(data); // population index
+}
+
+static float _world_crt_mass(void *data, void *ctx) {
+    return ((World *)ctx)->crts->mass[CRT_INDEX(data)];
+}
+
+static int _world_crt_type(void *data, void *ctx) {
+    return ((World *)ctx)->crts->type[CRT_INDEX(data)];
+}
+
 /**
  * Main loop: update
  */
@@ -102,46 +245,166 @@ int world_update(App *app, World *world) {
         return -1;
     }
 
-    // 1. rebuild quad tree
+    // 1. update spatial index
 
-    if (world->population) {
+    CrtStore *crts = world->crts;
 
-        qtree_destroy(world->qtree); // TODO optimize (pre-alloc MAX_POP)
-        world->qtree = qtree_create(world->nw, world->se);
-        EXIT_IF(world->qtree == NULL, "failed to allocate memory for world tree");
+    if (world->backend == WORLD_BACKEND_LINEAR) {
+        if (!world->lqtree) {
+            world->lqtree = lqtree_create(world->nw, world->se);
+            EXIT_IF(world->lqtree == NULL, "failed to allocate memory for world tree");
+        } else {
+            lqtree_reset(world->lqtree);
+        }
 
-        for (int i = 0; i < world->len; i++) {
-            if (world->population[i]) {
-                qtree_insert(world->qtree, world->population[i], world->population[i]->pos);
+        for (size_t i = 0; i < crts->len; i++) {
+            lqtree_insert(world->lqtree, CRT_DATA(i), crts->pos[i]);
+        }
+        lqtree_build(world->lqtree);
+    }
+
+    if (world->backend == WORLD_BACKEND_GRID) {
+        // one cell per perception radius: queries scan the 3x3 cells around a creature
+        float perception = 0;
+        for (size_t i = 0; i < crts->len; i++) {
+            perception = fmaxf(perception, crts->perception[i]);
+        }
+
+        // resize the cells once a creature sees further than they are wide (or the grid was sized for nobody)
+        if (world->sgrid && perception > world->sgrid_perception) {
+            sgrid_destroy(world->sgrid);
+            world->sgrid = NULL;
+        }
+
+        if (!world->sgrid) {
+            world->sgrid = sgrid_create(world->nw, world->se, (perception > 0) ? perception : WORLD_WIDTH(world));
+            EXIT_IF(world->sgrid == NULL, "failed to allocate memory for world grid");
+            world->sgrid_perception = perception;
+        } else {
+            sgrid_reset(world->sgrid);
+        }
+
+        for (size_t i = 0; i < crts->len; i++) {
+            sgrid_insert(world->sgrid, CRT_DATA(i), crts->pos[i]);
+        }
+        sgrid_build(world->sgrid);
+    }
+
+    if (world->backend == WORLD_BACKEND_QTREE) {
+        int rebuild = 1;
+        int res;
+
+        if (!world->qtree) {
+            world->qtree = qtree_create(world->nw, world->se);
+            EXIT_IF(world->qtree == NULL, "failed to allocate memory for world tree");
+            qtree_configure(world->qtree, QUAD_BUCKET_MAX, QUAD_DEPTH_MAX);
+            qtree_toroidal(world->qtree, world->wrap);
+            qtree_classify(world->qtree, _world_crt_type, world); // type masks for the neighbour queries
+        } else if (world->index_mode == WORLD_INDEX_INCREMENTAL) {
+            rebuild = 0;
+        }
+
+        // query counters (if enabled) cover one frame
+        qtree_reset_counters(world->qtree);
+
+        if (rebuild) {
+            // partitioned top-down in one go (keeps the node arenas of the previous frame)
+            memcpy(world->indexed, crts->pos, crts->len * sizeof(Vec2));
+            qtree_build_bulk(world->qtree, world->index_data, world->indexed, crts->len, world->threads);
+        }
+
+        for (size_t i = 0; i < crts->len && !rebuild; i++) {
+            if (vec2_equals(world->indexed[i], crts->pos[i])) {
+                continue; // unchanged
             }
+
+            res = qtree_move(world->qtree, CRT_DATA(i), world->indexed[i], crts->pos[i]);
+            world->indexed[i] = (res == QUAD_FAILED) ? (Vec2){INFINITY, INFINITY} : crts->pos[i];
         }
     }
 
+    // 2. neighbour table
+
+    if (world->pairs) {
+        qpairs_reset(world->pairs);
+    }
+
+    // the table is not wrap-aware: toroidal worlds stream their neighbours instead
+    if (world->all_pairs && world->backend == WORLD_BACKEND_QTREE && !world->knn && !world->wrap) {
+        if (!world->pairs) {
+            world->pairs = qpairs_create();
+            EXIT_IF(world->pairs == NULL, "failed to allocate memory for world neighbour table");
+        }
+
+        // one radius for the whole tree, creatures filter by their own perception
+        float radius = 0;
+        for (size_t i = 0; i < crts->len; i++) {
+            radius = fmaxf(radius, crts->perception[i]);
+        }
+        qtree_find_all_pairs(world->qtree, radius, crts->len, _world_crt_index, NULL, world->pairs);
+    }
+
+    // 3. far field
+
+    if (world->theta > 0 && world->backend == WORLD_BACKEND_QTREE) {
+        if (!world->mass) {
+            world->mass = qmass_create(CRT_TYPE_MAX);
+            EXIT_IF(world->mass == NULL, "failed to allocate memory for world mass aggregates");
+        }
+        qmass_build(world->mass, world->qtree, _world_crt_mass, _world_crt_type, world);
+    }
+
     // TODO
     return 0;
 }
 
-static void _draw_qtree_asc(QuadNode *node) {
-    if (!node) {
-        return;
-    }
+static int _draw_qtree_asc(QuadNode *node, QuadBounds bounds, void *ctx) {
+    (void)node; // visitor signature
+    (void)ctx;
 
     glLineWidth(1.0);
     glColor4f(0.15, 0.15, 0.15, 1.0);
 
     // right
     glBegin(GL_LINES);
-    glVertex2f(node->self_se.x, node->self_nw.y);
-    glVertex2f(node->self_se.x, node->self_se.y);
+    glVertex2f(bounds.se.x, bounds.nw.y);
+    glVertex2f(bounds.se.x, bounds.se.y);
     glEnd();
 
     //  bottom
     glBegin(GL_LINES);
-    glVertex2f(node->self_nw.x, node->self_se.y);
-    glVertex2f(node->self_se.x, node->self_se.y);
+    glVertex2f(bounds.nw.x, bounds.se.y);
+    glVertex2f(bounds.se.x, bounds.se.y);
+    glEnd();
+    return QUAD_VISIT_CONTINUE;
+}
+
+static void _draw_sgrid(SpatialGrid *grid) {
+    glLineWidth(1.0);
+    glColor4f(0.15, 0.15, 0.15, 1.0);
+
+    glBegin(GL_LINES);
+    for (uint32_t x = 1; x < grid->cols; x++) {
+        glVertex2f(grid->nw.x + x * grid->cell, grid->nw.y);
+        glVertex2f(grid->nw.x + x * grid->cell, grid->se.y);
+    }
+    for (uint32_t y = 1; y < grid->rows; y++) {
+        glVertex2f(grid->nw.x, grid->nw.y + y * grid->cell);
+        glVertex2f(grid->se.x, grid->nw.y + y * grid->cell);
+    }
     glEnd();
 }
-static void _draw_qtree_desc(QuadNode *node) {}
+
+/**
+ * Main loop: ends the step, after every creature was updated (crt_update()): their next state becomes current.
+ * The spatial indices follow with the next world_update().
+ */
+void world_swap(World *world) {
+    if (!world) {
+        return;
+    }
+    crt_store_swap(world->crts);
+}
 
 /**
  * Main loop: draw
@@ -157,13 +420,116 @@ int world_draw(App *app, World *world) {
     }
 
     // draw quads
-    if (world->qtree) {
-        qnode_walk(world->qtree->root, _draw_qtree_asc, _draw_qtree_desc);
+    if (world->qtree && world->backend == WORLD_BACKEND_QTREE) {
+        qtree_walk(world->qtree, NULL, _draw_qtree_asc, NULL);
+    }
+
+    // draw grid cells
+    if (world->sgrid && world->backend == WORLD_BACKEND_GRID) {
+        _draw_sgrid(world->sgrid);
     }
 
     return res;
 }
 
+////
+// Topology
+////
+
+/**
+ * Maps a position into the world (nw inclusive, se exclusive) if the world is toroidal, returns it unchanged otherwise
+ */
+Vec2 world_wrap(World *world, Vec2 pos) {
+    if (!world || !world->wrap) {
+        return pos;
+    }
+
+    float width = world->se.x - world->nw.x;
+    float height = world->se.y - world->nw.y;
+
+    pos.x = world->nw.x + fmodf(pos.x - world->nw.x, width);
+    pos.y = world->nw.y + fmodf(pos.y - world->nw.y, height);
+    if (pos.x < world->nw.x) {
+        pos.x += width;
+    }
+    if (pos.y < world->nw.y) {
+        pos.y += height;
+    }
+
+    // rounding of tiny negative remainders
+    if (pos.x >= world->se.x) {
+        pos.x = world->nw.x;
+    }
+    if (pos.y >= world->se.y) {
+        pos.y = world->nw.y;
+    }
+    return pos;
+}
+
+/**
+ * a - b, the shortest way around if the world is toroidal
+ */
+Vec2 world_delta(World *world, Vec2 a, Vec2 b) {
+    Vec2 delta = vec2_sub(a, b);
+    if (!world || !world->wrap) {
+        return delta;
+    }
+
+    float width = world->se.x - world->nw.x;
+    float height = world->se.y - world->nw.y;
+
+    if (delta.x > width / 2) {
+        delta.x -= width;
+    } else if (delta.x < -width / 2) {
+        delta.x += width;
+    }
+    if (delta.y > height / 2) {
+        delta.y -= height;
+    } else if (delta.y < -height / 2) {
+        delta.y += height;
+    }
+    return delta;
+}
+
+////
+// Queries
+////
+
+/**
+ * Appends the creatures whose body (crt_body()) overlaps the area nw-se (inclusive).
+ * The body index is independent of the neighbour backend and is only kept up to date while it is queried:
+ * creatures which moved or grew since the last query are moved within it first.
+ */
+QuadList *world_find_bodies(World *world, Vec2 nw, Vec2 se, QuadList *list) {
+    if (!world || !list) {
+        return NULL;
+    }
+
+    if (!world->bodies) {
+        world->bodies = ltree_create(world->nw, world->se);
+        EXIT_IF(world->bodies == NULL, "failed to allocate memory for world body index");
+    }
+
+    CrtStore *crts = world->crts;
+    int res;
+    for (size_t i = 0; i < crts->len; i++) {
+        if (world->bodies_size[i] == crts->size[i] && vec2_equals(world->bodies_pos[i], crts->pos[i])) {
+            continue; // unchanged
+        }
+
+        if (world->bodies_size[i] < 0) {
+            res = ltree_insert(world->bodies, CRT_DATA(i), crt_body(crts->pos[i], crts->size[i]));
+        } else {
+            res = ltree_move(world->bodies, CRT_DATA(i), crt_body(world->bodies_pos[i], world->bodies_size[i]), crt_body(crts->pos[i], crts->size[i]));
+        }
+
+        world->bodies_pos[i] = crts->pos[i];
+        world->bodies_size[i] = (res == QUAD_FAILED) ? -1 : crts->size[i];
+    }
+
+    return ltree_find_overlapping(world->bodies, nw, se, list);
+}
+
 ////
 // Rules
 ////
@@ -219,8 +585,23 @@ Rule *rules_get(RuleSet *rules, int left, int right) {
     return NULL;
 }
 
+/**
+ * Mask of the right hand types (0..len - 1) which affect left: a missing rule counts as the default attraction, rules of 0 do not affect it.
+ */
+unsigned int rules_mask(RuleSet *rules, int left, int len) {
+    unsigned int mask = 0;
+    Rule *rule;
+    for (int right = 0; right < len; right++) {
+        rule = rules_get(rules, left, right);
+        if (!rule || rule->val != 0) {
+            mask |= 1u << right;
+        }
+    }
+    return mask;
+}
+
 void rules_destroy(RuleSet *rules) {
-    if (rules) {
+    if (!rules) {
         return;
     }
     for (size_t i = 0;i < rules->len; i++) {
@@ -2,23 +2,71 @@
 #define __WORLD_H__
 
 #include "app.h"
+#include "force.h"
 #include "vec2.h"
 
-#define WORLD_POP_MAX 1000
 #define GRAVITY 0.01 // 0.000000000066742f // Gravitational constant
 
 // forward declarations
 
-typedef struct Creature Creature;
+typedef struct CrtStore CrtStore;
+typedef struct CrtNeighbours CrtNeighbours;
 typedef struct QuadTree QuadTree;
+typedef struct LinearQuadTree LinearQuadTree;
+typedef struct SpatialGrid SpatialGrid;
+typedef struct LooseQuadTree LooseQuadTree;
+typedef struct QuadPairs QuadPairs;
+typedef struct QuadList QuadList;
+typedef struct QuadMass QuadMass;
 typedef struct RuleSet RuleSet;
+typedef struct ThreadPool ThreadPool;
+
+typedef enum WorldIndexMode {
+    WORLD_INDEX_REBUILD,     // rebuild the quad tree every frame
+    WORLD_INDEX_INCREMENTAL, // move creatures within the quad tree
+} WorldIndexMode;
+
+typedef enum WorldIndexBackend {
+    WORLD_BACKEND_QTREE,  // pointer based quad tree (qtree.h)
+    WORLD_BACKEND_LINEAR, // morton sorted linear quad tree (lqtree.h)
+    WORLD_BACKEND_GRID,   // uniform grid, cell size = perception (sgrid.h)
+    WORLD_BACKEND_MAX
+} WorldIndexBackend;
+extern const char world_backend_names[][16];
+
+#ifndef WORLD_BACKEND_DEFAULT
+#define WORLD_BACKEND_DEFAULT WORLD_BACKEND_QTREE
+#endif
 
 typedef struct World {
     Vec2 nw; // north-west corner of the world (min)
     Vec2 se; // south-east corner of the world (max)
-    size_t len;
-    Creature *population[WORLD_POP_MAX];
+    int wrap; // toroidal topology: positions wrap around the edges, neighbour queries across them (see world_wrap())
+    CrtStore *crts;    // population: creatures 0..crts->len-1, structure of arrays (crt.h)
+    size_t max;        // capacity of the per creature index arrays below, see world_reserve()
+    void **index_data; // CRT_DATA(i) of the population, input of the qtree bulk build
+    WorldIndexBackend backend;
     QuadTree *qtree;
+    LinearQuadTree *lqtree;
+    SpatialGrid *sgrid;
+    float sgrid_perception;    // grid only: largest perception the grid cells were sized for (0: none, one cell)
+    WorldIndexMode index_mode; // qtree only
+    size_t knn;                // qtree only: creatures only consider their k nearest neighbours (0: all within perception), not wrap-aware
+    Vec2 *indexed;               // positions the population is currently indexed with in qtree
+    unsigned int threads;        // worker threads of the qtree bulk build and of the creature updates (crt_update_all())
+    ThreadPool *pool;            // creature update workers (threads > 1), created on demand
+    CrtNeighbours **neighbours;  // neighbour buffer per worker, created on demand
+    unsigned int workers;        // neighbour buffers
+    int all_pairs;               // qtree only (no knn): find all neighbour pairs once per frame
+    QuadPairs *pairs;            // neighbour table of the current frame, rows are population indices
+    float theta;                 // qtree only: Barnes-Hut opening angle of the far field (0: off, neighbours only)
+    QuadMass *mass;              // mass aggregates of the current frame (theta > 0)
+    ForceLevel simd;             // neighbour force kernel (force.h), force_detect() by default
+
+    LooseQuadTree *bodies;            // creature bodies (crt_body()), synced on demand by world_find_bodies()
+    Vec2 *bodies_pos;                 // position and size the population is currently indexed with in bodies
+    float *bodies_size;               // < 0: not indexed
+
     RuleSet *rules;
 } World;
 
@@ -27,9 +75,15 @@ typedef struct World {
 
 // Live cycle
 
-World *world_create(size_t len, Vec2 nw, Vec2 se);
+World *world_create(size_t max, Vec2 nw, Vec2 se);
 void world_destroy(World *world);
 
+// Population
+
+int world_reserve(World *world, size_t max);
+void world_unindex(World *world, size_t i);
+void world_reindex(World *world, size_t from, size_t to);
+
 // Debug
 
 void world_print(FILE *fp, World *world);
@@ -37,8 +91,18 @@ void world_print(FILE *fp, World *world);
 // Main loop
 
 int world_update(App *app, World *world);
+void world_swap(World *world);
 int world_draw(App *app, World *world);
 
+// Topology
+
+Vec2 world_wrap(World *world, Vec2 pos);
+Vec2 world_delta(World *world, Vec2 a, Vec2 b);
+
+// Queries
+
+QuadList *world_find_bodies(World *world, Vec2 nw, Vec2 se, QuadList *list);
+
 // Rules
 
 typedef struct Rule {
@@ -55,5 +119,6 @@ typedef struct RuleSet {
 RuleSet *rules_create();
 Rule *rules_set(RuleSet *rules, int left, int right, float val);
 Rule *rules_get(RuleSet *rules, int left, int right);
+unsigned int rules_mask(RuleSet *rules, int left, int len);
 void rules_destroy(RuleSet *rules);
 #endif
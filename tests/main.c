@@ -19,6 +19,11 @@ enum Sections {
     TEST_QTREE,
     TEST_QNODE_LIST,
     TEST_QTREE_AREA,
+    TEST_LQTREE,
+    TEST_SGRID,
+    TEST_LTREE,
+    TEST_POOL,
+    TEST_FORCE,
     TEST_MAX
 };
 
@@ -29,6 +34,11 @@ char sections[][256] = {
     "TEST_QTREE",
     "TEST_QNODE_LIST",
     "TEST_QTREE_AREA",
+    "TEST_LQTREE",
+    "TEST_SGRID",
+    "TEST_LTREE",
+    "TEST_POOL",
+    "TEST_FORCE",
     "TEST_MAX"
 };
 
@@ -155,6 +165,36 @@ int main(int argc, char **argv) {
             test_qtree_area(argc, argv);
         }
 
+        if (section == TEST_LQTREE || section == TEST_MAX) {
+            // test.lqtree.c
+            SECTION(sections[TEST_LQTREE]);
+            test_lqtree(argc, argv);
+        }
+
+        if (section == TEST_SGRID || section == TEST_MAX) {
+            // test.sgrid.c
+            SECTION(sections[TEST_SGRID]);
+            test_sgrid(argc, argv);
+        }
+
+        if (section == TEST_LTREE || section == TEST_MAX) {
+            // test.ltree.c
+            SECTION(sections[TEST_LTREE]);
+            test_ltree(argc, argv);
+        }
+
+        if (section == TEST_POOL || section == TEST_MAX) {
+            // test.pool.c
+            SECTION(sections[TEST_POOL]);
+            test_pool(argc, argv);
+        }
+
+        if (section == TEST_FORCE || section == TEST_MAX) {
+            // test.force.c
+            SECTION(sections[TEST_FORCE]);
+            test_force(argc, argv);
+        }
+
     }
 
     fprintf(stderr,
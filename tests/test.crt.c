@@ -7,66 +7,453 @@
 
 #include "test.h"
 #include "crt.h"
+#include "sgrid.h"
+#include "world.h"
 
 void test_crt(int argc, char **argv) {
 
-    GROUP("Creature creation");
+    GROUP("Creature storage");
 
     {
-        DESCRIBE("CRT_INIT()");
+        DESCRIBE("CRT_DATA(), CRT_INDEX()");
 
-        Creature c = CRT_INIT(123);
+        assert(CRT_DATA(0) != NULL);
+        assert(CRT_INDEX(CRT_DATA(0)) == 0);
+        assert(CRT_INDEX(CRT_DATA(123)) == 123);
 
-        // lazy tesing some props
-        assert(c.id == 123);
-        assert(c.pos.x == CRT_POS_NONE);
-        assert(c.targ.y == CRT_POS_NONE);
+        DONE();
+    }
+
+    {
+        DESCRIBE("crt_store_create(), crt_store_reserve()");
+
+        CrtStore *crts = crt_store_create(4);
+
+        assert(crts->len == 0);
+        assert(crts->max == 4);
+        assert(crts->slots_len == 0);
+        assert(crts->free == CRT_SLOT_NONE);
+
+        assert(crt_store_reserve(crts, 2) == 0);
+        assert(crts->max == 4);
+        assert(crt_store_reserve(crts, 100) == 0);
+        assert(crts->max == 100);
+        assert(crt_store_reserve(NULL, 100) == -1);
+
+        crt_store_destroy(crts);
+        crt_store_destroy(NULL);
 
         DONE();
     }
 
     {
-        DESCRIBE("crt_create()");
+        DESCRIBE("crt_store_spawn(), crt_store_index()");
+
+        CrtStore *crts = crt_store_create(1);
+        CrtHandle handles[100];
 
-        Creature *c = crt_create(1234);
+        // geometric growth
+        for (int i = 0; i < 100; i++) {
+            handles[i] = crt_store_spawn(crts);
+            assert(handles[i].slot == i);
+            assert(handles[i].gen == 1);
+        }
+        assert(crts->len == 100);
+        assert(crts->max == 128);
 
         // strict testing all props
-        assert(c->id == 1234);
-        assert(strlen(c->name) == 0);
-        assert(c->type == CRT_TYPE_NONE);
-        assert(c->status == CRT_STATUS_NONE);
-        assert(c->agility == 0.0);
-        assert(c->size == 0.0);
-        assert(c->mass == 0.0);
-        assert(c->pos.x == CRT_POS_NONE);
-        assert(c->pos.y == CRT_POS_NONE);
-        assert(c->targ.x == CRT_POS_NONE);
-        assert(c->targ.y == CRT_POS_NONE);
-
-        crt_destroy(c);
+        for (long i = 0; i < 100; i++) {
+            assert(crt_store_index(crts, handles[i]) == i);
+            assert(crts->info[i].handle.slot == handles[i].slot && crts->info[i].handle.gen == handles[i].gen);
+            assert(strlen(crts->info[i].name) == 0);
+            assert(crts->info[i].status == CRT_STATUS_NONE);
+            assert(crts->type[i] == CRT_TYPE_NONE);
+            assert(crts->agility[i] == 0.0);
+            assert(crts->size[i] == 0.0);
+            assert(crts->mass[i] == 0.0);
+            assert(crts->perception[i] == 0.0);
+            assert(crts->pos[i].x == CRT_POS_NONE);
+            assert(crts->pos[i].y == CRT_POS_NONE);
+            assert(crts->targ[i].x == CRT_POS_NONE);
+            assert(crts->targ[i].y == CRT_POS_NONE);
+        }
+
+        assert(crt_store_index(crts, CRT_HANDLE_NONE) == -1);
+        assert(crt_store_index(crts, (CrtHandle){0, 2}) == -1);
+        assert(crt_store_index(crts, (CrtHandle){100, 1}) == -1);
+        assert(crt_store_index(NULL, handles[0]) == -1);
+
+        crt_store_destroy(crts);
 
         DONE();
     }
 
     {
-        DESCRIBE("crt_birth()");
+        DESCRIBE("crt_store_despawn()");
+
+        CrtStore *crts = crt_store_create(4);
+        CrtHandle h[4];
+        for (int i = 0; i < 4; i++) {
+            h[i] = crt_store_spawn(crts);
+            crts->mass[i] = i;
+        }
+
+        // the last creature fills the gap, its handle follows
+        assert(crt_store_despawn(crts, h[1]) == 0);
+        assert(crts->len == 3);
+        assert(crt_store_index(crts, h[1]) == -1);
+        assert(crt_store_index(crts, h[3]) == 1);
+        assert(crts->mass[1] == 3.f);
+        assert(crts->info[1].handle.slot == h[3].slot);
+        assert(crt_store_index(crts, h[0]) == 0);
+        assert(crt_store_index(crts, h[2]) == 2);
 
-        Creature *c = crt_birth(12345, "c12345", CRT_TYPE_HERBIVORE, (Vec2){1.0, 2.0});
+        // stale handles
+        assert(crt_store_despawn(crts, h[1]) == 1);
+        assert(crt_store_despawn(NULL, h[0]) == 1);
+
+        // removing the last creature
+        assert(crt_store_despawn(crts, h[2]) == 0);
+        assert(crts->len == 2);
+        assert(crt_store_index(crts, h[3]) == 1);
+
+        // slots are reused (last freed first) under the next generation
+        CrtHandle r = crt_store_spawn(crts);
+        assert(r.slot == h[2].slot && r.gen == 2);
+        assert(crt_store_index(crts, r) == 2);
+        assert(crt_store_index(crts, h[2]) == -1);
+        r = crt_store_spawn(crts);
+        assert(r.slot == h[1].slot && r.gen == 2);
+        r = crt_store_spawn(crts);
+        assert(r.slot == 4 && r.gen == 1);
+        assert(crts->len == 5);
+        assert(crts->slots_len == 5);
+
+        crt_store_destroy(crts);
+
+        DONE();
+    }
+
+    {
+        DESCRIBE("crt_birth(), crt_death()");
+
+        World *world = world_create(0, (Vec2){0.f, 0.f}, (Vec2){800.f, 600.f});
+        CrtStore *crts = world->crts;
+
+        CrtHandle h = crt_birth(world, "c0", CRT_TYPE_HERBIVORE, (Vec2){1.0, 2.0});
+        assert(h.gen);
 
         // strict testing all props
-        assert(c->id == 12345);
-        assert(strncmp(c->name, "c12345", CRT_NAME_LEN) == 0);
-        assert(c->type == CRT_TYPE_HERBIVORE);
-        assert(c->status == CRT_STATUS_ALIVE);
-        assert(c->agility == CRT_MIN_AGILITY);
-        assert(c->mass == CRT_MIN_MASS);
-        assert(c->size == CRT_MIN_SIZE);
-        assert(c->pos.x == 1.0);
-        assert(c->pos.y == 2.0);
-        assert(c->targ.x == 1.0);
-        assert(c->targ.y == 2.0);
-
-        crt_destroy(c);
+        assert(crts->len == 1);
+        assert(strncmp(crts->info[0].name, "c0", CRT_NAME_LEN) == 0);
+        assert(crts->info[0].status == CRT_STATUS_ALIVE);
+        assert(crts->type[0] == CRT_TYPE_HERBIVORE);
+        assert(crts->agility[0] == CRT_MIN_AGILITY);
+        assert(crts->mass[0] == CRT_MIN_MASS);
+        assert(crts->size[0] == CRT_MIN_SIZE);
+        assert(crts->perception[0] == CRT_MIN_PERCEPTION);
+        assert(crts->pos[0].x == 1.0);
+        assert(crts->pos[0].y == 2.0);
+        assert(crts->targ[0].x == 1.0);
+        assert(crts->targ[0].y == 2.0);
+
+        // the world's index arrays grow with the population
+        for (int i = 1; i < 2000; i++) {
+            assert(crt_birth(world, "c", CRT_TYPE_CARNIVORE, (Vec2){i % 800, i % 600}).gen);
+        }
+        assert(crts->len == 2000);
+        assert(world->max >= crts->max);
+
+        assert(crt_death(world, h) == 0);
+        assert(crt_death(world, h) == 1);
+        assert(crts->len == 1999);
+        assert(crts->type[0] == CRT_TYPE_CARNIVORE);
+
+        world_destroy(world);
+
+        DONE();
+    }
+
+    {
+        DESCRIBE("crt_death() keeps the incremental indices");
+
+        App app = {0};
+        World *world = world_create(16, (Vec2){0.f, 0.f}, (Vec2){800.f, 600.f});
+        CrtStore *crts = world->crts;
+        CrtHandle handles[200];
+        QuadList *list = qlist_create(8);
+
+        world->index_mode = WORLD_INDEX_INCREMENTAL;
+        for (int i = 0; i < 200; i++) {
+            handles[i] = crt_birth(world, "c", 1 + i % 2, (Vec2){(i * 37) % 800, (i * 53) % 600});
+        }
+        world_update(&app, world);
+        world_find_bodies(world, world->nw, world->se, list);
+
+        // every third, then births into the freed slots and a move
+        for (int i = 0; i < 200; i += 3) {
+            assert(crt_death(world, handles[i]) == 0);
+        }
+        for (int i = 0; i < 10; i++) {
+            crt_birth(world, "n", CRT_TYPE_HERBIVORE, (Vec2){i * 10.f, 5.f});
+        }
+        crts->pos[0] = (Vec2){400.f, 300.f};
+        world_update(&app, world);
+
+        assert(crts->len == 200 - 67 + 10);
+        assert(world->qtree->length == crts->len);
+
+        for (size_t i = 0; i < crts->len; i++) {
+            qlist_reset(list);
+            qtree_find_in_radius(world->qtree, crts->pos[i], .5f, list);
+            int found = 0;
+            for (size_t n = 0; n < list->len; n++) {
+                found += (CRT_INDEX(list->items[n]->data) == i);
+            }
+            assert(found == 1);
+        }
+
+        // bodies crossing the world's edge are not indexed
+        qlist_reset(list);
+        world_find_bodies(world, world->nw, world->se, list);
+        size_t bodies = 0;
+        for (size_t i = 0; i < crts->len; i++) {
+            bodies += (world->bodies_size[i] >= 0);
+        }
+        assert(bodies > crts->len / 2);
+        assert(list->len == bodies);
+        for (size_t n = 0; n < list->len; n++) {
+            size_t i = CRT_INDEX(list->items[n]->data);
+            assert(i < crts->len);
+            assert(vec2_equals(world->bodies_pos[i], crts->pos[i]));
+        }
+
+        qlist_destroy(list);
+        world_destroy(world);
+
+        DONE();
+    }
+
+    {
+        DESCRIBE("world_update() sizes the grid cells by the largest perception");
+
+        App app = {0};
+        World *world = world_create(0, (Vec2){0.f, 0.f}, (Vec2){800.f, 600.f});
+        world->backend = WORLD_BACKEND_GRID;
+
+        // nobody yet: a single cell
+        world_update(&app, world);
+        assert(world->sgrid != NULL);
+        assert(world->sgrid->cell == 800.f);
+
+        crt_birth(world, "c0", CRT_TYPE_HERBIVORE, (Vec2){100.f, 100.f});
+        world->crts->perception[0] = 60.f;
+        world_update(&app, world);
+        assert(world->sgrid->cell == 60.f);
+
+        // smaller perceptions keep the cells
+        crt_birth(world, "c1", CRT_TYPE_HERBIVORE, (Vec2){200.f, 200.f});
+        world->crts->perception[1] = 20.f;
+        world_update(&app, world);
+        assert(world->sgrid->cell == 60.f);
+
+        // a larger one grows them
+        world->crts->perception[1] = 150.f;
+        world_update(&app, world);
+        assert(world->sgrid->cell == 150.f);
+        assert(world->sgrid->length == 2);
+
+        world_destroy(world);
+
+        DONE();
+    }
+
+    GROUP("Neighbours");
+
+    {
+        DESCRIBE("crt_neighbours_append(), crt_neighbours_reset()");
+
+        World *world = world_create(0, (Vec2){0.f, 0.f}, (Vec2){800.f, 600.f});
+        CrtNeighbours *neighbours = crt_neighbours_create(1);
+        for (int i = 0; i < 7; i++) {
+            crt_birth(world, "c", CRT_TYPE_HERBIVORE, (Vec2){0.0, 0.0});
+        }
+        crt_birth(world, "c7", CRT_TYPE_CARNIVORE, (Vec2){3.0, 4.0});
+
+        assert(neighbours->len == 0);
+        assert(neighbours->max == 1);
+        assert(neighbours->list != NULL);
+
+        // geometric growth
+        for (int i = 0; i < 9; i++) {
+            assert(crt_neighbours_append(neighbours, world->crts, 7, (float) i) == 0);
+        }
+        assert(neighbours->len == 9);
+        assert(neighbours->max == 16);
+        assert(crt_neighbours_append(neighbours, NULL, 7, 0.f) == -1);
+        assert(crt_neighbours_append(neighbours, world->crts, world->crts->len, 0.f) == -1);
+
+        // copies
+        world->crts->pos[7] = (Vec2){5.0, 6.0};
+        assert(neighbours->index[8] == 7);
+        assert(neighbours->type[8] == CRT_TYPE_CARNIVORE);
+        assert(neighbours->mass[8] == CRT_MIN_MASS);
+        assert(neighbours->x[8] == 3.0 && neighbours->y[8] == 4.0);
+        assert(neighbours->dist2[8] == 8.f);
+
+        // keeps its capacity
+        crt_neighbours_reset(neighbours);
+        assert(neighbours->len == 0);
+        assert(neighbours->max == 16);
+
+        crt_neighbours_destroy(neighbours);
+        world_destroy(world);
+
+        DONE();
+    }
+
+    GROUP("World topology");
+
+    {
+        DESCRIBE("world_wrap(), world_delta()");
+
+        World *world = world_create(0, (Vec2){0.f, 0.f}, (Vec2){800.f, 600.f});
+        Vec2 pos, delta;
+
+        // bounded: unchanged
+        pos = world_wrap(world, (Vec2){-10.f, 610.f});
+        assert(pos.x == -10.f && pos.y == 610.f);
+        delta = world_delta(world, (Vec2){790.f, 5.f}, (Vec2){10.f, 595.f});
+        assert(delta.x == 780.f && delta.y == -590.f);
+
+        world->wrap = 1;
+
+        pos = world_wrap(world, (Vec2){-10.f, 610.f});
+        assert(pos.x == 790.f && pos.y == 10.f);
+        pos = world_wrap(world, (Vec2){800.f, 0.f}); // se is exclusive
+        assert(pos.x == 0.f && pos.y == 0.f);
+        pos = world_wrap(world, (Vec2){-2410.f, 1250.f});
+        assert(pos.x == 790.f && pos.y == 50.f);
+        pos = world_wrap(world, (Vec2){400.f, 300.f});
+        assert(pos.x == 400.f && pos.y == 300.f);
+
+        // the short way around
+        delta = world_delta(world, (Vec2){790.f, 5.f}, (Vec2){10.f, 595.f});
+        assert(delta.x == -20.f && delta.y == 10.f);
+        delta = world_delta(world, (Vec2){10.f, 595.f}, (Vec2){790.f, 5.f});
+        assert(delta.x == 20.f && delta.y == -10.f);
+        delta = world_delta(world, (Vec2){500.f, 200.f}, (Vec2){300.f, 100.f});
+        assert(delta.x == 200.f && delta.y == 100.f);
+
+        world_destroy(world);
+
+        DONE();
+    }
+
+    GROUP("Step");
+
+    {
+        DESCRIBE("crt_update() does not depend on the update order, world_swap()");
+
+        App app = {0};
+        World *world = world_create(0, (Vec2){0.f, 0.f}, (Vec2){800.f, 600.f});
+        CrtStore *crts = world->crts;
+        CrtNeighbours *neighbours = crt_neighbours_create(16);
+        size_t len = 300;
+
+        world->wrap = 1;
+        rules_set(world->rules, CRT_TYPE_HERBIVORE, CRT_TYPE_CARNIVORE, -0.5f);
+        rules_set(world->rules, CRT_TYPE_CARNIVORE, CRT_TYPE_HERBIVORE, 1.5f);
+        for (size_t i = 0; i < len; i++) {
+            crt_birth(world, "c", 1 + i % 2, (Vec2){(i * 37) % 800, (i * 53) % 600});
+            crts->mass[i] = 1.f + i % 5;
+            crts->agility[i] = .1f;
+            crts->perception[i] = (i % 3) ? 60.f : 0.f; // some only move towards their target
+        }
+
+        Vec2 pos[300], targ[300];
+        unsigned int seed[300];
+
+        // streamed (qtree), listed (knn), far field
+        for (int mode = 0; mode < 3; mode++) {
+            world->knn = (mode == 1) ? 4 : 0;
+            world->theta = (mode == 2) ? .5f : 0.f;
+            world_update(&app, world);
+            memcpy(seed, crts->seed, len * sizeof(unsigned int));
+
+            for (size_t i = 0; i < len; i++) {
+                crt_update(i, &app, world, (mode == 1) ? crt_find_neighbours(i, &app, world, neighbours) : NULL);
+            }
+            memcpy(pos, crts->pos_next, len * sizeof(Vec2));
+            memcpy(targ, crts->targ_next, len * sizeof(Vec2));
+
+            memcpy(crts->seed, seed, len * sizeof(unsigned int));
+            for (size_t i = len; i-- > 0;) {
+                crt_update(i, &app, world, (mode == 1) ? crt_find_neighbours(i, &app, world, neighbours) : NULL);
+            }
+            assert(memcmp(pos, crts->pos_next, len * sizeof(Vec2)) == 0);
+            assert(memcmp(targ, crts->targ_next, len * sizeof(Vec2)) == 0);
+
+            // something moved
+            size_t moved = 0;
+            for (size_t i = 0; i < len; i++) {
+                moved += !vec2_equals(crts->pos[i], crts->pos_next[i]);
+            }
+            assert(moved > len / 2);
+
+            Vec2 *next = crts->pos_next;
+            world_swap(world);
+            assert(crts->pos == next);
+            assert(memcmp(pos, crts->pos, len * sizeof(Vec2)) == 0);
+            assert(memcmp(targ, crts->targ, len * sizeof(Vec2)) == 0);
+        }
+
+        crt_neighbours_destroy(neighbours);
+        world_destroy(world);
+
+        DONE();
+    } {
+        DESCRIBE("crt_update_all() does not depend on the number of threads");
+
+        App app = {0};
+        World *world = world_create(0, (Vec2){0.f, 0.f}, (Vec2){800.f, 600.f});
+        CrtStore *crts = world->crts;
+        size_t len = 500;
+
+        rules_set(world->rules, CRT_TYPE_HERBIVORE, CRT_TYPE_CARNIVORE, -0.5f);
+        rules_set(world->rules, CRT_TYPE_CARNIVORE, CRT_TYPE_HERBIVORE, 1.5f);
+        for (size_t i = 0; i < len; i++) {
+            crt_birth(world, "c", 1 + i % 2, (Vec2){(i * 37) % 800, (i * 53) % 600});
+            crts->mass[i] = 1.f + i % 5;
+            crts->agility[i] = .1f;
+            crts->perception[i] = 60.f;
+        }
+
+        Vec2 pos[500], targ[500];
+        unsigned int seed[500];
+
+        // streamed (qtree), listed (knn)
+        for (int mode = 0; mode < 2; mode++) {
+            world->knn = (mode == 1) ? 4 : 0;
+            world_update(&app, world);
+            memcpy(seed, crts->seed, len * sizeof(unsigned int));
+
+            world->threads = 1;
+            assert(crt_update_all(&app, world) == 0);
+            memcpy(pos, crts->pos_next, len * sizeof(Vec2));
+            memcpy(targ, crts->targ_next, len * sizeof(Vec2));
+
+            memcpy(crts->seed, seed, len * sizeof(unsigned int));
+            world->threads = 4;
+            assert(crt_update_all(&app, world) == 0);
+            assert(world->pool != NULL);
+            assert(memcmp(pos, crts->pos_next, len * sizeof(Vec2)) == 0);
+            assert(memcmp(targ, crts->targ_next, len * sizeof(Vec2)) == 0);
+
+            world_swap(world);
+        }
+
+        world_destroy(world);
 
         DONE();
     }
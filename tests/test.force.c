@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <assert.h>
+
+#include "test.h"
+#include "force.h"
+
+#define TEST_BATCH 100
+
+typedef struct TestBatch {
+    float x[TEST_BATCH];
+    float y[TEST_BATCH];
+    float mass[TEST_BATCH];
+    float dist2[TEST_BATCH];
+    int class[TEST_BATCH];
+} TestBatch;
+
+static float _rand_f(float min, float max) {
+    return min + (max - min) * ((float) rand() / (float) RAND_MAX);
+}
+
+/**
+ * Random neighbours around the body: in and out of range, across the wrapped edges, the body itself,
+ * with and without distances
+ */
+static void _fill(TestBatch *batch, ForceBody *body) {
+    for (int n = 0; n < TEST_BATCH; n++) {
+        batch->x[n] = _rand_f(0.f, 800.f);
+        batch->y[n] = _rand_f(0.f, 600.f);
+        batch->mass[n] = _rand_f(1.f, 5.f);
+        batch->class[n] = rand() % FORCE_CLASSES;
+        batch->dist2[n] = -1.f;
+        if (n % 7 == 0) {
+            batch->x[n] = body->pos.x;
+            batch->y[n] = body->pos.y;
+        }
+        if (n % 3 == 0 && body->wrap.x == 0) {
+            float dx = body->pos.x - batch->x[n];
+            float dy = body->pos.y - batch->y[n];
+            batch->dist2[n] = dx * dx + dy * dy;
+        }
+    }
+}
+
+/**
+ * Sum of |force * delta| (per component) of the scalar kernel, the scale of its rounding error
+ */
+static Vec2 _magnitude(ForceBody *body, TestBatch *batch, size_t len) {
+    Vec2 sum = {0.f, 0.f};
+    Vec2 accl;
+    for (size_t n = 0; n < len; n++) {
+        accl = (Vec2){0.f, 0.f};
+        ForceBatch one = {1, &batch->x[n], &batch->y[n], &batch->mass[n], &batch->dist2[n], &batch->class[n]};
+        force_sum(FORCE_SCALAR, body, &one, &accl);
+        sum.x += fabsf(accl.x);
+        sum.y += fabsf(accl.y);
+    }
+    return sum;
+}
+
+void test_force(int argc, char **argv) {
+    {
+        DESCRIBE("force_sum() scalar");
+
+        ForceBody body = {.pos = {10.f, 10.f}, .mass = 2.f, .range2 = 100.f, .wrap = {0.f, 0.f}};
+        for (int c = 0; c < FORCE_CLASSES; c++) {
+            body.attraction[c] = 1.f;
+        }
+        body.attraction[1] = -0.5f;
+
+        float x[] = {13.f, 10.f, 10.f, 30.f, 795.f};
+        float y[] = {14.f, 10.f, 6.f, 10.f, 10.f};
+        float mass[] = {1.f, 1.f, 4.f, 1.f, 1.f};
+        float dist2[] = {-1.f, -1.f, 16.f, -1.f, -1.f};
+        int class[] = {0, 0, 1, 0, 0};
+        ForceBatch batch = {5, x, y, mass, dist2, class};
+        Vec2 accl = {0.f, 0.f};
+
+        // 0: 2 / 25 * (-3, -4), 1: itself, 2: -0.5 * 8 / 16 * (0, 4), 3: out of range, 4: out of range (no wrap)
+        assert(force_sum(FORCE_SCALAR, &body, &batch, &accl) == 2);
+        assert(fabsf(accl.x - (-0.24f)) < 1e-6f);
+        assert(fabsf(accl.y - (-0.32f - 1.f)) < 1e-6f);
+
+        // wrapped: 4 is 15 away across the edge
+        body.wrap = (Vec2){800.f, 600.f};
+        accl = (Vec2){0.f, 0.f};
+        assert(force_sum(FORCE_SCALAR, &body, &batch, &accl) == 2);
+        body.range2 = 300.f;
+        accl = (Vec2){0.f, 0.f};
+        assert(force_sum(FORCE_SCALAR, &body, &batch, &accl) == 3);
+        assert(fabsf(accl.x - (-0.24f + 2.f / 225.f * 15.f)) < 1e-6f);
+
+        // invalid
+        assert(force_sum(FORCE_SCALAR, NULL, &batch, &accl) == 0);
+        assert(force_sum(FORCE_SCALAR, &body, NULL, &accl) == 0);
+
+        DONE();
+    } {
+        DESCRIBE("force_sum() vector kernels match the scalar one");
+
+        ForceLevel detected = force_detect();
+        assert(detected < FORCE_LEVEL_MAX);
+        fprintf(stderr, "      force_detect(): %s\n", force_level_names[detected]);
+
+        TestBatch batch;
+        ForceBody body;
+        Vec2 scalar, accl, magnitude;
+        size_t count;
+
+        for (int round = 0; round < 200; round++) {
+            body.pos = (Vec2){_rand_f(0.f, 800.f), _rand_f(0.f, 600.f)};
+            body.mass = _rand_f(1.f, 5.f);
+            body.range2 = _rand_f(10.f, 300.f);
+            body.range2 *= body.range2;
+            body.wrap = (round % 2) ? (Vec2){800.f, 600.f} : (Vec2){0.f, 0.f};
+            for (int c = 0; c < FORCE_CLASSES; c++) {
+                body.attraction[c] = _rand_f(-2.f, 2.f);
+            }
+            _fill(&batch, &body);
+
+            // all tails of every lane width
+            for (size_t len = 0; len <= TEST_BATCH; len += (len < 40) ? 1 : 13) {
+                ForceBatch view = {len, batch.x, batch.y, batch.mass, batch.dist2, batch.class};
+                scalar = (Vec2){0.f, 0.f};
+                count = force_sum(FORCE_SCALAR, &body, &view, &scalar);
+                magnitude = _magnitude(&body, &batch, len);
+
+                for (ForceLevel level = FORCE_SSE2; level <= detected; level++) {
+                    accl = (Vec2){0.f, 0.f};
+                    assert(force_sum(level, &body, &view, &accl) == count);
+                    assert(fabsf(accl.x - scalar.x) <= 1e-5f * magnitude.x);
+                    assert(fabsf(accl.y - scalar.y) <= 1e-5f * magnitude.y);
+                }
+            }
+        }
+
+        DONE();
+    }
+}
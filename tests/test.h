@@ -21,5 +21,15 @@ void test_qtree(int argc, char **argv);
 void test_qnode_list(int argc, char **argv);
 // test.qtree_in_area.c
 void test_qtree_area(int argc, char **argv);
+// test.lqtree.c
+void test_lqtree(int argc, char **argv);
+// test.sgrid.c
+void test_sgrid(int argc, char **argv);
+// test.ltree.c
+void test_ltree(int argc, char **argv);
+// test.pool.c
+void test_pool(int argc, char **argv);
+// test.force.c
+void test_force(int argc, char **argv);
 
 #endif
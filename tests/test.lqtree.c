@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <assert.h>
+
+#include "test.h"
+#include "lqtree.h"
+#include "qtree.h"
+
+typedef struct TestItem {
+    int id;
+    Vec2 pos; // control data, will not be queried within lqtree.h
+} TestItem;
+
+static int _in_list(int id, QuadList *list) {
+    for (size_t i = 0; i < list->len; i++) {
+        if (list->items[i] && list->items[i]->data) {
+            TestItem *item = (TestItem*) list->items[i]->data;
+            if (item->id == id) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void test_morton() {
+    DESCRIBE("morton codes");
+
+    assert(lqtree_morton(0, 0) == 0);
+    assert(lqtree_morton(1, 0) == 1); // ne
+    assert(lqtree_morton(0, 1) == 2); // sw
+    assert(lqtree_morton(1, 1) == 3); // se
+    assert(lqtree_morton(2, 0) == 4);
+    assert(lqtree_morton(LQUAD_CELLS - 1, LQUAD_CELLS - 1) == 0xffffffff);
+
+    DONE();
+}
+
+static void test_insert_find() {
+    DESCRIBE("insert, build, find");
+    LinearQuadTree *tree = lqtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
+
+    TestItem itm1 = {111, {8.f, 2.f}};
+    TestItem itm2 = {222, {1.f, 1.f}};
+    TestItem itm3 = {333, {0.f, 0.f}}; // outside
+    TestItem itm4 = {444, {8.f, 2.f}}; // coincident
+
+    int res;
+    QuadItem *found;
+
+    {
+        res = lqtree_insert(tree, &itm1, itm1.pos);
+        assert(res == QUAD_INSERTED);
+        res = lqtree_insert(tree, &itm2, itm2.pos);
+        assert(res == QUAD_INSERTED);
+        res = lqtree_insert(tree, &itm3, itm3.pos);
+        assert(res == QUAD_FAILED);
+        res = lqtree_insert(tree, &itm4, itm4.pos);
+        assert(res == QUAD_INSERTED);
+
+        assert(tree->length == 3);
+        assert(!tree->sorted);
+
+        res = lqtree_build(tree);
+        assert(res == 0);
+        assert(tree->sorted);
+
+        // sorted by morton code
+        for (size_t i = 1; i < tree->length; i++) {
+            assert(tree->codes[i - 1] <= tree->codes[i]);
+        }
+    } {
+        found = lqtree_find(tree, (Vec2) {2.f, 2.f});
+        assert(found == NULL);
+
+        found = lqtree_find(tree, itm2.pos);
+        assert(found != NULL);
+        assert(found->data == &itm2);
+
+        found = lqtree_find(tree, itm1.pos);
+        assert(found != NULL);
+        assert(found->data == &itm1 || found->data == &itm4);
+    } {
+        // reset keeps capacity
+        size_t max = tree->max;
+        lqtree_reset(tree);
+        assert(tree->length == 0);
+        assert(tree->max == max);
+        assert(lqtree_find(tree, itm1.pos) == NULL);
+    }
+
+    lqtree_destroy(tree);
+    DONE();
+}
+
+static void test_find_in_area() {
+    DESCRIBE("area");
+    LinearQuadTree *tree = lqtree_create((Vec2){1.f, 1.f}, (Vec2) {10.f, 10.f});
+
+    float radius = 2.f;
+    Vec2 pos = (Vec2) {4.f, 4.f};
+
+    TestItem items[7] = {
+        {0, pos},
+        // inside
+        {1, {pos.x + (radius / 2.f), pos.y + (radius / 2.f)}},
+        {2, {pos.x + radius, pos.y + radius}},
+        {3, {pos.x - radius, pos.y - radius}},
+        // outside
+        {4, {1.f, 1.f}},
+        {5, {pos.x, pos.y + radius + 0.1}},
+        {6, {pos.x - radius - 0.1, pos.y}},
+    };
+
+    for (int i = 0; i < 7; i++) {
+        assert(lqtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    QuadList *list = qlist_create(1);
+    lqtree_find_in_area(tree, pos, radius, list);
+
+    assert(list->len == 4);
+    assert(_in_list(0, list));
+    assert(_in_list(1, list));
+    assert(_in_list(2, list));
+    assert(_in_list(3, list));
+
+    qlist_destroy(list);
+    lqtree_destroy(tree);
+    DONE();
+}
+
+static void test_same_as_qtree() {
+    DESCRIBE("same results as qtree");
+
+    Vec2 nw = {0.f, 0.f};
+    Vec2 se = {800.f, 600.f};
+    LinearQuadTree *ltree = lqtree_create(nw, se);
+    QuadTree *qtree = qtree_create(nw, se);
+    qtree_configure(qtree, QUAD_BUCKET_MAX, QUAD_DEPTH_MAX);
+
+    TestItem items[1000];
+    for (int i = 0; i < 1000; i++) {
+        // coarse positions: plenty of coincident points and points on node boundaries
+        items[i] = (TestItem) {i, {(float) (rand() % 200) * 4.f, (float) (rand() % 150) * 4.f}};
+        assert(lqtree_insert(ltree, &items[i], items[i].pos) == QUAD_INSERTED);
+        assert(qtree_insert(qtree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    QuadList *llist = qlist_create(5);
+    QuadList *qlist = qlist_create(5);
+    Vec2 pos;
+    float radius;
+
+    for (int k = 0; k < 200; k++) {
+        pos = (Vec2) {(float) (rand() % 220) * 4.f - 40.f, (float) (rand() % 170) * 4.f - 40.f};
+        radius = (float) (rand() % 40) * 4.f;
+
+        qlist_reset(llist);
+        qlist_reset(qlist);
+        lqtree_find_in_area(ltree, pos, radius, llist);
+        qtree_find_in_area(qtree, pos, radius, qlist);
+
+        assert(llist->len == qlist->len);
+        for (size_t i = 0; i < qlist->len; i++) {
+            assert(_in_list(((TestItem *) qlist->items[i]->data)->id, llist));
+        }
+
+        qlist_reset(llist);
+        qlist_reset(qlist);
+        lqtree_find_in_radius(ltree, pos, radius, llist);
+        qtree_find_in_radius(qtree, pos, radius, qlist);
+
+        assert(llist->len == qlist->len);
+        for (size_t i = 0; i < qlist->len; i++) {
+            assert(_in_list(((TestItem *) qlist->items[i]->data)->id, llist));
+        }
+    }
+
+    qlist_destroy(llist);
+    qlist_destroy(qlist);
+    lqtree_destroy(ltree);
+    qtree_destroy(qtree);
+    DONE();
+}
+
+void test_lqtree(int argc, char **argv) {
+    test_morton();
+    test_insert_find();
+    test_find_in_area();
+    test_same_as_qtree();
+}
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <assert.h>
+
+#include "test.h"
+#include "ltree.h"
+#include "qtree.h"
+
+typedef struct TestItem {
+    int id;
+    QuadBounds box; // control data, will not be queried within ltree.h
+} TestItem;
+
+static int _in_list(int id, QuadList *list) {
+    for (size_t i = 0; i < list->len; i++) {
+        if (list->items[i] && list->items[i]->data) {
+            TestItem *item = (TestItem*) list->items[i]->data;
+            if (item->id == id) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static QuadBounds _box(float x, float y, float hx, float hy) {
+    return (QuadBounds) {{x - hx, y - hy}, {x + hx, y + hy}};
+}
+
+static void test_create() {
+    DESCRIBE("create, configure");
+    LooseQuadTree *tree = ltree_create((Vec2) {0.f, 0.f}, (Vec2) {100.f, 100.f});
+    assert(tree != NULL);
+    assert(tree->looseness == LTREE_LOOSENESS);
+    assert(tree->max_depth == QUAD_DEPTH_MAX);
+    assert(tree->root->count == 0);
+
+    int res;
+    {
+        res = ltree_configure(tree, .5f, 4);
+        assert(res == -1);
+        res = ltree_configure(tree, 2.f, QUAD_DEPTH_LIMIT + 1);
+        assert(res == -1);
+        res = ltree_configure(tree, 1.5f, 4);
+        assert(res == 0);
+        assert(tree->looseness == 1.5f);
+        assert(tree->max_depth == 4);
+    }
+
+    {
+        // loose bounds: (k - 1) / 2 of the node size on each side
+        QuadBounds loose = ltree_loose_bounds(tree, (QuadBounds) {{0.f, 0.f}, {40.f, 20.f}});
+        assert(loose.nw.x == -10.f && loose.nw.y == -5.f);
+        assert(loose.se.x == 50.f && loose.se.y == 25.f);
+    }
+
+    ltree_destroy(tree);
+    DONE();
+}
+
+static void test_insert_depth() {
+    DESCRIBE("entities are stored by size");
+    LooseQuadTree *tree = ltree_create((Vec2) {0.f, 0.f}, (Vec2) {100.f, 100.f});
+    ltree_configure(tree, 2.f, 4);
+
+    TestItem large = {1, _box(50.f, 50.f, 40.f, 10.f)};  // > half of the root's children
+    TestItem medium = {2, _box(10.f, 10.f, 20.f, 20.f)}; // covered by the margin of depth 1 (25)
+    TestItem small = {3, _box(99.f, 99.f, 1.f, 1.f)};    // max depth
+    TestItem huge = {4, _box(50.f, 50.f, 80.f, 80.f)};   // exceeds the tree
+    TestItem outside = {5, _box(120.f, 50.f, 1.f, 1.f)};
+    TestItem inverted = {6, {{10.f, 10.f}, {5.f, 5.f}}};
+
+    int res;
+
+    res = ltree_insert(tree, &large, large.box);
+    assert(res == QUAD_INSERTED);
+    assert(tree->root->len == 1);
+    assert(tree->root->children == NULL);
+
+    res = ltree_insert(tree, &medium, medium.box);
+    assert(res == QUAD_INSERTED);
+    assert(tree->root->children != NULL);
+    assert(tree->root->children[QUAD_NW].len == 1);
+    assert(tree->root->children[QUAD_NW].children == NULL);
+
+    res = ltree_insert(tree, &small, small.box);
+    assert(res == QUAD_INSERTED);
+    LooseNode *node = tree->root;
+    for (int i = 0; i < 4; i++) {
+        node = &node->children[QUAD_SE];
+        assert(node->count == 1);
+    }
+    assert(node->depth == 4);
+    assert(node->len == 1);
+    assert(node->items[0].item.data == &small);
+    assert(node->items[0].item.pos.x == 99.f && node->items[0].item.pos.y == 99.f);
+
+    res = ltree_insert(tree, &huge, huge.box);
+    assert(res == QUAD_INSERTED);
+    assert(tree->root->len == 2);
+
+    res = ltree_insert(tree, &outside, outside.box);
+    assert(res == QUAD_FAILED);
+    res = ltree_insert(tree, &inverted, inverted.box);
+    assert(res == QUAD_FAILED);
+
+    assert(tree->length == 4);
+    assert(tree->root->count == 4);
+
+    ltree_destroy(tree);
+    DONE();
+}
+
+static void test_find_overlapping() {
+    DESCRIBE("overlap queries prune by loose bounds");
+    LooseQuadTree *tree = ltree_create((Vec2) {0.f, 0.f}, (Vec2) {100.f, 100.f});
+    QuadList *list = qlist_create(1);
+
+    TestItem large = {1, _box(20.f, 20.f, 30.f, 5.f)}; // reaches from (-10, 15) into the NE quadrant
+    TestItem small = {2, _box(70.f, 20.f, 1.f, 1.f)};
+
+    ltree_insert(tree, &large, large.box);
+    ltree_insert(tree, &small, small.box);
+
+    {
+        // a point query within the large box, but far from its center
+        ltree_find_overlapping(tree, (Vec2) {49.f, 20.f}, (Vec2) {49.f, 20.f}, list);
+        assert(list->len == 1);
+        assert(_in_list(1, list));
+        assert(list->dist2[0] == -1.f);
+    }
+
+    {
+        qlist_reset(list);
+        ltree_find_overlapping(tree, (Vec2) {45.f, 15.f}, (Vec2) {71.f, 19.f}, list);
+        assert(list->len == 2);
+        assert(_in_list(1, list));
+        assert(_in_list(2, list));
+    }
+
+    {
+        // touching edges overlap (inclusive)
+        qlist_reset(list);
+        ltree_find_overlapping(tree, (Vec2) {71.f, 21.f}, (Vec2) {80.f, 80.f}, list);
+        assert(list->len == 1);
+        assert(_in_list(2, list));
+    }
+
+    {
+        qlist_reset(list);
+        ltree_find_overlapping(tree, (Vec2) {0.f, 50.f}, (Vec2) {100.f, 100.f}, list);
+        assert(list->len == 0);
+    }
+
+    qlist_destroy(list);
+    ltree_destroy(tree);
+    DONE();
+}
+
+static void test_remove_move() {
+    DESCRIBE("remove, move, collapse");
+    LooseQuadTree *tree = ltree_create((Vec2) {0.f, 0.f}, (Vec2) {100.f, 100.f});
+    ltree_configure(tree, 2.f, 4);
+    QuadList *list = qlist_create(1);
+
+    TestItem itm1 = {1, _box(10.f, 10.f, 1.f, 1.f)};
+    TestItem itm2 = {2, _box(12.f, 12.f, 1.f, 1.f)};
+
+    int res;
+    QuadBounds box;
+
+    ltree_insert(tree, &itm1, itm1.box);
+    ltree_insert(tree, &itm2, itm2.box);
+    assert(tree->root->children != NULL);
+
+    {
+        // within the same node: updated in place
+        box = _box(10.5f, 10.5f, 1.f, 1.f);
+        LooseNode *children = tree->root->children;
+        res = ltree_move(tree, &itm1, itm1.box, box);
+        assert(res == QUAD_INSERTED);
+        assert(tree->root->children == children);
+        itm1.box = box;
+
+        ltree_find_overlapping(tree, (Vec2) {11.4f, 11.4f}, (Vec2) {11.4f, 11.4f}, list);
+        assert(list->len == 2);
+    }
+
+    {
+        // grows: stored at the root
+        box = _box(10.5f, 10.5f, 40.f, 40.f);
+        res = ltree_move(tree, &itm1, itm1.box, box);
+        assert(res == QUAD_INSERTED);
+        assert(tree->root->len == 1);
+        assert(tree->length == 2);
+        itm1.box = box;
+    }
+
+    {
+        // not found at old box: removal fails
+        res = ltree_remove(tree, &itm2, itm1.box);
+        assert(res == QUAD_FAILED);
+
+        res = ltree_remove(tree, &itm2, itm2.box);
+        assert(res == QUAD_REMOVED);
+        assert(tree->length == 1);
+        assert(tree->root->children == NULL); // collapsed
+    }
+
+    {
+        // moved outside: removed
+        res = ltree_move(tree, &itm1, itm1.box, _box(200.f, 200.f, 1.f, 1.f));
+        assert(res == QUAD_FAILED);
+        assert(tree->length == 0);
+        assert(tree->root->count == 0);
+    }
+
+    {
+        // not indexed: inserted
+        res = ltree_move(tree, &itm2, itm1.box, itm2.box);
+        assert(res == QUAD_INSERTED);
+        assert(tree->length == 1);
+
+        ltree_reset(tree);
+        assert(tree->length == 0);
+        assert(tree->root->children == NULL);
+    }
+
+    qlist_destroy(list);
+    ltree_destroy(tree);
+    DONE();
+}
+
+static void test_same_as_brute_force() {
+    DESCRIBE("random boxes and moves, compared to a linear scan");
+    LooseQuadTree *tree = ltree_create((Vec2) {0.f, 0.f}, (Vec2) {800.f, 600.f});
+    QuadList *list = qlist_create(16);
+
+    size_t len = 500;
+    TestItem *items = malloc(len * sizeof(TestItem));
+    QuadBounds box;
+    Vec2 nw, se;
+    size_t count;
+
+    for (size_t i = 0; i < len; i++) {
+        items[i].id = (int)i;
+        items[i].box = _box(rand() % 800, rand() % 600, (rand() % 1000) / 10.f, (rand() % 1000) / 10.f);
+        assert(ltree_insert(tree, &items[i], items[i].box) == QUAD_INSERTED);
+    }
+
+    for (int round = 0; round < 4; round++) {
+        for (size_t i = 0; i < len; i++) {
+            box = _box(rand() % 800, rand() % 600, (rand() % 200) / 10.f, (rand() % 200) / 10.f);
+            assert(ltree_move(tree, &items[i], items[i].box, box) == QUAD_INSERTED);
+            items[i].box = box;
+        }
+        assert(tree->length == len);
+
+        for (int q = 0; q < 50; q++) {
+            nw = (Vec2) {rand() % 800, rand() % 600};
+            se = (Vec2) {nw.x + rand() % 100, nw.y + rand() % 100};
+
+            qlist_reset(list);
+            ltree_find_overlapping(tree, nw, se, list);
+
+            count = 0;
+            for (size_t i = 0; i < len; i++) {
+                if (qbounds_overlaps_area(items[i].box, nw, se)) {
+                    assert(_in_list(items[i].id, list));
+                    count++;
+                }
+            }
+            assert(list->len == count);
+        }
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        assert(ltree_remove(tree, &items[i], items[i].box) == QUAD_REMOVED);
+    }
+    assert(tree->length == 0);
+    assert(tree->root->children == NULL);
+
+    free(items);
+    qlist_destroy(list);
+    ltree_destroy(tree);
+    DONE();
+}
+
+void test_ltree(int argc, char **argv) {
+    test_create();
+    test_insert_depth();
+    test_find_overlapping();
+    test_remove_move();
+    test_same_as_brute_force();
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "test.h"
+#include "pool.h"
+
+typedef struct TestLoop {
+    atomic_int *hits;
+    unsigned int threads;
+    atomic_int bad_worker;
+    int stall; // worker 0 sleeps on its first chunk, so the others have to steal its share
+} TestLoop;
+
+static void _test_range(size_t begin, size_t end, unsigned int worker, void *ctx) {
+    TestLoop *loop = ctx;
+    if (worker >= loop->threads) {
+        atomic_store(&loop->bad_worker, 1);
+    }
+    if (loop->stall && worker == 0 && begin == 0) {
+        nanosleep(&(struct timespec){0, 20 * 1000 * 1000}, NULL);
+    }
+    for (size_t i = begin; i < end; i++) {
+        atomic_fetch_add(&loop->hits[i], 1);
+    }
+}
+
+void test_pool(int argc, char **argv) {
+    {
+        DESCRIBE("pool_create(), pool_destroy()");
+
+        ThreadPool *pool = pool_create(4);
+        assert(pool != NULL);
+        assert(pool->threads == 4);
+        assert(pool->started == 4);
+        pool_destroy(pool);
+
+        // 0: the calling thread only
+        pool = pool_create(0);
+        assert(pool != NULL);
+        assert(pool->threads == 1);
+        assert(pool->started == 1);
+        pool_destroy(pool);
+
+        pool_destroy(NULL);
+
+        DONE();
+    } {
+        DESCRIBE("pool_for() runs every index once");
+
+        size_t n = 1000;
+        atomic_int hits[1000];
+        unsigned int threads[] = {1, 2, 4, 8};
+        size_t chunks[] = {0, 1, 7, 64, 1000, 5000};
+
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            ThreadPool *pool = pool_create(threads[t]);
+            TestLoop loop = {hits, threads[t], 0, 0};
+
+            for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+                // the same pool runs loops of different lengths
+                for (size_t len = n; len > 0; len /= 3) {
+                    for (size_t i = 0; i < n; i++) {
+                        atomic_init(&hits[i], 0);
+                    }
+                    assert(pool_for(pool, len, chunks[c], _test_range, &loop) == 0);
+                    for (size_t i = 0; i < n; i++) {
+                        assert(atomic_load(&hits[i]) == (i < len));
+                    }
+                }
+            }
+            assert(atomic_load(&loop.bad_worker) == 0);
+
+            // nothing to do
+            assert(pool_for(pool, 0, 16, _test_range, &loop) == 0);
+            // invalid
+            assert(pool_for(pool, n, 16, NULL, &loop) == -1);
+            assert(pool_for(NULL, n, 16, _test_range, &loop) == -1);
+
+            pool_destroy(pool);
+        }
+
+        DONE();
+    } {
+        DESCRIBE("pool_for() steals from a stalled worker");
+
+        size_t n = 1000;
+        atomic_int hits[1000];
+        for (size_t i = 0; i < n; i++) {
+            atomic_init(&hits[i], 0);
+        }
+
+        ThreadPool *pool = pool_create(4);
+        TestLoop loop = {hits, 4, 0, 1};
+
+        assert(pool_for(pool, n, 10, _test_range, &loop) == 0);
+        for (size_t i = 0; i < n; i++) {
+            assert(atomic_load(&hits[i]) == 1);
+        }
+        // worker 0 owns 25 chunks, the others are done long before it wakes up
+        assert(atomic_load(&pool->steals) > 0);
+
+        pool_destroy(pool);
+
+        DONE();
+    }
+}
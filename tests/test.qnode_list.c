@@ -17,17 +17,17 @@ void test_qnode_list(int argc, char **argv) {
         assert(list->len == 0);
         assert(list->max == sz);
         assert(list->grow == sz);
-        assert(list->nodes != NULL);
+        assert(list->items != NULL);
 
         qlist_destroy(list);
         DONE();
     } {
         DESCRIBE("qlist_append()");
 
-        QuadNode q1 = {
+        QuadItem q1 = {
             .pos={1.f, 1.f}
         };
-        QuadNode q2 = {
+        QuadItem q2 = {
             .pos={2.f, 2.f}
         };
 
@@ -46,15 +46,23 @@ void test_qnode_list(int argc, char **argv) {
         assert(list->max == 2);
         assert(list->grow == 1);
 
+        // geometric growth
+        for (int i = 2; i < 100; i++) {
+            assert(qlist_append(list, &q1) == list);
+        }
+        assert(list->len == 100);
+        assert(list->max == 128);
+        assert(list->items[99] == &q1);
+
         qlist_destroy(list);
         DONE();
     } {
         DESCRIBE("qlist_reset()");
 
-        QuadNode q1 = {
+        QuadItem q1 = {
             .pos={1.f, 1.f}
         };
-        QuadNode q2 = {
+        QuadItem q2 = {
             .pos={2.f, 2.f}
         };
 
@@ -72,8 +80,8 @@ void test_qnode_list(int argc, char **argv) {
         assert(list->max == 2);
         assert(list->grow == 1);
 
-        assert(list->nodes[0] == NULL);
-        assert(list->nodes[1] == NULL);
+        assert(list->items[0] == NULL);
+        assert(list->items[1] == NULL);
 
         qlist_destroy(list);
         DONE();
@@ -24,13 +24,14 @@ static void test_tree() {
     assert(qnode_isempty(root));
     assert(!qnode_ispointer(root));
 
-    assert(root->self_nw.x == 0);
-    assert(root->self_nw.y == 0);
-    assert(root->self_se.x == 600.0);
-    assert(root->self_se.y == 400.0);
+    assert(tree->bounds.nw.x == 0);
+    assert(tree->bounds.nw.y == 0);
+    assert(tree->bounds.se.x == 600.0);
+    assert(tree->bounds.se.y == 400.0);
 
-    assert(root->width == 600.0);
-    assert(root->height == 400.0);
+    assert(root->children == NULL);
+    assert(root->bucket == NULL);
+    assert(root->depth == 0);
 
     qtree_destroy(tree);
     DONE();
@@ -40,12 +41,12 @@ static void test_node() {
     DESCRIBE("node");
     QuadNode *node;
 
-    node = qnode_create(NULL);
+    node = qnode_create();
 
     assert(!qnode_isleaf(node));
     assert(qnode_isempty(node));
     assert(!qnode_ispointer(node));
-    assert(node->parent == NULL);
+    assert(node->children == NULL);
 
     qnode_destroy(node);
     DONE();
@@ -53,30 +54,34 @@ static void test_node() {
 
 static void test_node_bounds() {
     DESCRIBE("bounds");
-    QuadNode *node;
+    QuadBounds bounds = {{1.f, 2.f}, {3.f, 6.f}};
+    QuadBounds child;
 
-    node = qnode_create(NULL);
+    child = qbounds_quadrant(bounds, QUAD_NW);
+    assert(child.nw.x == 1.0 && child.nw.y == 2.0);
+    assert(child.se.x == 2.0 && child.se.y == 4.0);
 
-    qnode_set_bounds(node, (Vec2) {1.f, 2.f}, (Vec2) {2.f, 4.f});
-    assert(node->self_nw.x == 1.0);
-    assert(node->self_nw.y == 2.0);
-    assert(node->self_se.x == 2.0);
-    assert(node->self_se.y == 4.0);
+    child = qbounds_quadrant(bounds, QUAD_NE);
+    assert(child.nw.x == 2.0 && child.nw.y == 2.0);
+    assert(child.se.x == 3.0 && child.se.y == 4.0);
 
-    assert(node->width == 1.0);
-    assert(node->height == 2.0);
+    child = qbounds_quadrant(bounds, QUAD_SW);
+    assert(child.nw.x == 1.0 && child.nw.y == 4.0);
+    assert(child.se.x == 2.0 && child.se.y == 6.0);
 
-    qnode_destroy(node);
+    child = qbounds_quadrant(bounds, QUAD_SE);
+    assert(child.nw.x == 2.0 && child.nw.y == 4.0);
+    assert(child.se.x == 3.0 && child.se.y == 6.0);
     DONE();
 }
 
 static void test_tree_insert() {
     QuadTree *tree =  qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
     assert(tree != NULL);
-    assert(tree->root->self_nw.x == 1.0);
-    assert(tree->root->self_nw.y == 1.0);
-    assert(tree->root->self_se.x == 10.0);
-    assert(tree->root->self_se.y == 10.0);
+    assert(tree->bounds.nw.x == 1.0);
+    assert(tree->bounds.nw.y == 1.0);
+    assert(tree->bounds.se.x == 10.0);
+    assert(tree->bounds.se.y == 10.0);
 
     TestItem itm1 = {111, {8.f, 2.f}};
     TestItem itm2 = {222, {1.f, 1.f}};
@@ -86,21 +91,18 @@ static void test_tree_insert() {
         int res = qtree_insert(tree, &itm1, itm1.pos);
         // qnode_print(tree->root);
 
-        assert(tree->root->data != NULL);
+        assert(tree->root->bucket->items[0].data != NULL);
         assert(res == QUAD_INSERTED);
         assert(tree->length == 1);
 
-        assert(tree->root->nw == NULL);
-        assert(tree->root->ne == NULL);
-        assert(tree->root->se == NULL);
-        assert(tree->root->sw == NULL);
+        assert(tree->root->children == NULL);
 
         // verify node idendity
-        assert(tree->root->data != NULL);
-        assert(tree->root->pos.x == itm1.pos.x);
-        assert(tree->root->pos.y == itm1.pos.y);
+        assert(tree->root->bucket->items[0].data != NULL);
+        assert(tree->root->bucket->items[0].pos.x == itm1.pos.x);
+        assert(tree->root->bucket->items[0].pos.y == itm1.pos.y);
 
-        TestItem *item = (TestItem*) tree->root->data;
+        TestItem *item = (TestItem*) tree->root->bucket->items[0].data;
         assert(item->id == itm1.id);
         DONE();
     } {
@@ -108,22 +110,21 @@ static void test_tree_insert() {
         int res = qtree_insert(tree, &itm2, itm2.pos);
         // qnode_print(tree->root);
 
-        assert(tree->root->data == NULL); // 111 has been moved
+        assert(tree->root->len == 2); // subtree count, 111 has been moved
         assert(res == QUAD_INSERTED);
         assert(tree->length == 2);
 
         // splitting
-        assert(tree->root->nw != NULL);
-        assert(tree->root->ne != NULL);
-        assert(tree->root->se != NULL);
-        assert(tree->root->sw != NULL);
+        assert(tree->root->children != NULL);
+        assert(tree->root->bucket == NULL);
 
         // verify node idendity
-        assert(tree->root->ne->data != NULL);
-        assert(tree->root->ne->pos.x == itm1.pos.x);
-        assert(tree->root->ne->pos.y == itm1.pos.y);
+        QuadNode *ne = &tree->root->children[QUAD_NE];
+        assert(ne->bucket->items[0].data != NULL);
+        assert(ne->bucket->items[0].pos.x == itm1.pos.x);
+        assert(ne->bucket->items[0].pos.y == itm1.pos.y);
 
-        TestItem *item = (TestItem*) tree->root->ne->data;
+        TestItem *item = (TestItem*) ne->bucket->items[0].data;
         assert(item->id == itm1.id);
         DONE();
     }
@@ -140,9 +141,7 @@ static void test_tree_insert_outside() {
     int res;
     res = qtree_insert(tree, &itm, itm.pos);
 
-    assert(tree->root->data == NULL);
-    assert(tree->root->pos.x == INFINITY);
-    assert(tree->root->pos.y == INFINITY);
+    assert(tree->root->len == 0);
     assert(res == QUAD_FAILED);
 
     qtree_destroy(tree);
@@ -151,48 +150,125 @@ static void test_tree_insert_outside() {
 
 
 static void test_tree_insert_replace() {
-    DESCRIBE("replace if (n2.pos == n1.pos)");
+    DESCRIBE("replace if (n2.data == n1.data && n2.pos == n1.pos)");
     QuadTree *tree = qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
 
     TestItem itm1 = {111, {8.f, 2.f}};
-    TestItem itm2 = {222, {8.f, 2.f}};
 
     int res;
-    TestItem *item;
 
-    {
-        // first node
-        res = qtree_insert(tree, &itm1, itm1.pos);
+    res = qtree_insert(tree, &itm1, itm1.pos);
+    assert(res == QUAD_INSERTED);
+    assert(tree->length == 1);
 
-        assert(res == QUAD_INSERTED);
-        assert(tree->length == 1);
+    // same item, same pos: nothing changes
+    res = qtree_insert(tree, &itm1, itm1.pos);
+    assert(res == QUAD_REPLACED);
+    assert(tree->length == 1);
+    assert(tree->root->len == 1);
+    assert(tree->root->bucket->items[0].data == &itm1);
+
+    qtree_destroy(tree);
+    DONE();
+}
 
-        assert(tree->root->data != NULL);
-        assert(tree->root->pos.x == itm1.pos.x);
-        assert(tree->root->pos.y == itm1.pos.y);
+static void test_tree_insert_coincident() {
+    DESCRIBE("coincident points (n2.pos == n1.pos)");
+    QuadTree *tree = qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
 
-        item = (TestItem*) tree->root->data;
-        assert(item->id == itm1.id);
+    TestItem items[20];
+    TestItem other = {999, {2.f, 9.f}};
+
+    int res;
+
+    {
+        // all entities are kept, without splitting
+        for (int i = 0; i < 20; i++) {
+            items[i] = (TestItem) {i, {8.f, 2.f}};
+            res = qtree_insert(tree, &items[i], items[i].pos);
+            assert(res == QUAD_INSERTED);
+        }
+        assert(tree->length == 20);
+
+        assert(qnode_isleaf(tree->root));
+        assert(!qnode_ispointer(tree->root));
+        assert(tree->root->len == 20);
+        assert(tree->root->bucket->len == 1);
+        assert(tree->root->bucket->next != NULL);
+
+        QuadList *list = qlist_create(1);
+        qtree_find_in_area(tree, items[0].pos, 0.1f, list);
+        assert(list->len == 20);
+        qlist_destroy(list);
     } {
-        // second node replaces first
-        res = qtree_insert(tree, &itm2, itm2.pos);
+        // a separable entity splits the leaf, coincident entities move down together
+        res = qtree_insert(tree, &other, other.pos);
+        assert(res == QUAD_INSERTED);
+        assert(tree->length == 21);
 
-        assert(res == QUAD_REPLACED);
+        assert(qnode_ispointer(tree->root));
+        assert(tree->root->children[QUAD_NE].len == 20);
+        assert(tree->root->children[QUAD_NE].bucket->next != NULL);
+        assert(tree->root->children[QUAD_SW].len == 1);
+        assert(tree->root->children[QUAD_SW].bucket->items[0].data == &other);
+    } {
+        // removing coincident entities
+        for (int i = 0; i < 20; i++) {
+            res = qtree_remove(tree, &items[i], items[i].pos);
+            assert(res == QUAD_REMOVED);
+        }
         assert(tree->length == 1);
+        assert(qnode_isleaf(tree->root));
+        assert(tree->root->bucket->items[0].data == &other);
+    }
 
-        assert(tree->root->data != NULL);
-        assert(tree->root->pos.x == itm2.pos.x);
-        assert(tree->root->pos.y == itm2.pos.y);
+    qtree_destroy(tree);
+    DONE();
+}
 
-        item = (TestItem*) tree->root->data;
-        assert(item->id == itm2.id);
+static void test_tree_bucket() {
+    DESCRIBE("bucket size and max depth");
+    QuadTree *tree = qtree_create((Vec2) {0.f, 0.f}, (Vec2) {16.f, 16.f});
 
-        // splitting
-        {
-            assert(tree->root->nw == NULL);
-            assert(tree->root->ne == NULL);
-            assert(tree->root->se == NULL);
-            assert(tree->root->sw == NULL);
+    TestItem items[8];
+    int res;
+
+    {
+        // invalid settings
+        assert(qtree_configure(tree, 0, QUAD_DEPTH_MAX) == -1);
+        assert(qtree_configure(tree, QUAD_BUCKET_MAX + 1, QUAD_DEPTH_MAX) == -1);
+        assert(qtree_configure(tree, 4, 2) == 0);
+        assert(tree->bucket == 4);
+        assert(tree->max_depth == 2);
+    } {
+        // fills the root bucket
+        for (int i = 0; i < 4; i++) {
+            items[i] = (TestItem) {i, {1.f + i * 0.5f, 1.f}};
+            res = qtree_insert(tree, &items[i], items[i].pos);
+            assert(res == QUAD_INSERTED);
+        }
+        assert(qnode_isleaf(tree->root));
+        assert(tree->root->len == 4);
+
+        // can't configure a populated tree
+        assert(qtree_configure(tree, 1, QUAD_DEPTH_MAX) == -1);
+    } {
+        // splits until max depth, then overflows
+        items[4] = (TestItem) {4, {3.f, 3.f}};
+        res = qtree_insert(tree, &items[4], items[4].pos);
+        assert(res == QUAD_INSERTED);
+        assert(tree->length == 5);
+
+        QuadNode *node = &tree->root->children[QUAD_NW].children[QUAD_NW];
+        assert(node->depth == 2);
+        assert(qnode_isleaf(node));
+        assert(node->len == 5);
+        assert(node->bucket->len == 4);
+        assert(node->bucket->next != NULL);
+        assert(node->bucket->next->len == 1);
+
+        for (int i = 0; i < 5; i++) {
+            assert(qtree_find(tree, items[i].pos)->data == &items[i]);
         }
     }
 
@@ -207,7 +283,7 @@ static void test_tree_find() {
     TestItem itm1 = {111, {8.f, 2.f}};
     TestItem itm2 = {222, {1.f, 1.f}};
 
-    QuadNode *node;
+    QuadItem *found;
     TestItem *item;
     int res;
     Vec2 search;
@@ -224,22 +300,22 @@ static void test_tree_find() {
     } {
         // find second non-existing node;
         search = (Vec2){0};
-        node = qtree_find(tree, search);
-        assert(node == NULL);
+        found = qtree_find(tree, search);
+        assert(found == NULL);
     } {
         // find second item;
         search = itm2.pos;
-        node = qtree_find(tree, search);
-        assert(node != NULL);
+        found = qtree_find(tree, search);
+        assert(found != NULL);
 
-        item = (TestItem*) node->data;
+        item = (TestItem*) found->data;
         assert(item->id == itm2.id);
     } {
        //find first item
         search = itm1.pos;
-        node = qtree_find(tree, search);
+        found = qtree_find(tree, search);
 
-        item = (TestItem*) node->data;
+        item = (TestItem*) found->data;
         assert(item->id == itm1.id);
     }
 
@@ -247,8 +323,8 @@ static void test_tree_find() {
     DONE();
 }
 
-static void test_node_parent() {
-    DESCRIBE("parent");
+static void test_node_children() {
+    DESCRIBE("children");
     QuadTree *tree = qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
 
     // a nested tree with three levels
@@ -256,9 +332,9 @@ static void test_node_parent() {
     TestItem itm2 = {222, {9.f, 1.f}};
 
     QuadNode *node, *parent;
+    QuadBounds bounds;
     TestItem *item;
     int res;
-    Vec2 search;
 
     {
         // insert nodes
@@ -270,69 +346,393 @@ static void test_node_parent() {
 
         assert(tree->length == 2);
     } {
-        // find first parent
+        // first level: children are one block
         parent = tree->root;
-        node = tree->root->ne;
+        node = &tree->root->children[QUAD_NE];
 
-        assert(node != NULL);
-        assert(node->parent != NULL);
+        assert(qnode_ispointer(parent));
+        assert(node->depth == 1);
+        assert(node == parent->children + 1);
 
-        assert(node->parent->self_nw.x == parent->self_nw.x);
-        assert(node->parent->self_se.y == parent->self_se.y);
+        bounds = qbounds_quadrant(tree->bounds, QUAD_NE);
+        assert(bounds.nw.x == 5.5 && bounds.nw.y == 1.0);
+        assert(bounds.se.x == 10.0 && bounds.se.y == 5.5);
     } {
-        // find second parent
-        parent = tree->root->ne;
-        node   = tree->root->ne->ne;
+        // second level
+        parent = &tree->root->children[QUAD_NE];
+        node   = &parent->children[QUAD_NE];
 
-        assert(node != NULL);
-        assert(node->parent != NULL);
+        assert(qnode_ispointer(node));
+        assert(node->depth == 2);
 
-        assert(node->parent->self_nw.x == parent->self_nw.x);
-        assert(node->parent->self_se.y == parent->self_se.y);
+        bounds = qbounds_quadrant(bounds, QUAD_NE);
+        assert(bounds.nw.x == 7.75 && bounds.nw.y == 1.0);
+        assert(bounds.se.x == 10.0 && bounds.se.y == 3.25);
 
         // qnode_print(stderr, node);
     } {
-        // find first leaf
-        parent = tree->root->ne->ne;
-        node   = tree->root->ne->ne->nw;
+        // first leaf
+        parent = &tree->root->children[QUAD_NE].children[QUAD_NE];
+        node   = &parent->children[QUAD_NW];
 
-        assert(node != NULL);
-        assert(node->parent != NULL);
-
-        assert(node->parent->self_nw.x == parent->self_nw.x);
-        assert(node->parent->self_se.y == parent->self_se.y);
+        assert(qnode_isleaf(node));
+        assert(node->depth == 3);
+        assert(vec2_within(itm1.pos, qbounds_quadrant(bounds, QUAD_NW).nw, qbounds_quadrant(bounds, QUAD_NW).se));
 
         // data
-        assert(node->data != NULL);
+        assert(node->bucket->items[0].data != NULL);
 
-        item = (TestItem*) node->data;
+        item = (TestItem*) node->bucket->items[0].data;
         assert(item->id == itm1.id);
-
-        // qnode_print(stderr, node);
     } {
-        // find second leaf
-        parent = tree->root->ne->ne;
-        node   = tree->root->ne->ne->ne;
-
-        assert(node != NULL);
-        assert(node->parent != NULL);
+        // second leaf
+        node   = &parent->children[QUAD_NE];
 
-        assert(node->parent->self_nw.x == parent->self_nw.x);
-        assert(node->parent->self_se.y == parent->self_se.y);
+        assert(qnode_isleaf(node));
+        assert(node->depth == 3);
+        assert(vec2_within(itm2.pos, qbounds_quadrant(bounds, QUAD_NE).nw, qbounds_quadrant(bounds, QUAD_NE).se));
 
         // data
-        assert(node->data != NULL);
+        assert(node->bucket->items[0].data != NULL);
 
-        item = (TestItem*) node->data;
+        item = (TestItem*) node->bucket->items[0].data;
         assert(item->id == itm2.id);
+    }
 
-        // qnode_print(stderr, node);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static void test_tree_reset() {
+    DESCRIBE("reset");
+    QuadTree *tree = qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
+
+    TestItem items[64];
+    int res;
+    size_t blocks;
+
+    for (int i = 0; i < 64; i++) {
+        items[i] = (TestItem) {i, {1.f + (i % 8), 1.f + (i / 8)}};
+        res = qtree_insert(tree, &items[i], items[i].pos);
+        assert(res == QUAD_INSERTED);
+    }
+    assert(tree->length == 64);
+    assert(qnode_ispointer(tree->root));
+
+    blocks = tree->nodes.blocks_len;
+    assert(blocks > 0);
+
+    {
+        // reset keeps bounds and capacity
+        qtree_reset(tree);
+
+        assert(tree->length == 0);
+        assert(qnode_isempty(tree->root));
+        assert(tree->bounds.nw.x == 1.0);
+        assert(tree->bounds.nw.y == 1.0);
+        assert(tree->bounds.se.x == 10.0);
+        assert(tree->bounds.se.y == 10.0);
+        assert(tree->nodes.blocks_len == blocks);
+
+        assert(qtree_find(tree, items[0].pos) == NULL);
+    } {
+        // re-inserting the same population does not grow the arena
+        for (int i = 0; i < 64; i++) {
+            res = qtree_insert(tree, &items[i], items[i].pos);
+            assert(res == QUAD_INSERTED);
+        }
+        assert(tree->length == 64);
+        assert(tree->nodes.blocks_len == blocks);
+
+        QuadItem *found = qtree_find(tree, items[63].pos);
+        assert(found != NULL);
+        assert(((TestItem*) found->data)->id == 63);
     }
 
     qtree_destroy(tree);
     DONE();
 }
 
+static void test_tree_remove() {
+    DESCRIBE("remove");
+    QuadTree *tree = qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
+
+    // a nested tree with three levels
+    TestItem itm1 = {111, {8.f, 2.f}};
+    TestItem itm2 = {222, {9.f, 1.f}};
+    TestItem itm3 = {333, {2.f, 9.f}};
+
+    int res;
+
+    {
+        qtree_insert(tree, &itm1, itm1.pos);
+        qtree_insert(tree, &itm2, itm2.pos);
+        qtree_insert(tree, &itm3, itm3.pos);
+        assert(tree->length == 3);
+        assert(qnode_ispointer(&tree->root->children[QUAD_NE].children[QUAD_NE]));
+    } {
+        // wrong data or pos
+        res = qtree_remove(tree, &itm1, itm2.pos);
+        assert(res == QUAD_FAILED);
+        res = qtree_remove(tree, &itm3, (Vec2) {2.f, 8.f});
+        assert(res == QUAD_FAILED);
+        assert(tree->length == 3);
+    } {
+        // siblings collapse into their parents
+        res = qtree_remove(tree, &itm2, itm2.pos);
+        assert(res == QUAD_REMOVED);
+        assert(tree->length == 2);
+
+        assert(qtree_find(tree, itm2.pos) == NULL);
+        assert(qnode_isleaf(&tree->root->children[QUAD_NE]));
+        assert(tree->root->children[QUAD_NE].bucket->items[0].data == &itm1);
+    } {
+        // last two: root becomes a leaf
+        res = qtree_remove(tree, &itm3, itm3.pos);
+        assert(res == QUAD_REMOVED);
+        assert(tree->length == 1);
+
+        assert(qnode_isleaf(tree->root));
+        assert(tree->root->bucket->items[0].data == &itm1);
+        assert(tree->root->children == NULL);
+    } {
+        // empty
+        res = qtree_remove(tree, &itm1, itm1.pos);
+        assert(res == QUAD_REMOVED);
+        assert(tree->length == 0);
+        assert(qnode_isempty(tree->root));
+    }
+
+    qtree_destroy(tree);
+    DONE();
+}
+
+static void test_tree_move() {
+    DESCRIBE("move");
+    QuadTree *tree = qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
+
+    TestItem itm1 = {111, {8.f, 2.f}};
+    TestItem itm2 = {222, {9.f, 1.f}};
+    TestItem itm3 = {333, {2.f, 9.f}};
+
+    int res;
+    QuadItem *found;
+    Vec2 pos;
+
+    qtree_insert(tree, &itm1, itm1.pos);
+    qtree_insert(tree, &itm2, itm2.pos);
+    qtree_insert(tree, &itm3, itm3.pos);
+
+    {
+        // within the same leaf
+        found = qtree_find(tree, itm3.pos);
+        pos = (Vec2) {2.5f, 8.5f};
+
+        res = qtree_move(tree, &itm3, itm3.pos, pos);
+        assert(res == QUAD_INSERTED);
+        assert(tree->length == 3);
+        assert(qtree_find(tree, pos) == found);
+        itm3.pos = pos;
+    } {
+        // into another quadrant, emptied siblings collapse
+        pos = (Vec2) {2.f, 2.f};
+
+        res = qtree_move(tree, &itm2, itm2.pos, pos);
+        assert(res == QUAD_INSERTED);
+        assert(tree->length == 3);
+        assert(qtree_find(tree, itm2.pos) == NULL);
+
+        found = qtree_find(tree, pos);
+        assert(found != NULL);
+        assert(found->data == &itm2);
+        itm2.pos = pos;
+
+        assert(qnode_isleaf(&tree->root->children[QUAD_NE]));
+        assert(tree->root->children[QUAD_NE].bucket->items[0].data == &itm1);
+    } {
+        // outside of the tree: removed
+        pos = (Vec2) {20.f, 20.f};
+
+        res = qtree_move(tree, &itm1, itm1.pos, pos);
+        assert(res == QUAD_FAILED);
+        assert(tree->length == 2);
+        assert(qtree_find(tree, itm1.pos) == NULL);
+    } {
+        // unknown: inserted
+        res = qtree_move(tree, &itm1, pos, itm1.pos);
+        assert(res == QUAD_INSERTED);
+        assert(tree->length == 3);
+        assert(qtree_find(tree, itm1.pos)->data == &itm1);
+    }
+
+    qtree_destroy(tree);
+    DONE();
+}
+
+static void test_tree_stats() {
+    DESCRIBE("stats and query counters");
+    QuadTree *tree = qtree_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f});
+
+    TestItem itm1 = {111, {8.f, 2.f}};
+    TestItem itm2 = {222, {9.f, 1.f}};
+    TestItem itm3 = {333, {2.f, 9.f}};
+
+    QuadStats stats;
+    QuadList *list = qlist_create(1);
+
+    {
+        // empty tree: the root
+        assert(qtree_stats(tree, &stats) == 0);
+        assert(stats.empty == 1);
+        assert(stats.internal == 0 && stats.leaves == 0);
+        assert(stats.bytes > 0 && stats.bytes_used == sizeof(QuadNode));
+    } {
+        // three levels, see test_node_children()
+        qtree_insert(tree, &itm1, itm1.pos);
+        qtree_insert(tree, &itm2, itm2.pos);
+        qtree_insert(tree, &itm3, itm3.pos);
+        assert(qtree_insert(tree, &itm3, itm3.pos) == QUAD_REPLACED);
+        assert(qtree_insert(tree, &itm3, (Vec2) {20.f, 20.f}) == QUAD_FAILED);
+
+        assert(qtree_stats(tree, &stats) == 0);
+        assert(stats.length == 3);
+        assert(stats.internal == 3);
+        assert(stats.leaves == 3);
+        assert(stats.empty == 13 - 3 - 3);
+        assert(stats.buckets == 3);
+        assert(stats.depth[0] == 1 && stats.depth[1] == 4 && stats.depth[2] == 4 && stats.depth[3] == 4);
+        assert(stats.max_depth == 3);
+        assert(stats.replaced == 1);
+        assert(stats.failed == 1);
+        assert(stats.bytes >= stats.bytes_used);
+    } {
+        // counters are opt-in
+        qtree_find_in_area(tree, itm1.pos, 1.f, list);
+        assert(tree->counters.queries == 0);
+
+        tree->counting = 1;
+        qlist_reset(list);
+        qtree_find_in_area(tree, itm1.pos, 1.f, list);
+        assert(list->len == 2);
+        assert(tree->counters.queries == 1);
+        assert(tree->counters.nodes > tree->counters.leaves);
+        assert(tree->counters.leaves == 2);
+        assert(tree->counters.tested == 2);
+        assert(tree->counters.hits == 2);
+
+        qlist_reset(list);
+        qtree_find_in_radius(tree, itm3.pos, 1.f, list);
+        assert(tree->counters.queries == 2);
+        assert(tree->counters.hits == 3);
+
+        qtree_reset_counters(tree);
+        assert(tree->counters.queries == 0 && tree->counters.nodes == 0);
+    } {
+        // reset clears the insert outcomes
+        qtree_reset(tree);
+        assert(qtree_stats(tree, &stats) == 0);
+        assert(stats.empty == 1 && stats.replaced == 0 && stats.failed == 0);
+    }
+
+    qlist_destroy(list);
+    qtree_destroy(tree);
+    DONE();
+}
+
+typedef struct TestShape {
+    size_t len;
+    unsigned int depth[4096];
+    unsigned int count[4096];
+} TestShape;
+
+static int _test_shape(QuadNode *node, QuadBounds bounds, void *ctx) {
+    TestShape *shape = ctx;
+    unsigned int count = 0;
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        count += bucket->len;
+    }
+    for (int i = 0; node->children && i < 4; i++) {
+        count += node->children[i].len;
+    }
+    assert(count == node->len); // subtree counts
+
+    assert(shape->len < 4096);
+    shape->depth[shape->len] = node->depth;
+    shape->count[shape->len] = count;
+    shape->len++;
+    return QUAD_VISIT_CONTINUE;
+}
+
+static void test_tree_build_bulk() {
+    DESCRIBE("bulk build");
+
+    TestItem items[1000];
+    void *data[1000];
+    Vec2 positions[1000];
+    static TestShape expected, shape;
+    unsigned int threads[] = {1, 2, 4, 16};
+    unsigned int buckets[] = {1, QUAD_BUCKET_MAX};
+
+    for (int i = 0; i < 1000; i++) {
+        // coarse positions: coincident points and points on node boundaries, some outside
+        items[i] = (TestItem) {i, {(float) (rand() % 110) * 4.f, (float) (rand() % 110) * 4.f}};
+        data[i] = &items[i];
+        positions[i] = items[i].pos;
+    }
+    data[7] = NULL; // skipped
+
+    for (int b = 0; b < 2; b++) {
+        // reference: one by one
+        QuadTree *ref = qtree_create((Vec2){0.f, 0.f}, (Vec2) {400.f, 400.f});
+        qtree_configure(ref, buckets[b], 8);
+        for (int i = 0; i < 1000; i++) {
+            if (data[i]) {
+                qtree_insert(ref, data[i], positions[i]);
+            }
+        }
+        expected.len = 0;
+        qtree_walk(ref, _test_shape, NULL, &expected);
+
+        QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {400.f, 400.f});
+        qtree_configure(tree, buckets[b], 8);
+
+        for (int t = 0; t < 4; t++) {
+            // same shape as inserting one by one, for any number of threads (and rebuilding an already built tree)
+            assert(qtree_build_bulk(tree, data, positions, 1000, threads[t]) == (int) ref->length);
+            assert(tree->length == ref->length);
+
+            shape.len = 0;
+            qtree_walk(tree, _test_shape, NULL, &shape);
+            assert(shape.len == expected.len);
+            for (size_t i = 0; i < shape.len; i++) {
+                assert(shape.depth[i] == expected.depth[i]);
+                assert(shape.count[i] == expected.count[i]);
+            }
+
+            for (int i = 0; i < 1000; i++) {
+                if (i != 7 && positions[i].x < 400.f && positions[i].y < 400.f) {
+                    assert(qtree_find(tree, positions[i]) != NULL);
+                }
+            }
+        }
+
+        {
+            // still incrementally updateable
+            assert(qtree_remove(tree, data[0], positions[0]) == QUAD_REMOVED || positions[0].x >= 400.f || positions[0].y >= 400.f);
+            assert(qtree_insert(tree, &items[7], (Vec2){1.f, 1.f}) == QUAD_INSERTED);
+        } {
+            // empty
+            assert(qtree_build_bulk(tree, data, positions, 0, 4) == 0);
+            assert(tree->length == 0);
+            assert(qnode_isempty(tree->root));
+        }
+
+        qtree_destroy(ref);
+        qtree_destroy(tree);
+    }
+
+    DONE();
+}
 
 void test_qtree(int argc, char **argv) {
     test_tree();
@@ -341,6 +741,13 @@ void test_qtree(int argc, char **argv) {
     test_tree_insert();
     test_tree_insert_outside();
     test_tree_insert_replace();
+    test_tree_insert_coincident();
+    test_tree_bucket();
     test_tree_find();
-    test_node_parent();
+    test_node_children();
+    test_tree_reset();
+    test_tree_remove();
+    test_tree_move();
+    test_tree_stats();
+    test_tree_build_bulk();
 }
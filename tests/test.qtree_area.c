@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 #include <assert.h>
+#include <math.h>
 
 #include "test.h"
 #include "qtree.h"
@@ -14,8 +15,8 @@ typedef struct TestItem {
 
 static int _in_list(int id, QuadList *list) {
     for (size_t i = 0; i < list->len; i++) {
-        if (list->nodes[i] && list->nodes[i]->data) {
-            TestItem *item = (TestItem*) list->nodes[i]->data;
+        if (list->items[i] && list->items[i]->data) {
+            TestItem *item = (TestItem*) list->items[i]->data;
             if (item->id == id) {
                 return 1;
             }
@@ -25,59 +26,53 @@ static int _in_list(int id, QuadList *list) {
 }
 
 
-static void test_qnode_within_area() {
-    DESCRIBE("node covered by area");
+static void test_qbounds_within_area() {
+    DESCRIBE("bounds covered by area");
 
     int res;
-    QuadNode *node = qnode_create(NULL);
-    node->self_nw = (Vec2) {2.f, 2.f};
-    node->self_se = (Vec2) {5.f, 5.f};
+    QuadBounds bounds = {{2.f, 2.f}, {5.f, 5.f}};
 
     // outside area
-    res = qnode_within_area(node, (Vec2) {0.f, 0.f}, (Vec2) {1.f, 1.f});
+    res = qbounds_within_area(bounds, (Vec2) {0.f, 0.f}, (Vec2) {1.f, 1.f});
     assert(res == 0);
 
     // overlaps area
-    res = qnode_within_area(node, (Vec2) {0.f, 0.f}, (Vec2) {3.f, 3.f});
+    res = qbounds_within_area(bounds, (Vec2) {0.f, 0.f}, (Vec2) {3.f, 3.f});
     assert(res == 0);
 
     // exact coverage
-    res = qnode_within_area(node, (Vec2){2.f, 2.f}, (Vec2) {5.f, 5.f});
+    res = qbounds_within_area(bounds, (Vec2){2.f, 2.f}, (Vec2) {5.f, 5.f});
     assert(res == 1);
 
     // inside area
-    res = qnode_within_area(node, (Vec2){1.f, 1.f}, (Vec2) {6.f, 6.f});
+    res = qbounds_within_area(bounds, (Vec2){1.f, 1.f}, (Vec2) {6.f, 6.f});
     assert(res == 1);
 
-    qnode_destroy(node);
     DONE();
 }
 
-static void test_qnode_overlaps_area() {
-    DESCRIBE("node overlaps area");
+static void test_qbounds_overlaps_area() {
+    DESCRIBE("bounds overlaps area");
 
     int res;
-    QuadNode *node = qnode_create(NULL);
-    node->self_nw = (Vec2) {2.f, 2.f};
-    node->self_se = (Vec2) {5.f, 5.f};
+    QuadBounds bounds = {{2.f, 2.f}, {5.f, 5.f}};
 
     // outside area
-    res = qnode_overlaps_area(node, (Vec2) {0.f, 0.f}, (Vec2) {1.f, 1.f});
+    res = qbounds_overlaps_area(bounds, (Vec2) {0.f, 0.f}, (Vec2) {1.f, 1.f});
     assert(res == 0);
 
     // overlaps area
-    res = qnode_overlaps_area(node, (Vec2) {0.f, 0.f}, (Vec2) {3.f, 3.f});
+    res = qbounds_overlaps_area(bounds, (Vec2) {0.f, 0.f}, (Vec2) {3.f, 3.f});
     assert(res == 1);
 
     // exact coverage
-    res = qnode_overlaps_area(node, (Vec2){2.f, 2.f}, (Vec2) {5.f, 5.f});
+    res = qbounds_overlaps_area(bounds, (Vec2){2.f, 2.f}, (Vec2) {5.f, 5.f});
     assert(res == 1);
 
     // inside area
-    res = qnode_overlaps_area(node, (Vec2){1.f, 1.f}, (Vec2) {6.f, 6.f});
+    res = qbounds_overlaps_area(bounds, (Vec2){1.f, 1.f}, (Vec2) {6.f, 6.f});
     assert(res == 1);
 
-    qnode_destroy(node);
     DONE();
 }
 
@@ -164,9 +159,950 @@ static void test_find_in_area() {
     DONE();
 }
 
+static void test_find_knn() {
+    DESCRIBE("k nearest neighbours");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {100.f, 100.f});
+    qtree_configure(tree, 4, QUAD_DEPTH_MAX);
+
+    Vec2 pos = {50.f, 50.f};
+    TestItem items[100];
+    QuadList *list = qlist_create(1);
+    float prev, dist;
+
+    // a ring of 10 items per distance 1..10
+    for (int i = 0; i < 100; i++) {
+        float r = (float) (i / 10 + 1);
+        float phi = (float) (i % 10) * 0.6283f;
+        items[i] = (TestItem) {i, {pos.x + r * cosf(phi), pos.y + r * sinf(phi)}};
+        assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    {
+        // sorted by distance
+        qtree_find_knn(tree, pos, 15, INFINITY, list);
+        assert(list->len == 15);
+
+        prev = 0;
+        for (size_t i = 0; i < list->len; i++) {
+            dist = vec2_dist(list->items[i]->pos, pos);
+            assert(dist >= prev);
+            prev = dist;
+        }
+
+        // the 10 items of the first ring, 5 of the second
+        for (int i = 0; i < 10; i++) {
+            assert(_in_list(i, list));
+        }
+        assert(vec2_dist(list->items[14]->pos, pos) < 2.01f);
+    } {
+        // limited by radius
+        qlist_reset(list);
+        qtree_find_knn(tree, pos, 50, 3.5f, list);
+        assert(list->len == 30);
+    } {
+        // same as a full (brute force) sort
+        qlist_reset(list);
+        Vec2 from = {10.f, 90.f};
+        qtree_find_knn(tree, from, 100, INFINITY, list);
+        assert(list->len == 100);
+
+        prev = 0;
+        for (size_t i = 0; i < list->len; i++) {
+            dist = vec2_dist(list->items[i]->pos, from);
+            assert(dist >= prev);
+            prev = dist;
+        }
+    } {
+        // nothing
+        qlist_reset(list);
+        qtree_find_knn(tree, pos, 0, INFINITY, list);
+        assert(list->len == 0);
+    }
+
+    qlist_destroy(list);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static void test_find_knn_rollback() {
+    DESCRIBE("k nearest neighbours: allocation failure leaves the list unchanged");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {100.f, 100.f});
+    qtree_configure(tree, 1, QUAD_DEPTH_MAX);
+
+    Vec2 pos = {50.f, 50.f};
+    TestItem items[100];
+    QuadItem first = {{0.f, 0.f}, NULL};
+    QuadList *list = qlist_create(1);
+
+    for (int i = 0; i < 100; i++) {
+        items[i] = (TestItem) {i, {(float) (i % 10) * 10.f + 5.f, (float) (i / 10) * 10.f + 5.f}};
+        assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+    qlist_append(list, &first);
+
+    {
+        // the results heap outgrows its stack entries
+        quad_alloc_fail = 0;
+        assert(qtree_find_knn(tree, pos, 100, INFINITY, list) == NULL);
+        quad_alloc_fail = -1;
+        assert(list->len == 1);
+        assert(list->items[0] == &first);
+    } {
+        // the list can't grow
+        quad_alloc_fail = 0;
+        assert(qtree_find_knn(tree, pos, 5, INFINITY, list) == NULL);
+        quad_alloc_fail = -1;
+        assert(list->len == 1);
+        assert(list->max == 1);
+        assert(list->items[0] == &first);
+    } {
+        // recovers once memory is available again
+        assert(qtree_find_knn(tree, pos, 5, INFINITY, list) == list);
+        assert(list->len == 6);
+        assert(list->items[0] == &first);
+    }
+
+    qlist_destroy(list);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static void test_find_in_radius() {
+    DESCRIBE("find in radius");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {100.f, 100.f});
+    qtree_configure(tree, 4, QUAD_DEPTH_MAX);
+
+    TestItem items[400];
+    QuadList *list = qlist_create(1);
+    Vec2 delta;
+    float dist2;
+    size_t expected;
+
+    // 20x20 grid, 5 units apart
+    for (int i = 0; i < 400; i++) {
+        items[i] = (TestItem) {i, {(float) (i % 20) * 5.f + 2.5f, (float) (i / 20) * 5.f + 2.5f}};
+        assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    Vec2 centers[] = {{50.f, 50.f}, {2.5f, 2.5f}, {97.f, 12.f}, {33.f, 71.f}};
+    float radii[] = {0.f, 5.f, 12.5f, 30.f};
+
+    for (size_t c = 0; c < sizeof(centers) / sizeof(centers[0]); c++) {
+        for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+            qlist_reset(list);
+            qtree_find_in_radius(tree, centers[c], radii[r], list);
+
+            // same as brute force, corners of the bounding square are excluded
+            expected = 0;
+            for (int i = 0; i < 400; i++) {
+                delta = vec2_sub(items[i].pos, centers[c]);
+                dist2 = delta.x * delta.x + delta.y * delta.y;
+                if (dist2 <= radii[r] * radii[r]) {
+                    expected++;
+                    assert(_in_list(i, list));
+                }
+            }
+            assert(list->len == expected);
+
+            // squared distances are returned
+            for (size_t i = 0; i < list->len; i++) {
+                delta = vec2_sub(list->items[i]->pos, centers[c]);
+                assert(fabsf(list->dist2[i] - (delta.x * delta.x + delta.y * delta.y)) < 0.001f);
+            }
+        }
+    }
+
+    {
+        // exactly on the circle
+        qlist_reset(list);
+        qtree_find_in_radius(tree, (Vec2){2.5f, 2.5f}, 5.f, list);
+        assert(list->len == 3);
+    } {
+        // negative radius
+        qlist_reset(list);
+        qtree_find_in_radius(tree, (Vec2){50.f, 50.f}, -1.f, list);
+        assert(list->len == 0);
+    }
+
+    qlist_destroy(list);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static float _segment_dist2(Vec2 pos, Vec2 a, Vec2 b, float *along2) {
+    Vec2 dir = vec2_sub(b, a);
+    Vec2 delta = vec2_sub(pos, a);
+    float len2 = dir.x * dir.x + dir.y * dir.y;
+    float t = (len2 > 0) ? fminf(fmaxf((delta.x * dir.x + delta.y * dir.y) / len2, 0.f), 1.f) : 0.f;
+    *along2 = t * t * len2;
+    delta.x -= t * dir.x;
+    delta.y -= t * dir.y;
+    return delta.x * delta.x + delta.y * delta.y;
+}
+
+static void test_find_on_segment() {
+    DESCRIBE("find on segment");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {100.f, 100.f});
+    qtree_configure(tree, 4, QUAD_DEPTH_MAX);
+
+    TestItem items[400];
+    QuadList *list = qlist_create(1);
+    float along2;
+    size_t expected;
+
+    // 20x20 grid, 5 units apart
+    for (int i = 0; i < 400; i++) {
+        items[i] = (TestItem) {i, {(float) (i % 20) * 5.f + 2.5f, (float) (i / 20) * 5.f + 2.5f}};
+        assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    Vec2 segments[][2] = {
+        {{2.5f, 2.5f}, {97.5f, 2.5f}},  // along a row
+        {{97.5f, 97.5f}, {2.5f, 2.5f}}, // diagonal, backwards
+        {{-20.f, 40.f}, {130.f, 61.f}}, // crossing the tree
+        {{50.f, 50.f}, {53.f, 91.f}},
+        {{33.f, 33.f}, {33.f, 33.f}},   // a point
+    };
+    float widths[] = {0.f, 1.f, 5.f, 12.f};
+
+    for (size_t s = 0; s < sizeof(segments) / sizeof(segments[0]); s++) {
+        for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+            qlist_reset(list);
+            qtree_find_on_segment(tree, segments[s][0], segments[s][1], widths[w], list);
+
+            // same as brute force
+            expected = 0;
+            for (int i = 0; i < 400; i++) {
+                if (_segment_dist2(items[i].pos, segments[s][0], segments[s][1], &along2) <= widths[w] * widths[w] / 4) {
+                    expected++;
+                    assert(_in_list(i, list));
+                }
+            }
+            assert(list->len == expected);
+
+            // ordered along the segment
+            for (size_t i = 0; i < list->len; i++) {
+                _segment_dist2(list->items[i]->pos, segments[s][0], segments[s][1], &along2);
+                assert(fabsf(list->dist2[i] - along2) < 0.01f);
+                assert(i == 0 || list->dist2[i - 1] <= list->dist2[i]);
+            }
+        }
+    }
+
+    {
+        // a row, first hit is the start
+        qlist_reset(list);
+        qtree_find_on_segment(tree, (Vec2){2.5f, 2.5f}, (Vec2){97.5f, 2.5f}, .1f, list);
+        assert(list->len == 20);
+        assert(((TestItem *)list->items[0]->data)->id == 0);
+        assert(((TestItem *)list->items[19]->data)->id == 19);
+
+        qlist_reset(list);
+        qtree_find_on_segment(tree, (Vec2){97.5f, 2.5f}, (Vec2){2.5f, 2.5f}, .1f, list);
+        assert(((TestItem *)list->items[0]->data)->id == 19);
+    } {
+        // prunes the nodes the segment does not pass through
+        qtree_reset_counters(tree);
+        tree->counting = 1;
+        qlist_reset(list);
+        qtree_find_on_segment(tree, (Vec2){1.f, 1.f}, (Vec2){1.f, 10.f}, 1.f, list);
+        assert(list->len == 0);
+        assert(tree->counters.queries == 1);
+        assert(tree->counters.tested < 20);
+        tree->counting = 0;
+    } {
+        // outside, negative width
+        qlist_reset(list);
+        qtree_find_on_segment(tree, (Vec2){-10.f, -10.f}, (Vec2){-10.f, 200.f}, 4.f, list);
+        assert(list->len == 0);
+        qtree_find_on_segment(tree, (Vec2){2.5f, 2.5f}, (Vec2){97.5f, 2.5f}, -1.f, list);
+        assert(list->len == 0);
+        assert(qtree_find_on_segment(NULL, (Vec2){0}, (Vec2){0}, 1.f, list) == NULL);
+    }
+
+    qlist_destroy(list);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static void test_toroidal() {
+    DESCRIBE("toroidal queries");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {100.f, 100.f});
+    qtree_configure(tree, 4, QUAD_DEPTH_MAX);
+
+    TestItem items[400];
+    QuadList *list = qlist_create(1);
+    Vec2 offsets[4];
+    Vec2 delta;
+    float dist2;
+    size_t expected;
+
+    {
+        // images of an area
+        QuadBounds bounds = tree->bounds;
+        assert(qbounds_wrap_offsets(bounds, (Vec2){10.f, 10.f}, (Vec2){20.f, 20.f}, offsets) == 1);
+        assert(offsets[0].x == 0.f && offsets[0].y == 0.f);
+
+        assert(qbounds_wrap_offsets(bounds, (Vec2){95.f, 10.f}, (Vec2){105.f, 20.f}, offsets) == 2);
+        assert(offsets[1].x == -100.f && offsets[1].y == 0.f);
+
+        assert(qbounds_wrap_offsets(bounds, (Vec2){-5.f, -5.f}, (Vec2){5.f, 5.f}, offsets) == 4);
+        assert(offsets[1].x == 100.f && offsets[1].y == 0.f);
+        assert(offsets[2].x == 0.f && offsets[2].y == 100.f);
+        assert(offsets[3].x == 100.f && offsets[3].y == 100.f);
+    }
+
+    // 20x20 grid, 5 units apart
+    for (int i = 0; i < 400; i++) {
+        items[i] = (TestItem) {i, {(float) (i % 20) * 5.f + 2.5f, (float) (i / 20) * 5.f + 2.5f}};
+        assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    {
+        // not toroidal: cut at the edges
+        qtree_find_in_radius(tree, (Vec2){1.f, 1.f}, 5.f, list);
+        assert(list->len == 1);
+    }
+
+    assert(qtree_toroidal(tree, 1) == 0);
+
+    {
+        // radii below half the tree are kept
+        assert(qbounds_wrap_radius(tree->bounds, 40.f) == 40.f);
+        assert(qbounds_wrap_radius(tree->bounds, 50.f) < 50.f);
+        assert(qbounds_wrap_radius(tree->bounds, 80.f) > 49.99f);
+        assert(qbounds_wrap_radius((QuadBounds){{0.f, 0.f}, {100.f, 40.f}}, 30.f) < 20.f);
+    }
+
+    // radii beyond a quarter and half of the tree: the circle crosses both edges of an axis
+    Vec2 centers[] = {{1.f, 1.f}, {99.f, 50.f}, {50.f, 98.f}, {97.f, 3.f}, {50.f, 50.f}};
+    float radii[] = {0.f, 5.f, 12.5f, 30.f, 40.f, 80.f};
+    float radius;
+
+    for (size_t c = 0; c < sizeof(centers) / sizeof(centers[0]); c++) {
+        for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+            qlist_reset(list);
+            qtree_find_in_radius(tree, centers[c], radii[r], list);
+            radius = qbounds_wrap_radius(tree->bounds, radii[r]);
+
+            // same as brute force with wrapped distances (within the clamped radius), each item once
+            expected = 0;
+            for (int i = 0; i < 400; i++) {
+                delta = vec2_sub(items[i].pos, centers[c]);
+                delta.x -= (delta.x > 50.f) ? 100.f : (delta.x < -50.f) ? -100.f : 0.f;
+                delta.y -= (delta.y > 50.f) ? 100.f : (delta.y < -50.f) ? -100.f : 0.f;
+                dist2 = delta.x * delta.x + delta.y * delta.y;
+                if (dist2 <= radius * radius) {
+                    expected++;
+                    assert(_in_list(i, list));
+                    for (size_t j = 0; j < list->len; j++) {
+                        if (((TestItem *)list->items[j]->data)->id == i) {
+                            assert(fabsf(list->dist2[j] - dist2) < 0.01f);
+                        }
+                    }
+                }
+            }
+            assert(list->len == expected);
+        }
+    }
+
+    {
+        // corner: the nearest item of each of the 4 corners
+        qlist_reset(list);
+        qtree_find_in_radius(tree, (Vec2){0.f, 0.f}, 6.f, list);
+        assert(list->len == 4);
+        assert(_in_list(0, list) && _in_list(19, list) && _in_list(380, list) && _in_list(399, list));
+
+        // area queries: 2x2 items of each corner
+        qlist_reset(list);
+        qtree_find_in_area(tree, (Vec2){0.f, 0.f}, 8.f, list);
+        assert(list->len == 16);
+    } {
+        // areas wider than the tree: every item once
+        qlist_reset(list);
+        qtree_find_in_area(tree, (Vec2){70.f, 30.f}, 60.f, list);
+        assert(list->len == 400);
+
+        // exactly as wide, crossing the nw edges
+        qlist_reset(list);
+        qtree_find_in_area(tree, (Vec2){1.f, 1.f}, 50.f, list);
+        assert(list->len == 400);
+    }
+
+    qlist_destroy(list);
+    qtree_destroy(tree);
+    DONE();
+}
+
+typedef struct TestVisit {
+    size_t count;
+    size_t stop; // stop after this many items/nodes, 0: never
+    QuadList *list;
+} TestVisit;
+
+static int _test_visit_item(QuadItem *item, float dist2, void *ctx) {
+    TestVisit *visit = ctx;
+    qlist_append_dist(visit->list, item, dist2);
+    visit->count++;
+    return (visit->stop && visit->count >= visit->stop) ? QUAD_VISIT_STOP : QUAD_VISIT_CONTINUE;
+}
+
+static int _test_visit_node(QuadNode *node, QuadBounds bounds, void *ctx) {
+    TestVisit *visit = ctx;
+    visit->count++;
+    return (visit->stop && visit->count >= visit->stop) ? QUAD_VISIT_STOP : QUAD_VISIT_CONTINUE;
+}
+
+static int _test_skip_node(QuadNode *node, QuadBounds bounds, void *ctx) {
+    ((TestVisit *)ctx)->count++;
+    return QUAD_VISIT_SKIP;
+}
+
+static void test_visit() {
+    DESCRIBE("visitors with context");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {100.f, 100.f});
+
+    TestItem items[100];
+    QuadList *found = qlist_create(1);
+    QuadList *visited = qlist_create(1);
+    TestVisit visit;
+
+    for (int i = 0; i < 100; i++) {
+        items[i] = (TestItem) {i, {(float) (i % 10) * 10.f + 5.f, (float) (i / 10) * 10.f + 5.f}};
+        assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    {
+        // same items as the list queries
+        visit = (TestVisit) {0, 0, visited};
+        assert(qtree_visit_area(tree, (Vec2){20.f, 20.f}, (Vec2){60.f, 60.f}, _test_visit_item, &visit) == QUAD_VISIT_CONTINUE);
+        qtree_find_in_area(tree, (Vec2){40.f, 40.f}, 20.f, found);
+        assert(visit.count == 16);
+        assert(visited->len == found->len);
+        for (size_t i = 0; i < found->len; i++) {
+            assert(_in_list(((TestItem *) found->items[i]->data)->id, visited));
+        }
+
+        qlist_reset(found);
+        qlist_reset(visited);
+        visit = (TestVisit) {0, 0, visited};
+        assert(qtree_visit_radius(tree, (Vec2){50.f, 50.f}, 25.f, _test_visit_item, &visit) == QUAD_VISIT_CONTINUE);
+        qtree_find_in_radius(tree, (Vec2){50.f, 50.f}, 25.f, found);
+        assert(visited->len == found->len);
+        for (size_t i = 0; i < visited->len; i++) {
+            assert(visited->dist2[i] >= 0 && visited->dist2[i] <= 25.f * 25.f);
+        }
+    } {
+        // early termination
+        qlist_reset(visited);
+        visit = (TestVisit) {0, 3, visited};
+        assert(qtree_visit_area(tree, (Vec2){0.f, 0.f}, (Vec2){100.f, 100.f}, _test_visit_item, &visit) == QUAD_VISIT_STOP);
+        assert(visit.count == 3);
+        assert(visited->len == 3);
+    } {
+        // walk: all nodes, stop, skip
+        visit = (TestVisit) {0, 0, NULL};
+        assert(qtree_walk(tree, _test_visit_node, NULL, &visit) == QUAD_VISIT_CONTINUE);
+        size_t nodes = visit.count;
+        assert(nodes > 100);
+
+        visit = (TestVisit) {0, 0, NULL};
+        qtree_walk(tree, NULL, _test_visit_node, &visit);
+        assert(visit.count == nodes);
+
+        visit = (TestVisit) {0, 5, NULL};
+        assert(qtree_walk(tree, _test_visit_node, _test_visit_node, &visit) == QUAD_VISIT_STOP);
+        assert(visit.count == 5);
+
+        visit = (TestVisit) {0, 0, NULL};
+        qtree_walk(tree, _test_skip_node, NULL, &visit);
+        assert(visit.count == 1);
+    } {
+        // invalid
+        assert(qtree_visit_area(NULL, (Vec2){0.f, 0.f}, (Vec2){1.f, 1.f}, _test_visit_item, NULL) == QUAD_FAILED);
+        assert(qtree_visit_radius(tree, (Vec2){0.f, 0.f}, 1.f, NULL, NULL) == QUAD_FAILED);
+    }
+
+    qlist_destroy(found);
+    qlist_destroy(visited);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static size_t _test_index(void *data, void *ctx) {
+    return (size_t) ((TestItem *)data)->id;
+}
+
+static void test_find_all_pairs() {
+    DESCRIBE("all pairs");
+
+    TestItem items[500];
+    QuadPairs *pairs = qpairs_create();
+    unsigned int buckets[] = {1, QUAD_BUCKET_MAX};
+    float radii[] = {0.f, 2.f, 7.5f, 30.f};
+    Vec2 delta;
+    float dist2;
+    size_t expected, found;
+
+    for (int b = 0; b < 2; b++) {
+        QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {100.f, 100.f});
+        qtree_configure(tree, buckets[b], 6);
+
+        for (int i = 0; i < 500; i++) {
+            // coarse positions: coincident points and points on node boundaries
+            items[i] = (TestItem) {i, {(float) (rand() % 50) * 2.f, (float) (rand() % 50) * 2.f}};
+            assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+        }
+
+        for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+            assert(qtree_find_all_pairs(tree, radii[r], 500, _test_index, NULL, pairs) == pairs);
+            assert(pairs->len == 500);
+            assert(pairs->offsets[500] == pairs->count);
+
+            // same as brute force, every item lists every other item within radius exactly once
+            for (int i = 0; i < 500; i++) {
+                expected = 0;
+                for (int j = 0; j < 500; j++) {
+                    delta = vec2_sub(items[i].pos, items[j].pos);
+                    dist2 = delta.x * delta.x + delta.y * delta.y;
+                    if (i == j || dist2 > radii[r] * radii[r]) {
+                        continue;
+                    }
+                    expected++;
+
+                    found = 0;
+                    for (size_t k = pairs->offsets[i]; k < pairs->offsets[i + 1]; k++) {
+                        if (pairs->indices[k] == (size_t) j) {
+                            assert(fabsf(pairs->dist2[k] - dist2) < 0.001f);
+                            found++;
+                        }
+                    }
+                    assert(found == 1);
+                }
+                assert(pairs->offsets[i + 1] - pairs->offsets[i] == expected);
+            }
+        }
+
+        {
+            // items mapped outside of the table are ignored
+            assert(qtree_find_all_pairs(tree, 30.f, 10, _test_index, NULL, pairs) == pairs);
+            for (size_t k = 0; k < pairs->count; k++) {
+                assert(pairs->indices[k] < 10);
+            }
+        } {
+            // negative radius
+            assert(qtree_find_all_pairs(tree, -1.f, 500, _test_index, NULL, pairs) == pairs);
+            assert(pairs->count == 0);
+        }
+
+        qtree_destroy(tree);
+    }
+
+    qpairs_destroy(pairs);
+    DONE();
+}
+
+static int _test_max_depth(QuadNode *node, QuadBounds bounds, void *ctx) {
+    if (node->depth > *(unsigned int *)ctx) {
+        *(unsigned int *)ctx = node->depth;
+    }
+    return QUAD_VISIT_CONTINUE;
+}
+
+static void test_deep_tree() {
+    DESCRIBE("deep clustered tree, explicit stacks");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {1.f, 1.f});
+    assert(qtree_configure(tree, 1, QUAD_DEPTH_LIMIT + 1) == -1);
+    assert(qtree_configure(tree, 1, QUAD_DEPTH_LIMIT) == 0);
+
+    // clustered towards the nw corner: every point halves the distance, one level deeper each
+    TestItem items[QUAD_DEPTH_LIMIT];
+    QuadList *list = qlist_create(1);
+    float p = 1.f;
+    for (int i = 0; i < QUAD_DEPTH_LIMIT; i++) {
+        p /= 2.f;
+        items[i] = (TestItem) {i, {p * 0.75f, p * 0.75f}};
+        assert(qtree_insert(tree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    unsigned int depth = 0;
+    assert(qtree_walk(tree, NULL, _test_max_depth, &depth) == QUAD_VISIT_CONTINUE);
+    assert(depth >= QUAD_DEPTH_LIMIT - 1);
+
+    for (int i = 0; i < QUAD_DEPTH_LIMIT; i++) {
+        assert(qtree_find(tree, items[i].pos)->data == &items[i]);
+    }
+
+    qtree_find_in_area(tree, (Vec2){0.f, 0.f}, 1.f, list);
+    assert(list->len == QUAD_DEPTH_LIMIT);
+
+    qlist_reset(list);
+    qtree_find_in_radius(tree, (Vec2){0.f, 0.f}, items[9].pos.x * 1.5f, list);
+    assert(list->len == QUAD_DEPTH_LIMIT - 9);
+
+    qlist_destroy(list);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static int _test_class(void *data, void *ctx) {
+    return ((TestItem *) data)->id % 3;
+}
+
+static int _test_counts(QuadNode *node, QuadBounds bounds, void *ctx) {
+    unsigned int count = 0;
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        count += bucket->len;
+    }
+    for (int i = 0; node->children && i < 4; i++) {
+        count += node->children[i].len;
+    }
+    assert(count == node->len);
+
+#if QUAD_CLASSES >= 3
+    unsigned int classes[3] = {0};
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            classes[_test_class(bucket->items[i].data, NULL)]++;
+        }
+    }
+    for (int k = 0; node->children && k < 4; k++) {
+        for (int i = 0; i < 3; i++) {
+            classes[i] += node->children[k].classes[i];
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        assert(classes[i] == node->classes[i]);
+    }
+#endif
+    return QUAD_VISIT_CONTINUE;
+}
+
+static void test_count_in_area() {
+    DESCRIBE("range counts from subtree counts");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {400.f, 400.f});
+    qtree_configure(tree, 2, QUAD_DEPTH_MAX);
+    assert(qtree_classify(tree, _test_class, NULL) == 0);
+
+    TestItem items[1000];
+    void *data[1000];
+    Vec2 positions[1000];
+    size_t classes[QUAD_CLASSES + 1];
+    size_t count, expected;
+    Vec2 nw, se;
+
+    for (int i = 0; i < 1000; i++) {
+        items[i] = (TestItem) {i, {(float) (rand() % 400), (float) (rand() % 400)}};
+        data[i] = &items[i];
+        positions[i] = items[i].pos;
+        qtree_insert(tree, &items[i], items[i].pos);
+    }
+
+    for (int round = 0; round < 3; round++) {
+        qtree_walk(tree, _test_counts, NULL, NULL);
+
+        for (int q = 0; q < 100; q++) {
+            nw = (Vec2) {(float) (rand() % 400), (float) (rand() % 400)};
+            se = (Vec2) {nw.x + rand() % 200, nw.y + rand() % 200};
+
+            // same as brute force (removed items are outside of all areas)
+            expected = 0;
+            size_t expected_classes[3] = {0};
+            for (int i = 0; i < 1000; i++) {
+                if (vec2_within(items[i].pos, nw, se)) {
+                    expected++;
+                    expected_classes[i % 3]++;
+                }
+            }
+
+            count = qtree_count_in_area(tree, nw, se, classes);
+            assert(count == expected);
+#if QUAD_CLASSES >= 3
+            for (int i = 0; i < 3; i++) {
+                assert(classes[i] == expected_classes[i]);
+            }
+#else
+            (void) expected_classes;
+#endif
+        }
+
+        // whole tree: one node
+        qtree_reset_counters(tree);
+        tree->counting = 1;
+        assert(qtree_count_in_area(tree, (Vec2) {0.f, 0.f}, (Vec2) {400.f, 400.f}, NULL) == tree->length);
+        assert(tree->counters.nodes == 1);
+        assert(tree->counters.tested == 0);
+        tree->counting = 0;
+
+        // subtree counts follow moves, removals and bulk builds
+        if (round == 0) {
+            for (int i = 0; i < 1000; i += 2) {
+                items[i].pos = (Vec2) {(float) (rand() % 400), (float) (rand() % 400)};
+                qtree_move(tree, &items[i], positions[i], items[i].pos);
+                positions[i] = items[i].pos;
+            }
+            for (int i = 1; i < 1000; i += 4) {
+                qtree_remove(tree, &items[i], items[i].pos);
+                items[i].pos = (Vec2) {-1.f, -1.f}; // not indexed any more
+            }
+        } else {
+            qtree_build_bulk(tree, data, positions, 1000, round);
+            for (int i = 0; i < 1000; i++) {
+                items[i].pos = positions[i];
+            }
+        }
+    }
+
+    qtree_destroy(tree);
+    DONE();
+}
+
+typedef struct TestField {
+    Vec2 pos;
+    Vec2 sum;    // sum of mass * (com - pos) / d^3
+    float scale; // sum of mass / d^2: the magnitude of the field without cancellation
+    float mass[3];
+    size_t visits;
+} TestField;
+
+static float _test_mass(void *data, void *ctx) {
+    return 1.f + ((TestItem *) data)->id % 5;
+}
+
+static int _test_field(Vec2 com, float mass, int class, QuadItem *item, void *ctx) {
+    TestField *field = ctx;
+    Vec2 delta = vec2_sub(com, field->pos);
+    float dist2 = delta.x * delta.x + delta.y * delta.y;
+
+    field->mass[class] += mass;
+    field->visits++;
+    if (dist2 > 0) {
+        float f = mass / (dist2 * sqrtf(dist2));
+        field->sum.x += f * delta.x;
+        field->sum.y += f * delta.y;
+        field->scale += mass / dist2;
+    }
+    return QUAD_VISIT_CONTINUE;
+}
+
+static int _test_masks(QuadNode *node, QuadBounds bounds, void *ctx) {
+    unsigned int mask = 0;
+    for (QuadBucket *bucket = node->bucket; bucket; bucket = bucket->next) {
+        for (unsigned int i = 0; i < bucket->len; i++) {
+            mask |= 1u << _test_class(bucket->items[i].data, NULL);
+        }
+    }
+    for (int k = 0; node->children && k < 4; k++) {
+        mask |= node->children[k].mask;
+    }
+    assert(mask == node->mask);
+    return QUAD_VISIT_CONTINUE;
+}
+
+static void test_find_mask() {
+    DESCRIBE("class masks, masked radius and knn queries");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {400.f, 400.f});
+    qtree_configure(tree, 2, QUAD_DEPTH_MAX);
+    assert(qtree_classify(tree, _test_class, NULL) == 0);
+
+    size_t len = 600;
+    TestItem *items = malloc(len * sizeof(TestItem));
+    void **data = malloc(len * sizeof(void *));
+    Vec2 *positions = malloc(len * sizeof(Vec2));
+    QuadList *list = qlist_create(8);
+    QuadList *all = qlist_create(8);
+    Vec2 pos, delta;
+    size_t expected;
+    unsigned int mask;
+
+    // class 2 only in the south-east quarter
+    for (size_t i = 0; i < len; i++) {
+        items[i] = (TestItem) {(int) i, {(float) (rand() % 200), (float) (rand() % 200)}};
+        if (i % 3 == 2) {
+            items[i].pos = vec2_add(items[i].pos, (Vec2){200.f, 200.f});
+        }
+        data[i] = &items[i];
+        positions[i] = items[i].pos;
+        qtree_insert(tree, &items[i], items[i].pos);
+    }
+
+    for (int round = 0; round < 3; round++) {
+        qtree_walk(tree, _test_masks, NULL, NULL);
+        assert(tree->root->mask == 7);
+
+        for (int q = 0; q < 50; q++) {
+            pos = (Vec2) {(float) (rand() % 400), (float) (rand() % 400)};
+            mask = 1 + q % 7;
+
+            // same as brute force
+            qlist_reset(list);
+            qtree_find_in_radius_mask(tree, pos, 60.f, mask, list);
+            expected = 0;
+            for (size_t i = 0; i < len; i++) {
+                delta = vec2_sub(items[i].pos, pos);
+                if ((mask & (1u << (i % 3))) && delta.x * delta.x + delta.y * delta.y <= 60.f * 60.f) {
+                    expected++;
+                    assert(_in_list((int) i, list));
+                }
+            }
+            assert(list->len == expected);
+
+            // nearest of the classes: the first ones of an unmasked search, filtered
+            qlist_reset(list);
+            qlist_reset(all);
+            qtree_find_knn_mask(tree, pos, 5, INFINITY, mask, list);
+            qtree_find_knn(tree, pos, len, INFINITY, all);
+            expected = 0;
+            for (size_t i = 0; i < all->len && expected < 5; i++) {
+                if (mask & (1u << (((TestItem *)all->items[i]->data)->id % 3))) {
+                    assert(list->dist2[expected] == all->dist2[i]);
+                    expected++;
+                }
+            }
+            assert(list->len == expected);
+        }
+
+        {
+            // the north-west quarter has no class 2: pruned without testing any item
+            qtree_reset_counters(tree);
+            tree->counting = 1;
+            qlist_reset(list);
+            qtree_find_in_radius_mask(tree, (Vec2){100.f, 100.f}, 50.f, 1u << 2, list);
+            assert(list->len == 0);
+            assert(tree->counters.tested == 0);
+            tree->counting = 0;
+
+            // unclassified: no mask matches
+            qlist_reset(list);
+            qtree_find_in_radius_mask(tree, (Vec2){100.f, 100.f}, 50.f, 1u << 15, list);
+            assert(list->len == 0);
+        }
+
+        // masks follow moves, removals and bulk builds
+        if (round == 0) {
+            for (size_t i = 2; i < len; i += 3) {
+                items[i].pos = vec2_sub(items[i].pos, (Vec2){200.f, 200.f}); // class 2 moves north-west
+                qtree_move(tree, &items[i], positions[i], items[i].pos);
+                positions[i] = items[i].pos;
+            }
+            qtree_walk(tree, _test_masks, NULL, NULL);
+            assert(tree->root->children[QUAD_SE].mask == 0);
+            for (size_t i = 2; i < len; i += 3) {
+                items[i].pos = vec2_add(items[i].pos, (Vec2){200.f, 200.f});
+                qtree_move(tree, &items[i], positions[i], items[i].pos);
+                positions[i] = items[i].pos;
+            }
+            for (size_t i = 0; i < len; i += 6) {
+                qtree_remove(tree, &items[i], items[i].pos);
+                items[i].pos = (Vec2){-1000.f, -1000.f}; // not indexed any more
+            }
+        } else {
+            for (size_t i = 0; i < len; i += 6) {
+                positions[i] = items[i].pos = (Vec2) {(float) (rand() % 200), (float) (rand() % 200)};
+            }
+            qtree_build_bulk(tree, data, positions, len, round);
+        }
+    }
+
+    free(items);
+    free(data);
+    free(positions);
+    qlist_destroy(list);
+    qlist_destroy(all);
+    qtree_destroy(tree);
+    DONE();
+}
+
+static void test_qmass() {
+    DESCRIBE("Barnes-Hut aggregates");
+    QuadTree *tree = qtree_create((Vec2){0.f, 0.f}, (Vec2) {1000.f, 1000.f});
+    qtree_configure(tree, 4, QUAD_DEPTH_MAX);
+    QuadMass *mass = qmass_create(3);
+    assert(mass != NULL);
+    assert(qmass_create(0) == NULL);
+
+    size_t len = 2000;
+    TestItem *items = malloc(len * sizeof(TestItem));
+    float total[3] = {0};
+    Vec2 com = {0.f, 0.f};
+    float all = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        items[i] = (TestItem) {(int) i, {(float) (rand() % 10000) / 10.f, (float) (rand() % 10000) / 10.f}};
+        qtree_insert(tree, &items[i], items[i].pos);
+        total[_test_class(&items[i], NULL)] += _test_mass(&items[i], NULL);
+        all += _test_mass(&items[i], NULL);
+        com.x += _test_mass(&items[i], NULL) * items[i].pos.x;
+        com.y += _test_mass(&items[i], NULL) * items[i].pos.y;
+    }
+    com.x /= all;
+    com.y /= all;
+
+    assert(qmass_build(mass, tree, _test_mass, _test_class, NULL) == 0);
+
+    {
+        // root: whole tree, pre-order with skip indices
+        assert(mass->len > 1);
+        assert(mass->nodes[0].node == tree->root);
+        assert(mass->nodes[0].next == mass->len);
+        assert(fabsf(mass->nodes[0].mass - all) < 0.01f);
+        assert(fabsf(mass->nodes[0].com.x - com.x) < 0.1f && fabsf(mass->nodes[0].com.y - com.y) < 0.1f);
+        for (int k = 0; k < 3; k++) {
+            assert(fabsf(mass->mass[k] - total[k]) < 0.01f);
+        }
+    }
+
+    Vec2 probes[] = {{500.f, 500.f}, {10.f, 990.f}, {1200.f, -50.f}, {items[0].pos.x, items[0].pos.y}};
+    for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+        TestField exact = {probes[p], {0}, 0, {0}, 0};
+        TestField approx = {probes[p], {0}, 0, {0}, 0};
+
+        // theta 0: every item
+        qmass_visit(mass, probes[p], 0.f, _test_field, &exact);
+        assert(exact.visits == len);
+
+        // all mass is accounted for once, by class
+        qmass_visit(mass, probes[p], .5f, _test_field, &approx);
+        assert(approx.visits < len / 4);
+        for (int k = 0; k < 3; k++) {
+            assert(fabsf(approx.mass[k] - total[k]) < 0.01f);
+            assert(fabsf(exact.mass[k] - total[k]) < 0.01f);
+        }
+
+        // within a few percent of the exact field's scale: the net field nearly cancels out within the cloud
+        float err = vec2_mag(vec2_sub(approx.sum, exact.sum));
+        assert(err <= 0.05f * exact.scale);
+    }
+
+    {
+        // rebuild after changes, keeps memory
+        qtree_remove(tree, &items[0], items[0].pos);
+        assert(qmass_build(mass, tree, _test_mass, NULL, NULL) == 0);
+        assert(fabsf(mass->nodes[0].mass - (all - _test_mass(&items[0], NULL))) < 0.01f);
+        assert(fabsf(mass->mass[0] - mass->nodes[0].mass) < 0.01f); // single class
+        assert(mass->mass[1] == 0.f);
+    }
+
+    free(items);
+    qmass_destroy(mass);
+    qtree_destroy(tree);
+    DONE();
+}
+
 void test_qtree_area(int argc, char **argv) {
-    test_qnode_within_area();
-    test_qnode_overlaps_area();
+    test_qbounds_within_area();
+    test_qbounds_overlaps_area();
 
     test_find_in_area();
+    test_find_knn();
+    test_find_knn_rollback();
+    test_find_in_radius();
+    test_find_on_segment();
+    test_toroidal();
+    test_count_in_area();
+    test_find_mask();
+    test_visit();
+    test_find_all_pairs();
+    test_qmass();
+    test_deep_tree();
 }
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <assert.h>
+
+#include "test.h"
+#include "sgrid.h"
+#include "qtree.h"
+
+typedef struct TestItem {
+    int id;
+    Vec2 pos; // control data, will not be queried within sgrid.h
+} TestItem;
+
+static int _in_list(int id, QuadList *list) {
+    for (size_t i = 0; i < list->len; i++) {
+        if (list->items[i] && list->items[i]->data) {
+            TestItem *item = (TestItem*) list->items[i]->data;
+            if (item->id == id) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void test_create() {
+    DESCRIBE("cells");
+    SpatialGrid *grid;
+
+    grid = sgrid_create((Vec2) {0.f, 0.f}, (Vec2) {800.f, 600.f}, 60.f);
+    assert(grid != NULL);
+    assert(grid->cols == 14);
+    assert(grid->rows == 10);
+    assert(grid->cell == 60.f);
+    sgrid_destroy(grid);
+
+    // invalid cell size
+    grid = sgrid_create((Vec2) {0.f, 0.f}, (Vec2) {800.f, 600.f}, 0.f);
+    assert(grid == NULL);
+
+    // tiny cells: capped
+    grid = sgrid_create((Vec2) {0.f, 0.f}, (Vec2) {800.f, 600.f}, 0.001f);
+    assert(grid != NULL);
+    assert(grid->cols * grid->rows <= SGRID_CELLS_MAX);
+    sgrid_destroy(grid);
+
+    DONE();
+}
+
+static void test_insert_find() {
+    DESCRIBE("insert, build, find");
+    SpatialGrid *grid = sgrid_create((Vec2) {1.f, 1.f}, (Vec2) {10.f, 10.f}, 2.f);
+
+    TestItem itm1 = {111, {8.f, 2.f}};
+    TestItem itm2 = {222, {1.f, 1.f}};
+    TestItem itm3 = {333, {0.f, 0.f}}; // outside
+    TestItem itm4 = {444, {8.f, 2.f}}; // coincident
+
+    int res;
+    QuadItem *found;
+
+    {
+        res = sgrid_insert(grid, &itm1, itm1.pos);
+        assert(res == QUAD_INSERTED);
+        res = sgrid_insert(grid, &itm2, itm2.pos);
+        assert(res == QUAD_INSERTED);
+        res = sgrid_insert(grid, &itm3, itm3.pos);
+        assert(res == QUAD_FAILED);
+        res = sgrid_insert(grid, &itm4, itm4.pos);
+        assert(res == QUAD_INSERTED);
+
+        assert(grid->length == 3);
+        assert(!grid->sorted);
+
+        res = sgrid_build(grid);
+        assert(res == 0);
+        assert(grid->sorted);
+
+        // grouped by cell
+        assert(grid->offsets[grid->cols * grid->rows] == 3);
+        assert(grid->offsets[1] - grid->offsets[0] == 1);
+    } {
+        found = sgrid_find(grid, (Vec2) {2.f, 2.f});
+        assert(found == NULL);
+
+        found = sgrid_find(grid, itm2.pos);
+        assert(found != NULL);
+        assert(found->data == &itm2);
+
+        found = sgrid_find(grid, itm1.pos);
+        assert(found != NULL);
+        assert(found->data == &itm1 || found->data == &itm4);
+    } {
+        // reset keeps capacity
+        size_t max = grid->max;
+        sgrid_reset(grid);
+        assert(grid->length == 0);
+        assert(grid->max == max);
+        assert(sgrid_find(grid, itm1.pos) == NULL);
+
+        QuadList *list = qlist_create(1);
+        sgrid_find_in_area(grid, itm1.pos, 5.f, list);
+        assert(list->len == 0);
+        qlist_destroy(list);
+    }
+
+    sgrid_destroy(grid);
+    DONE();
+}
+
+static void test_find_in_area() {
+    DESCRIBE("area");
+    SpatialGrid *grid = sgrid_create((Vec2){1.f, 1.f}, (Vec2) {10.f, 10.f}, 2.f);
+
+    float radius = 2.f;
+    Vec2 pos = (Vec2) {4.f, 4.f};
+
+    TestItem items[7] = {
+        {0, pos},
+        // inside
+        {1, {pos.x + (radius / 2.f), pos.y + (radius / 2.f)}},
+        {2, {pos.x + radius, pos.y + radius}},
+        {3, {pos.x - radius, pos.y - radius}},
+        // outside
+        {4, {1.f, 1.f}},
+        {5, {pos.x, pos.y + radius + 0.1}},
+        {6, {pos.x - radius - 0.1, pos.y}},
+    };
+
+    for (int i = 0; i < 7; i++) {
+        assert(sgrid_insert(grid, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    QuadList *list = qlist_create(1);
+    sgrid_find_in_area(grid, pos, radius, list);
+
+    assert(list->len == 4);
+    assert(_in_list(0, list));
+    assert(_in_list(1, list));
+    assert(_in_list(2, list));
+    assert(_in_list(3, list));
+
+    qlist_destroy(list);
+    sgrid_destroy(grid);
+    DONE();
+}
+
+static void test_same_as_qtree() {
+    DESCRIBE("same results as qtree");
+
+    Vec2 nw = {0.f, 0.f};
+    Vec2 se = {800.f, 600.f};
+    SpatialGrid *grid = sgrid_create(nw, se, 60.f);
+    QuadTree *qtree = qtree_create(nw, se);
+    qtree_configure(qtree, QUAD_BUCKET_MAX, QUAD_DEPTH_MAX);
+
+    TestItem items[1000];
+    for (int i = 0; i < 1000; i++) {
+        // coarse positions: plenty of coincident points and points on cell boundaries
+        items[i] = (TestItem) {i, {(float) (rand() % 200) * 4.f, (float) (rand() % 150) * 4.f}};
+        assert(sgrid_insert(grid, &items[i], items[i].pos) == QUAD_INSERTED);
+        assert(qtree_insert(qtree, &items[i], items[i].pos) == QUAD_INSERTED);
+    }
+
+    QuadList *glist = qlist_create(5);
+    QuadList *qlist = qlist_create(5);
+    Vec2 pos;
+    float radius;
+
+    for (int k = 0; k < 200; k++) {
+        // radii up to (and beyond) the cell size
+        pos = (Vec2) {(float) (rand() % 220) * 4.f - 40.f, (float) (rand() % 170) * 4.f - 40.f};
+        radius = (float) (rand() % 40) * 4.f;
+
+        qlist_reset(glist);
+        qlist_reset(qlist);
+        sgrid_find_in_area(grid, pos, radius, glist);
+        qtree_find_in_area(qtree, pos, radius, qlist);
+
+        assert(glist->len == qlist->len);
+        for (size_t i = 0; i < qlist->len; i++) {
+            assert(_in_list(((TestItem *) qlist->items[i]->data)->id, glist));
+        }
+
+        qlist_reset(glist);
+        qlist_reset(qlist);
+        sgrid_find_in_radius(grid, pos, radius, glist);
+        qtree_find_in_radius(qtree, pos, radius, qlist);
+
+        assert(glist->len == qlist->len);
+        for (size_t i = 0; i < qlist->len; i++) {
+            assert(_in_list(((TestItem *) qlist->items[i]->data)->id, glist));
+        }
+    }
+
+    qlist_destroy(glist);
+    qlist_destroy(qlist);
+    sgrid_destroy(grid);
+    qtree_destroy(qtree);
+    DONE();
+}
+
+void test_sgrid(int argc, char **argv) {
+    test_create();
+    test_insert_find();
+    test_find_in_area();
+    test_same_as_qtree();
+}